@@ -0,0 +1,416 @@
+#include "foothread.h"
+#include <time.h>
+
+// Micro-benchmarks of the primitives of libfoothread.so, each run side by side with its pthread equivalent:
+// thread create+join, mutex lock/unlock at 1..N threads, barrier round trip and handoff between two threads
+// through a mutex and a condition variable. Every measurement is a set of samples reported as percentiles.
+
+#define BENCH_STACK_SIZE FOOTHREAD_DEFAULT_STACK_SIZE // Stack of the threads of both libraries
+#define MUTEX_BATCH 64 // Lock/unlock pairs timed together, as a clock read costs about as much as one pair
+
+// Thread of either library, with the function it runs
+typedef struct {
+    foothread_t ft;
+    pthread_t pt;
+    void (*fn)(void *);
+    void *arg;
+} bthread_t;
+
+typedef union {
+    foothread_mutex_t ft;
+    pthread_mutex_t pt;
+} bmutex_t;
+
+typedef union {
+    foothread_barrier_t ft;
+    pthread_barrier_t pt;
+} bbarrier_t;
+
+typedef union {
+    foothread_cond_t ft;
+    pthread_cond_t pt;
+} bcond_t;
+
+// Operations of a library
+typedef struct {
+    const char *name;
+    int barrier_only; // A barrier algorithm of the same library, only run by the barrier benchmark
+    void (*create)(bthread_t *);
+    void (*join)(bthread_t *);
+    void (*mutex_init)(bmutex_t *);
+    void (*mutex_lock)(bmutex_t *);
+    void (*mutex_unlock)(bmutex_t *);
+    void (*mutex_destroy)(bmutex_t *);
+    void (*barrier_init)(bbarrier_t *, int);
+    void (*barrier_wait)(bbarrier_t *);
+    void (*barrier_destroy)(bbarrier_t *);
+    void (*cond_init)(bcond_t *);
+    void (*cond_wait)(bcond_t *, bmutex_t *);
+    void (*cond_signal)(bcond_t *);
+    void (*cond_destroy)(bcond_t *);
+} impl_t;
+
+int samples = 1000; // Samples of every measurement, after a tenth as many for warm up
+int max_threads = 0; // Largest thread count of the mutex and barrier benchmarks
+
+// Nanoseconds on the monotonic clock
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// foothread operations
+int ft_entry(void *arg) {
+    bthread_t *t = (bthread_t *)arg;
+    t->fn(t->arg);
+    return 0;
+}
+
+void ft_create(bthread_t *t) {
+    foothread_attr_t attr = FOOTHREAD_ATTR_INITIALIZER;
+    foothread_attr_setjointype(&attr, FOOTHREAD_JOINABLE);
+    foothread_attr_setstacksize(&attr, BENCH_STACK_SIZE);
+    foothread_create(&t->ft, &attr, ft_entry, t);
+}
+
+void ft_join(bthread_t *t) {
+    int retval;
+    foothread_join(&t->ft, &retval);
+}
+
+void ft_mutex_init(bmutex_t *m) { foothread_mutex_init(&m->ft); }
+void ft_mutex_lock(bmutex_t *m) { foothread_mutex_lock(&m->ft); }
+void ft_mutex_unlock(bmutex_t *m) { foothread_mutex_unlock(&m->ft); }
+void ft_mutex_destroy(bmutex_t *m) { foothread_mutex_destroy(&m->ft); }
+
+void ft_barrier_init_algorithm(bbarrier_t *b, int count, int algorithm) {
+    foothread_barrierattr_t attr = FOOTHREAD_BARRIERATTR_INITIALIZER;
+    foothread_barrierattr_setalgorithm(&attr, algorithm);
+    foothread_barrier_init_attr(&b->ft, count, &attr);
+}
+
+void ft_barrier_init(bbarrier_t *b, int count) { foothread_barrier_init(&b->ft, count); }
+void ft_barrier_init_central(bbarrier_t *b, int count) { ft_barrier_init_algorithm(b, count, FOOTHREAD_BARRIER_CENTRAL); }
+void ft_barrier_init_tree(bbarrier_t *b, int count) { ft_barrier_init_algorithm(b, count, FOOTHREAD_BARRIER_TREE); }
+void ft_barrier_init_dissemination(bbarrier_t *b, int count) { ft_barrier_init_algorithm(b, count, FOOTHREAD_BARRIER_DISSEMINATION); }
+void ft_barrier_wait(bbarrier_t *b) { foothread_barrier_wait(&b->ft); }
+void ft_barrier_destroy(bbarrier_t *b) { foothread_barrier_destroy(&b->ft); }
+
+void ft_cond_init(bcond_t *c) { foothread_cond_init(&c->ft); }
+void ft_cond_wait(bcond_t *c, bmutex_t *m) { foothread_cond_wait(&c->ft, &m->ft); }
+void ft_cond_signal(bcond_t *c) { foothread_cond_signal(&c->ft); }
+void ft_cond_destroy(bcond_t *c) { foothread_cond_destroy(&c->ft); }
+
+// pthread operations
+void *pt_entry(void *arg) {
+    bthread_t *t = (bthread_t *)arg;
+    t->fn(t->arg);
+    return NULL;
+}
+
+void pt_create(bthread_t *t) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BENCH_STACK_SIZE);
+    int err = pthread_create(&t->pt, &attr, pt_entry, t);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void pt_join(bthread_t *t) { pthread_join(t->pt, NULL); }
+
+void pt_mutex_init(bmutex_t *m) { pthread_mutex_init(&m->pt, NULL); }
+void pt_mutex_lock(bmutex_t *m) { pthread_mutex_lock(&m->pt); }
+void pt_mutex_unlock(bmutex_t *m) { pthread_mutex_unlock(&m->pt); }
+void pt_mutex_destroy(bmutex_t *m) { pthread_mutex_destroy(&m->pt); }
+
+void pt_barrier_init(bbarrier_t *b, int count) { pthread_barrier_init(&b->pt, NULL, count); }
+void pt_barrier_wait(bbarrier_t *b) { pthread_barrier_wait(&b->pt); }
+void pt_barrier_destroy(bbarrier_t *b) { pthread_barrier_destroy(&b->pt); }
+
+void pt_cond_init(bcond_t *c) { pthread_cond_init(&c->pt, NULL); }
+void pt_cond_wait(bcond_t *c, bmutex_t *m) { pthread_cond_wait(&c->pt, &m->pt); }
+void pt_cond_signal(bcond_t *c) { pthread_cond_signal(&c->pt); }
+void pt_cond_destroy(bcond_t *c) { pthread_cond_destroy(&c->pt); }
+
+#define FT_IMPL(name, barrier_only, barrier_init) \
+    {name, barrier_only, ft_create, ft_join, ft_mutex_init, ft_mutex_lock, ft_mutex_unlock, ft_mutex_destroy, \
+     barrier_init, ft_barrier_wait, ft_barrier_destroy, ft_cond_init, ft_cond_wait, ft_cond_signal, ft_cond_destroy}
+
+impl_t impls[] = {
+    {"pthread", 0, pt_create, pt_join, pt_mutex_init, pt_mutex_lock, pt_mutex_unlock, pt_mutex_destroy,
+     pt_barrier_init, pt_barrier_wait, pt_barrier_destroy, pt_cond_init, pt_cond_wait, pt_cond_signal, pt_cond_destroy},
+    FT_IMPL("foothread", 0, ft_barrier_init),
+    FT_IMPL("foothread/central", 1, ft_barrier_init_central),
+    FT_IMPL("foothread/tree", 1, ft_barrier_init_tree),
+    FT_IMPL("foothread/dissem", 1, ft_barrier_init_dissemination),
+};
+#define NUM_IMPLS ((int)(sizeof(impls) / sizeof(impls[0])))
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Print one row: percentiles of the samples (in ns per operation) and the throughput of the run
+void report(const char *bench, const impl_t *impl, int threads, long long *vals, int n, long long ops, long long elapsed_ns) {
+    qsort(vals, n, sizeof(long long), cmp_ll);
+    printf("%-14s %-18s %7d %8d %9lld %9lld %9lld %9lld %12.0f\n", bench, impl->name, threads, n, vals[n / 2],
+           vals[(int)(n * 0.90)], vals[(int)(n * 0.99)], vals[n - 1], ops * 1e9 / elapsed_ns);
+}
+
+// Thread create+join: one thread at a time for the latency, then batches of threads created before any is joined
+void nop(void *arg) { (void)arg; }
+
+void bench_create(const impl_t *impl) {
+    long long *vals = (long long *)malloc(samples * sizeof(long long));
+    bthread_t t = {.fn = nop, .arg = NULL};
+    for (int i = 0; i < samples / 10; i++) {
+        impl->create(&t);
+        impl->join(&t);
+    }
+    long long start = now_ns();
+    for (int i = 0; i < samples; i++) {
+        long long t0 = now_ns();
+        impl->create(&t);
+        impl->join(&t);
+        vals[i] = now_ns() - t0;
+    }
+    report("create+join", impl, 1, vals, samples, samples, now_ns() - start);
+
+    // Each sample is the time per thread of a batch
+    int batch = max_threads;
+    bthread_t *ts = (bthread_t *)calloc(batch, sizeof(bthread_t));
+    start = now_ns();
+    for (int i = 0; i < samples; i++) {
+        long long t0 = now_ns();
+        for (int j = 0; j < batch; j++) {
+            ts[j].fn = nop;
+            impl->create(&ts[j]);
+        }
+        for (int j = 0; j < batch; j++) impl->join(&ts[j]);
+        vals[i] = (now_ns() - t0) / batch;
+    }
+    report("create+join/b", impl, batch, vals, samples, (long long)samples * batch, now_ns() - start);
+    free(ts);
+    free(vals);
+}
+
+// Mutex lock/unlock by threads that all start together
+typedef struct {
+    const impl_t *impl;
+    bmutex_t *mutex;
+    bbarrier_t *start;
+    long *counter; // Critical section
+    long long *vals; // Samples of this thread
+    long long start_ns; // Span of the samples of this thread
+    long long end_ns;
+} mutex_arg_t;
+
+void mutex_worker(void *arg) {
+    mutex_arg_t *a = (mutex_arg_t *)arg;
+    const impl_t *impl = a->impl;
+    for (int i = 0; i < samples / 10 * MUTEX_BATCH; i++) {
+        impl->mutex_lock(a->mutex);
+        (*a->counter)++;
+        impl->mutex_unlock(a->mutex);
+    }
+    impl->barrier_wait(a->start);
+    a->start_ns = now_ns();
+    for (int i = 0; i < samples; i++) {
+        long long t0 = now_ns();
+        for (int j = 0; j < MUTEX_BATCH; j++) {
+            impl->mutex_lock(a->mutex);
+            (*a->counter)++;
+            impl->mutex_unlock(a->mutex);
+        }
+        a->vals[i] = (now_ns() - t0) / MUTEX_BATCH;
+    }
+    a->end_ns = now_ns();
+}
+
+void bench_mutex(const impl_t *impl, int threads) {
+    bmutex_t mutex;
+    bbarrier_t start;
+    long counter = 0;
+    impl->mutex_init(&mutex);
+    impl->barrier_init(&start, threads);
+    long long *vals = (long long *)malloc((long)threads * samples * sizeof(long long));
+    bthread_t *ts = (bthread_t *)calloc(threads, sizeof(bthread_t));
+    mutex_arg_t *args = (mutex_arg_t *)calloc(threads, sizeof(mutex_arg_t));
+    for (int i = 0; i < threads; i++) {
+        args[i] = (mutex_arg_t){impl, &mutex, &start, &counter, vals + (long)i * samples, 0, 0};
+        ts[i].fn = mutex_worker;
+        ts[i].arg = &args[i];
+        impl->create(&ts[i]);
+    }
+    long long first = LLONG_MAX, last = 0;
+    for (int i = 0; i < threads; i++) {
+        impl->join(&ts[i]);
+        if (args[i].start_ns < first) first = args[i].start_ns;
+        if (args[i].end_ns > last) last = args[i].end_ns;
+    }
+
+    long long ops = (long long)threads * samples * MUTEX_BATCH;
+    if (counter != ops + (long long)threads * (samples / 10) * MUTEX_BATCH) {
+        fprintf(stderr, "%s mutex lost updates: %ld\n", impl->name, counter);
+        exit(EXIT_FAILURE);
+    }
+    report("mutex", impl, threads, vals, threads * samples, ops, last - first);
+    impl->barrier_destroy(&start);
+    impl->mutex_destroy(&mutex);
+    free(args);
+    free(ts);
+    free(vals);
+}
+
+// Barrier round trip, timed by the main thread from entering a round to leaving it
+typedef struct {
+    const impl_t *impl;
+    bbarrier_t *barrier;
+} barrier_arg_t;
+
+void barrier_worker(void *arg) {
+    barrier_arg_t *a = (barrier_arg_t *)arg;
+    for (int i = 0; i < samples + samples / 10; i++) a->impl->barrier_wait(a->barrier);
+}
+
+void bench_barrier(const impl_t *impl, int threads) {
+    bbarrier_t barrier;
+    impl->barrier_init(&barrier, threads);
+    long long *vals = (long long *)malloc(samples * sizeof(long long));
+    bthread_t *ts = (bthread_t *)calloc(threads - 1, sizeof(bthread_t));
+    barrier_arg_t arg = {impl, &barrier};
+    for (int i = 0; i < threads - 1; i++) {
+        ts[i].fn = barrier_worker;
+        ts[i].arg = &arg;
+        impl->create(&ts[i]);
+    }
+    for (int i = 0; i < samples / 10; i++) impl->barrier_wait(&barrier);
+    long long start = now_ns();
+    for (int i = 0; i < samples; i++) {
+        long long t0 = now_ns();
+        impl->barrier_wait(&barrier);
+        vals[i] = now_ns() - t0;
+    }
+    long long elapsed = now_ns() - start;
+    for (int i = 0; i < threads - 1; i++) impl->join(&ts[i]);
+    report("barrier", impl, threads, vals, samples, samples, elapsed);
+    impl->barrier_destroy(&barrier);
+    free(ts);
+    free(vals);
+}
+
+// Handoff: two threads pass a turn back and forth through a mutex and a condition variable, so that every pass
+// wakes the other thread. A sample is half a round trip.
+typedef struct {
+    const impl_t *impl;
+    bmutex_t mutex;
+    bcond_t cond[2];
+    int turn;
+} handoff_t;
+
+void handoff_worker(void *arg) {
+    handoff_t *h = (handoff_t *)arg;
+    const impl_t *impl = h->impl;
+    impl->mutex_lock(&h->mutex);
+    for (int i = 0; i < samples + samples / 10; i++) {
+        while (h->turn != 1) impl->cond_wait(&h->cond[1], &h->mutex);
+        h->turn = 0;
+        impl->cond_signal(&h->cond[0]);
+    }
+    impl->mutex_unlock(&h->mutex);
+}
+
+void bench_handoff(const impl_t *impl) {
+    handoff_t h = {.impl = impl, .turn = 0};
+    impl->mutex_init(&h.mutex);
+    impl->cond_init(&h.cond[0]);
+    impl->cond_init(&h.cond[1]);
+    long long *vals = (long long *)malloc(samples * sizeof(long long));
+    bthread_t t = {.fn = handoff_worker, .arg = &h};
+    impl->create(&t);
+
+    long long start = 0;
+    impl->mutex_lock(&h.mutex);
+    for (int i = -(samples / 10); i < samples; i++) {
+        if (i == 0) start = now_ns();
+        long long t0 = now_ns();
+        h.turn = 1;
+        impl->cond_signal(&h.cond[1]);
+        while (h.turn != 0) impl->cond_wait(&h.cond[0], &h.mutex);
+        if (i >= 0) vals[i] = (now_ns() - t0) / 2;
+    }
+    impl->mutex_unlock(&h.mutex);
+    long long elapsed = now_ns() - start;
+    impl->join(&t);
+    report("handoff", impl, 2, vals, samples, 2LL * samples, elapsed);
+    impl->cond_destroy(&h.cond[1]);
+    impl->cond_destroy(&h.cond[0]);
+    impl->mutex_destroy(&h.mutex);
+    free(vals);
+}
+
+// Next thread count of the mutex and barrier benchmarks: doubling, with max_threads itself as the last step
+int next_threads(int threads) {
+    if (threads >= max_threads) return max_threads + 1;
+    return (threads < max_threads / 2) ? 2 * threads : max_threads;
+}
+
+void usage(char *prog) {
+    printf("Usage: %s [-n <Samples>] [-t <Max Threads>] [<Benchmark> ...]\n", prog);
+    printf("\t-n: samples of every measurement (default 1000)\n");
+    printf("\t-t: threads of the mutex and barrier benchmarks go 1, 2, 4, ... and <Max Threads> itself\n");
+    printf("\t    (default twice the CPUs available, at least 4)\n");
+    printf("\tBenchmarks: create, mutex, barrier, handoff (default all)\n");
+    exit(EXIT_FAILURE);
+}
+
+// Run the benchmarks given on the command line for pthreads and foothreads
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+            case 'n': samples = atoi(optarg); break;
+            case 't': max_threads = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (samples < 10 || max_threads < 0) usage(argv[0]);
+    if (max_threads == 0) {
+        cpu_set_t cpus;
+        max_threads = (sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == 0) ? 2 * CPU_COUNT(&cpus) : 4;
+        if (max_threads < 4) max_threads = 4;
+    }
+
+    const char *names[] = {"create", "mutex", "barrier", "handoff"};
+    int run[4] = {optind == argc, optind == argc, optind == argc, optind == argc};
+    for (int i = optind; i < argc; i++) {
+        int b;
+        for (b = 0; b < 4 && strcmp(argv[i], names[b]) != 0; b++);
+        if (b == 4) usage(argv[0]);
+        run[b] = 1;
+    }
+
+    printf("%-14s %-18s %7s %8s %9s %9s %9s %9s %12s\n", "benchmark", "library", "threads", "samples", "p50 ns",
+           "p90 ns", "p99 ns", "max ns", "ops/s");
+    for (int i = 0; i < NUM_IMPLS; i++) {
+        if (run[0] && !impls[i].barrier_only) bench_create(&impls[i]);
+    }
+    for (int threads = 1; run[1] && threads <= max_threads; threads = next_threads(threads)) {
+        for (int i = 0; i < NUM_IMPLS; i++) {
+            if (!impls[i].barrier_only) bench_mutex(&impls[i], threads);
+        }
+    }
+    for (int threads = 2; run[2] && threads <= max_threads; threads = next_threads(threads)) {
+        for (int i = 0; i < NUM_IMPLS; i++) bench_barrier(&impls[i], threads);
+    }
+    for (int i = 0; i < NUM_IMPLS; i++) {
+        if (run[3] && !impls[i].barrier_only) bench_handoff(&impls[i]);
+    }
+    return 0;
+}
@@ -1,13 +1,16 @@
 #include "foothread.h"
 
-// Maximum number of nodes in the tree
+// Maximum number of nodes in the tree when a thread is created for each node
 #define MAX_NODES 100
 
+// Leaves summed by a task of the reduction before it stops splitting its range
+#define LEAF_GRAIN 4096
+
 // Global variables
 int n; // Number of nodes in the tree
 int root_node; // ID of the root node in the tree
-int parent[MAX_NODES]; // Parent array of the tree
-int num_child[MAX_NODES]; // Number of children of a node in the tree
+int *parent; // Parent array of the tree
+int *num_child; // Number of children of a node in the tree
 foothread_mutex_t mutex_sum[MAX_NODES]; // Mutexes for each node to synchronize sum updates
 foothread_barrier_t barrier[MAX_NODES]; // Barriers for each node to synchronize its run only after its children are done
 foothread_barrier_t computation_done; // Barrier to indicate that the computation is done
@@ -15,11 +18,55 @@ foothread_mutex_t func_exec; // Mutex to ensure that only one function prints or
 int sum[MAX_NODES]; // Partial sums at each node
 int total_sum; // Total sum calculated at the root node
 
-// Function prototype
+// State of the reduction over a pool when leaf values come from a file
+int num_leaves; // Number of leaves in the tree
+int *leaves; // Leaf nodes in increasing order of ID
+int *leaf_val; // Value of each leaf, in the same order
+
+// Node of the reduction. Parents are spread over the tree, so everything a child touches in its parent is kept in
+// one 16-byte record to cost one cache miss per edge.
+typedef struct {
+    long long sum; // Partial sum
+    int parent;
+    uint32_t pending; // Children not yet added to the sum
+} __attribute__((aligned(16))) tree_node_t;
+
+tree_node_t *nodes;
+
+// Range of leaves handled by a task of the reduction
+typedef struct {
+    int lo;
+    int hi;
+} leaf_range_t;
+
+// Function prototypes
+int read_int(FILE *fp, int *value);
 int compute_sum(void* arg);
+void reduce_leaves(foothread_worker_t *worker, void *arg);
+long long reduce_tree(const char *leaf_file, int nworkers);
+
+void usage(char *prog) {
+    printf("Usage: %s [-l <Leaf Values File> [-w <Workers>]]\n", prog);
+    printf("\t-l: read the values of the leaves from a file (- for stdin), one per leaf in increasing order of node ID,\n");
+    printf("\t    and reduce the tree on a pool of <Workers> threads (default: the CPUs available) instead of\n");
+    printf("\t    creating one thread per node and asking for each leaf\n");
+    exit(EXIT_FAILURE);
+}
 
 // Main function
-int main() {
+int main(int argc, char *argv[]) {
+    char *leaf_file = NULL;
+    int nworkers = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:w:")) != -1) {
+        switch (opt) {
+            case 'l': leaf_file = optarg; break;
+            case 'w': nworkers = atoi(optarg); if (nworkers < 1) usage(argv[0]); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || (nworkers > 0 && leaf_file == NULL)) usage(argv[0]);
+
     // Read input tree from file
     FILE* fp = fopen("tree.txt", "r");
     if (fp == NULL) {
@@ -28,18 +75,31 @@ int main() {
     }
 
     // Read number of nodes in the tree
-    fscanf(fp, "%d", &n);
-    
+    if (!read_int(fp, &n) || n < 1) {
+        printf("ERROR: Invalid number of nodes in tree.txt\n");
+        exit(EXIT_FAILURE);
+    }
+    if (leaf_file == NULL && n > MAX_NODES) {
+        printf("ERROR: The tree has more than %d nodes, give the leaf values in a file with -l\n", MAX_NODES);
+        exit(EXIT_FAILURE);
+    }
+
     // Initialize arrays and variables
-    for(int i = 0; i < n; i++) {
-        num_child[i] = 0; // Initialize number of children to 0
+    parent = (int *)malloc(n * sizeof(int));
+    num_child = (int *)calloc(n, sizeof(int)); // Initialize number of children to 0
+    if (parent == NULL || num_child == NULL) {
+        perror("Error allocating the tree");
+        exit(EXIT_FAILURE);
     }
 
     // Read tree structure from file
     for (int i = 0; i < n; i++) {
         int node, par;
-        fscanf(fp, "%d %d", &node, &par);
-        
+        if (!read_int(fp, &node) || !read_int(fp, &par) || node < 0 || node >= n || par < 0 || par >= n) {
+            printf("ERROR: Invalid line %d in tree.txt\n", i + 2);
+            exit(EXIT_FAILURE);
+        }
+
         // Maintain the tree structure
         parent[node] = par;
         if(node != par) {
@@ -52,6 +112,15 @@ int main() {
     // Close the file
     fclose(fp);
 
+    // Non-interactive mode: reduce the tree on a pool
+    if (leaf_file != NULL) {
+        long long root_sum = reduce_tree(leaf_file, nworkers);
+        printf("Sum at root (node %d) = %lld\n", root_node, root_sum);
+        free(parent);
+        free(num_child);
+        return 0;
+    }
+
     // Initialize synchronization resources for each node
     total_sum = 0;
     foothread_mutex_init(&func_exec); // Mutex to ensure only one function prints or takes input at a time
@@ -65,6 +134,7 @@ int main() {
     // Create follower threads for each node
     foothread_t threads[MAX_NODES];
     foothread_attr_t attr;
+    foothread_attr_init(&attr);
     foothread_attr_setjointype(&attr, FOOTHREAD_JOINABLE); // Create a joinable thread for each node
     foothread_attr_setstacksize(&attr, FOOTHREAD_DEFAULT_STACK_SIZE); // Use the default stack size for each thread
     for (int i = 0; i < n; i++) {
@@ -84,6 +154,8 @@ int main() {
     }
     foothread_barrier_destroy(&computation_done);
     foothread_mutex_destroy(&func_exec);
+    free(parent);
+    free(num_child);
 
     // Synchronize threads before exit
     foothread_exit();
@@ -91,6 +163,24 @@ int main() {
     return 0;
 }
 
+// Read the next integer in a file, skipping whitespace. Returns 0 at the end of the file or on anything else.
+// Trees of millions of nodes are mostly numbers, where fscanf spends more time than the whole reduction.
+int read_int(FILE *fp, int *value) {
+    int c;
+    while ((c = getc_unlocked(fp)) == ' ' || c == '\n' || c == '\t' || c == '\r');
+    int negative = (c == '-');
+    if (negative) c = getc_unlocked(fp);
+    if (c < '0' || c > '9') return 0;
+    long long v = 0;
+    do {
+        v = v * 10 + (c - '0');
+        if (v > INT_MAX) return 0;
+    } while ((c = getc_unlocked(fp)) >= '0' && c <= '9');
+    if (c != EOF) ungetc(c, fp);
+    *value = negative ? -v : v;
+    return 1;
+}
+
 // Function to compute sum at each node
 int compute_sum(void* arg) {
     int node_id = (intptr_t)arg;
@@ -138,3 +228,93 @@ int compute_sum(void* arg) {
 
     return 0;
 }
+
+// Reduce the tree bottom-up on a pool of nworkers threads, with the values of the leaves read from a file. Each
+// task takes a range of leaves, splitting it while it is large so that idle workers can steal the halves, and
+// carries every leaf up the tree: it adds the sum of the node to its parent and counts the parent's pending
+// children down. The task that counts a parent down to zero owns its complete sum and carries it further up, so
+// no thread ever waits for another.
+long long reduce_tree(const char *leaf_file, int nworkers) {
+    FILE *fp = (strcmp(leaf_file, "-") == 0) ? stdin : fopen(leaf_file, "r");
+    if (fp == NULL) {
+        perror(leaf_file);
+        exit(EXIT_FAILURE);
+    }
+
+    nodes = (tree_node_t *)malloc(n * sizeof(tree_node_t));
+    leaves = (int *)malloc(n * sizeof(int));
+    if (nodes == NULL || leaves == NULL) {
+        perror("Error allocating the tree");
+        exit(EXIT_FAILURE);
+    }
+    num_leaves = 0;
+    for (int i = 0; i < n; i++) {
+        nodes[i].sum = 0;
+        nodes[i].parent = parent[i];
+        nodes[i].pending = num_child[i];
+        if (num_child[i] == 0) leaves[num_leaves++] = i;
+    }
+
+    // Read one value per leaf
+    leaf_val = (int *)malloc(num_leaves * sizeof(int));
+    if (leaf_val == NULL) {
+        perror("Error allocating the leaf values");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_leaves; i++) {
+        if (!read_int(fp, &leaf_val[i])) {
+            printf("ERROR: %s has %d values for %d leaves\n", leaf_file, i, num_leaves);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (fp != stdin) fclose(fp);
+
+    if (nworkers == 0) {
+        cpu_set_t cpus;
+        nworkers = (sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == 0) ? CPU_COUNT(&cpus) : 1;
+    }
+    foothread_pool_t pool;
+    foothread_pool_init(&pool, nworkers);
+    leaf_range_t all = {0, num_leaves};
+    foothread_pool_run(&pool, reduce_leaves, &all);
+    foothread_pool_destroy(&pool);
+
+    long long root_sum = nodes[root_node].sum;
+    free(nodes);
+    free(leaves);
+    free(leaf_val);
+    return root_sum;
+}
+
+// Task of the reduction over a range of leaves
+void reduce_leaves(foothread_worker_t *worker, void *arg) {
+    leaf_range_t *range = (leaf_range_t *)arg;
+
+    // Split large ranges, running one half here and leaving the other to be stolen
+    if (range->hi - range->lo > LEAF_GRAIN) {
+        int mid = range->lo + (range->hi - range->lo) / 2;
+        leaf_range_t upper = {mid, range->hi};
+        leaf_range_t lower = {range->lo, mid};
+        foothread_taskgroup_t group = FOOTHREAD_TASKGROUP_INITIALIZER;
+        foothread_spawn(worker, &group, reduce_leaves, &upper);
+        reduce_leaves(worker, &lower);
+        foothread_sync(worker, &group);
+        return;
+    }
+
+    for (int i = range->lo; i < range->hi; i++) {
+        tree_node_t *node = &nodes[leaves[i]];
+        long long node_sum = leaf_val[i];
+        node->sum = node_sum;
+
+        // Carry the sum up while this task completes the parent
+        while (node != &nodes[node->parent]) {
+            tree_node_t *par = &nodes[node->parent];
+            __atomic_add_fetch(&par->sum, node_sum, __ATOMIC_RELAXED);
+            if (__atomic_sub_fetch(&par->pending, 1, __ATOMIC_ACQ_REL) != 0) break;
+            // The last child to arrive sees every earlier addition in the count it took to zero
+            node_sum = __atomic_load_n(&par->sum, __ATOMIC_RELAXED);
+            node = par;
+        }
+    }
+}
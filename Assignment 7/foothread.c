@@ -1,26 +1,475 @@
 #include <foothread.h>
 
-// Structure to hold function pointer and arguments
+// Threads with TLS of their own need the x86-64 TCB layout of glibc
+#if defined(__x86_64__) && defined(__GLIBC__) && !defined(FOOTHREAD_SHARED_TLS)
+#define FOOTHREAD_OWN_TLS
+#endif
+
+// glibc releases (2.x) whose ld.so calls and TCB layout foothreads with TLS of their own rely on
+#define FOOTHREAD_GLIBC_MIN_MINOR 26
+#define FOOTHREAD_GLIBC_MAX_MINOR 40
+
+// States of a registry slot
+#define FOOTHREAD_SLOT_FREE 0 // On the free list (or never used)
+#define FOOTHREAD_SLOT_LIVE 1 // Thread created, not joined
+#define FOOTHREAD_SLOT_JOINING 2 // A thread is joining it
+#define FOOTHREAD_SLOT_RETIRED 3 // Detached thread done with its routine, its stack to be released once it has exited
+
+// Registry entry of a thread
 typedef struct {
+    pid_t tid; // Written by the kernel at clone, cleared with a futex wake once the thread has exited
+    uint32_t gen; // Bumped whenever the slot is recycled, to tell stale handles apart
+    int state; // FOOTHREAD_SLOT_*
+    int join_type;
+    void *stack;
+    size_t stack_size;
+    int has_affinity; // Applied by the thread itself before its start routine
+    cpu_set_t cpus;
+    void *tcb; // Thread pointer of the thread: its TCB, with its static TLS below, both at the top of the stack
     int (*start_routine)(void *);
     void *args;
-} func_and_args;
+    int retval; // Return value of the start routine
+    int next_free; // Next slot on the free list, -1 at the end
+} foothread_slot_t;
 
-// Structure to manage threads
+// Registry of threads: chunk c holds FOOTHREAD_REGISTRY_FIRST << c slots, allocated when first needed and never
+// freed, so a slot stays where it is. Slots of joined and exited detached threads are recycled through a
+// lock-free free list, so the registry only grows with the number of threads alive at once.
+#define FOOTHREAD_REGISTRY_FIRST 64
+#define FOOTHREAD_REGISTRY_CHUNKS 25
 typedef struct {
-    foothread_t threads[FOOTHREAD_THREADS_MAX];
-    foothread_attr_t attrs[FOOTHREAD_THREADS_MAX];
-    sem_t mutex[FOOTHREAD_THREADS_MAX];
-    void *stack[FOOTHREAD_THREADS_MAX];
-    int live[FOOTHREAD_THREADS_MAX];
-    int count;
-} foothread_manager_t;
+    foothread_slot_t *chunk[FOOTHREAD_REGISTRY_CHUNKS];
+    int size; // Slots handed out so far
+    uint64_t free_head; // Free list: slot + 1 in the low 32 bits (0 if empty), a tag against ABA in the high ones
+} foothread_registry_t;
 
-// Static instances of thread manager and mutex
-static foothread_manager_t foothread_manager;
-static sem_t manager_mutex;
+// Static instance of thread registry
+static foothread_registry_t foothread_registry;
 static int init_done = 0;
 
+#ifdef FOOTHREAD_OWN_TLS
+// Whether foothreads get TLS of their own, decided once before the first thread or key is created
+static int tls_own = 0;
+#endif
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+
+// Value of a key in a thread
+typedef struct foothread_specific {
+    uintptr_t seq;
+    void *value;
+} foothread_specific_t;
+
+// Thread id of the calling thread (0 until first asked); with shared TLS, only of the thread whose TLS it is. Read
+// on every lock, so kept in the static TLS of the program, which has room for a library linked at startup.
+static __thread pid_t self_tid __attribute__((tls_model("initial-exec"))) = 0;
+
+// Values of the keys in the calling thread; with shared TLS, only in the thread whose TLS it is
+static __thread foothread_specific_t foothread_specific[FOOTHREAD_KEYS_MAX];
+
+#ifdef FOOTHREAD_OWN_TLS
+// Registry index of the calling thread, -1 in the main thread
+static __thread int self_index __attribute__((tls_model("initial-exec"))) = -1;
+
+// Every foothread gets a TLS block and thread control block (TCB) of its own, set up with the GLIBC_PRIVATE calls
+// of ld.so that pthread_create uses for its threads: errno, stdio locks, malloc arenas and __thread variables are
+// then per thread. glibc only turns on its locking for threads from pthread_create, so one pthread is created
+// and joined before the first foothread; it also checks that the thread id and robust list are where the
+// TCB_TID and TCB_ROBUST_HEAD say.
+extern void _dl_get_tls_static_info(size_t *size, size_t *align);
+extern void *_dl_allocate_tls(void *mem);
+extern void _dl_deallocate_tls(void *tcb, int dealloc_tcb);
+
+static size_t tls_static_size, tls_static_align;
+
+// Fields of the x86-64 TCB header (tcbhead_t in glibc), by offset from the thread pointer
+#define TCB_SELF 0x00 // tcb: the thread pointer itself
+#define TCB_DESCRIPTOR 0x10 // self: the thread descriptor, which starts at the thread pointer
+#define TCB_MULTIPLE_THREADS 0x18
+#define TCB_STACK_GUARD 0x28 // Read by -fstack-protector code
+#define TCB_POINTER_GUARD 0x30 // Mangles the pointers of setjmp and atexit, shared by all threads
+#define TCB_TID 0x2d0 // tid of the descriptor: owner of error-checking and recursive mutexes and of ld.so locks
+#define TCB_ROBUST_HEAD 0x2e0 // robust_head of the descriptor: robust mutexes held, for the kernel at thread exit
+
+// Robust list head of the kernel, as in the descriptor; futex_offset comes from the pthread of tls_init
+typedef struct {
+    void *list; // Circular, an empty list points to itself
+    long futex_offset; // From a list entry to the lock word of its mutex
+    void *list_op_pending;
+} tcb_robust_head_t;
+
+static long tls_robust_futex_offset;
+#endif
+
+// With shared TLS a foothread keeps its registry index and key values in a record at the top of its stack. Stacks
+// are aligned on their size, so the thread finds the record by rounding its stack pointer up to that size.
+typedef struct {
+    foothread_specific_t specific[FOOTHREAD_KEYS_MAX];
+    int index; // Registry index of the thread
+    char *top; // Top of the stack, just above the record, to tell it from other data
+} stack_record_t;
+
+// Stack of the thread whose TLS the caller shares, set when that thread creates its first foothread: with the
+// same TLS, a stack pointer outside it is on the stack of a foothread
+static __thread char *root_stack_low __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread char *root_stack_high __attribute__((tls_model("initial-exec"))) = NULL;
+
+// Spins on a busy mutex before sleeping on the futex
+#define FOOTHREAD_MUTEX_SPINS 100
+
+// Hint to the CPU that the caller is spinning
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+// Wait on / wake a futex word shared by the threads of this process
+static void futex_wait(uint32_t *word, uint32_t val) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word, int n) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// Lock word of three states (FOOTHREAD_MUTEX_*), behind foothread_mutex_t and the internal locks
+static void lock_word_acquire(uint32_t *word) {
+    // Fast path: take a free lock with a single compare-and-swap
+    uint32_t c = FOOTHREAD_MUTEX_UNLOCKED;
+    if (!__atomic_compare_exchange_n(word, &c, FOOTHREAD_MUTEX_LOCKED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        // Busy: spin a little in case the holder is about to release it
+        for (int i = 0; i < FOOTHREAD_MUTEX_SPINS && c != FOOTHREAD_MUTEX_UNLOCKED; i++) {
+            cpu_relax();
+            c = __atomic_load_n(word, __ATOMIC_RELAXED);
+            if (c == FOOTHREAD_MUTEX_UNLOCKED &&
+                __atomic_compare_exchange_n(word, &c, FOOTHREAD_MUTEX_LOCKED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        // Still busy: mark the lock contended and sleep until it is free. Once the lock has been marked
+        // contended it is taken as contended, as another waiter may still be asleep.
+        if (c != FOOTHREAD_MUTEX_UNLOCKED) {
+            if (c != FOOTHREAD_MUTEX_CONTENDED) c = __atomic_exchange_n(word, FOOTHREAD_MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+            while (c != FOOTHREAD_MUTEX_UNLOCKED) {
+                futex_wait(word, FOOTHREAD_MUTEX_CONTENDED);
+                c = __atomic_exchange_n(word, FOOTHREAD_MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+}
+
+// Release a lock word; only wake a waiter if there may be one
+static void lock_word_release(uint32_t *word) {
+    if (__atomic_exchange_n(word, FOOTHREAD_MUTEX_UNLOCKED, __ATOMIC_RELEASE) == FOOTHREAD_MUTEX_CONTENDED) {
+        futex_wake(word, 1);
+    }
+}
+
+// Stacks are mapped with a guard page below them, so that an overflow faults instead of running into other
+// memory, and without reserving swap: only the pages a thread touches get committed. Freed stacks are kept in
+// a cache of buckets by size (a power of two of pages each), so that creating a thread usually reuses one. Every
+// stack is aligned on its size, for the stack records of shared TLS.
+#define FOOTHREAD_STACK_BUCKETS 32
+#define FOOTHREAD_STACK_CACHE_MAX 16 // Stacks kept per bucket, the others are unmapped
+
+// A cached stack, linked through its lowest word
+typedef struct stack_cache_entry {
+    struct stack_cache_entry *next;
+} stack_cache_entry_t;
+
+typedef struct {
+    uint32_t lock; // Lock word
+    int count;
+    stack_cache_entry_t *head;
+} stack_bucket_t;
+
+static stack_bucket_t stack_cache[FOOTHREAD_STACK_BUCKETS];
+static size_t page_size = 0;
+static uint32_t stack_buckets_used = 0; // Bit b set once a stack of bucket b has been mapped
+
+// Bucket of a requested stack size, and the size of the stacks in it
+static int stack_bucket(size_t size, size_t *bucket_size) {
+    if (page_size == 0) page_size = sysconf(_SC_PAGESIZE);
+    int b = 0;
+    while ((page_size << b) < size) b++;
+    *bucket_size = page_size << b;
+    return b;
+}
+
+// Get a stack of at least size bytes; the size it really has goes to stack_size
+static void *stack_alloc(size_t size, size_t *stack_size) {
+    int b = stack_bucket(size, stack_size);
+    if (b >= FOOTHREAD_STACK_BUCKETS) return NULL;
+
+    stack_bucket_t *bucket = &stack_cache[b];
+    lock_word_acquire(&bucket->lock);
+    stack_cache_entry_t *entry = bucket->head;
+    if (entry != NULL) {
+        bucket->head = entry->next;
+        bucket->count--;
+    }
+    lock_word_release(&bucket->lock);
+    if (entry != NULL) return entry;
+
+    // Map twice the size and trim it down to an aligned stack and its guard page
+    size_t map_size = 2 * *stack_size + page_size;
+    char *base = (char *)mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK|MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    char *stack = (char *)(((uintptr_t)base + page_size + *stack_size - 1) & ~(uintptr_t)(*stack_size - 1));
+    if (stack - page_size > base) munmap(base, stack - page_size - base);
+    if (stack + *stack_size < base + map_size) munmap(stack + *stack_size, base + map_size - (stack + *stack_size));
+    if (mprotect(stack - page_size, page_size, PROT_NONE) == -1) {
+        munmap(stack - page_size, *stack_size + page_size);
+        return NULL;
+    }
+    __atomic_fetch_or(&stack_buckets_used, 1u << b, __ATOMIC_RELEASE);
+    return stack;
+}
+
+// Give back a stack no thread runs on any more
+static void stack_release(void *stack, size_t stack_size) {
+    size_t bucket_size;
+    stack_bucket_t *bucket = &stack_cache[stack_bucket(stack_size, &bucket_size)];
+    lock_word_acquire(&bucket->lock);
+    if (bucket->count < FOOTHREAD_STACK_CACHE_MAX) {
+        stack_cache_entry_t *entry = (stack_cache_entry_t *)stack;
+        entry->next = bucket->head;
+        bucket->head = entry;
+        bucket->count++;
+        stack = NULL;
+    }
+    lock_word_release(&bucket->lock);
+    if (stack != NULL) munmap((char *)stack - page_size, stack_size + page_size);
+}
+
+// Slot of an index, NULL if its chunk is not allocated yet
+static foothread_slot_t *registry_slot(int idx) {
+    unsigned q = (unsigned)idx / FOOTHREAD_REGISTRY_FIRST + 1;
+    int c = 31 - __builtin_clz(q);
+    foothread_slot_t *chunk = __atomic_load_n(&foothread_registry.chunk[c], __ATOMIC_ACQUIRE);
+    if (chunk == NULL) return NULL;
+    return &chunk[idx - FOOTHREAD_REGISTRY_FIRST * ((1 << c) - 1)];
+}
+
+// Put a slot on the free list
+static void registry_push(int idx) {
+    foothread_slot_t *slot = registry_slot(idx);
+    uint64_t head = __atomic_load_n(&foothread_registry.free_head, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        __atomic_store_n(&slot->next_free, (int)(uint32_t)head - 1, __ATOMIC_RELAXED);
+        next = (((head >> 32) + 1) << 32) | (uint32_t)(idx + 1);
+    } while (!__atomic_compare_exchange_n(&foothread_registry.free_head, &head, next, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Take a slot off the free list, -1 if it is empty. Slots are never freed, so the next link of a slot taken
+// meanwhile by another thread can still be read: the tag makes the compare-and-swap fail then.
+static int registry_pop() {
+    uint64_t head = __atomic_load_n(&foothread_registry.free_head, __ATOMIC_ACQUIRE);
+    while ((uint32_t)head != 0) {
+        int idx = (int)(uint32_t)head - 1;
+        int next = __atomic_load_n(&registry_slot(idx)->next_free, __ATOMIC_RELAXED);
+        uint64_t new_head = (((head >> 32) + 1) << 32) | (uint32_t)(next + 1);
+        if (__atomic_compare_exchange_n(&foothread_registry.free_head, &head, new_head, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+// Get a slot for a new thread: a recycled one if any, else a new one at the end of the registry
+static int registry_alloc() {
+    int idx = registry_pop();
+    if (idx >= 0) return idx;
+
+    idx = __atomic_fetch_add(&foothread_registry.size, 1, __ATOMIC_ACQ_REL);
+    unsigned q = (unsigned)idx / FOOTHREAD_REGISTRY_FIRST + 1;
+    int c = 31 - __builtin_clz(q);
+    if (idx < 0 || c >= FOOTHREAD_REGISTRY_CHUNKS) {
+        printf("ERROR: Maximum number of threads reached\n");
+        exit(EXIT_FAILURE);
+    }
+    if (__atomic_load_n(&foothread_registry.chunk[c], __ATOMIC_ACQUIRE) == NULL) {
+        // Whoever loses the race to install the chunk frees its own
+        foothread_slot_t *chunk = (foothread_slot_t *)calloc((size_t)FOOTHREAD_REGISTRY_FIRST << c, sizeof(foothread_slot_t));
+        if (chunk == NULL) {
+            printf("ERROR: Unable to grow the thread registry\n");
+            exit(EXIT_FAILURE);
+        }
+        foothread_slot_t *expected = NULL;
+        if (!__atomic_compare_exchange_n(&foothread_registry.chunk[c], &expected, chunk, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(chunk);
+        }
+    }
+    return idx;
+}
+
+// Wait until the kernel has cleared the thread id of a slot, i.e. the thread no longer runs on its stack. The
+// kernel wakes with a shared futex operation, so the wait cannot be a private one.
+static void slot_wait_exited(foothread_slot_t *slot) {
+    pid_t tid;
+    while ((tid = __atomic_load_n(&slot->tid, __ATOMIC_ACQUIRE)) != 0) {
+        syscall(SYS_futex, &slot->tid, FUTEX_WAIT, tid, NULL, NULL, 0);
+    }
+}
+
+// Stack record of the calling thread with shared TLS, NULL if it is not a foothread. Only sizes stacks have been
+// mapped with are tried, from the smallest: up to the size of the stack of the caller, the record read is on
+// that stack, and it is only taken if the registry has a stack with that top.
+static stack_record_t *stack_record_self() {
+    char here;
+    char *sp = &here;
+    if (root_stack_high == NULL || (sp >= root_stack_low && sp < root_stack_high)) return NULL;
+    uint32_t used = __atomic_load_n(&stack_buckets_used, __ATOMIC_ACQUIRE);
+    while (used != 0) {
+        size_t size = page_size << __builtin_ctz(used);
+        used &= used - 1;
+        char *top = (char *)(((uintptr_t)sp | (size - 1)) + 1);
+        stack_record_t *record = (stack_record_t *)(top - sizeof(stack_record_t));
+        if (record->top != top) continue;
+        int idx = record->index;
+        foothread_slot_t *slot = (idx >= 0 && idx < __atomic_load_n(&foothread_registry.size, __ATOMIC_ACQUIRE)) ? registry_slot(idx) : NULL;
+        if (slot != NULL && (char *)slot->stack + slot->stack_size == top) return record;
+    }
+    return NULL;
+}
+
+// Registry index of the calling thread, -1 for the main thread or any thread not created here
+static int foothread_self() {
+#ifdef FOOTHREAD_OWN_TLS
+    if (tls_own) return self_index;
+#endif
+    stack_record_t *record = stack_record_self();
+    return (record != NULL) ? record->index : -1;
+}
+
+// Thread id of the caller, without a system call after the first one
+static pid_t foothread_self_tid() {
+#ifdef FOOTHREAD_OWN_TLS
+    if (tls_own) {
+        if (self_tid == 0) self_tid = (self_index >= 0) ? registry_slot(self_index)->tid : getpid();
+        return self_tid;
+    }
+#endif
+    stack_record_t *record = stack_record_self();
+    if (record != NULL) return registry_slot(record->index)->tid;
+    if (self_tid == 0) self_tid = getpid();
+    return self_tid;
+}
+
+// Values of the keys in the calling thread
+static foothread_specific_t *foothread_self_specific() {
+#ifdef FOOTHREAD_OWN_TLS
+    if (tls_own) return foothread_specific;
+#endif
+    stack_record_t *record = stack_record_self();
+    return (record != NULL) ? record->specific : foothread_specific;
+}
+
+#ifdef FOOTHREAD_OWN_TLS
+// Run in a pthread: whether its descriptor holds its thread id at TCB_TID and its (empty) robust list at
+// TCB_ROBUST_HEAD
+static void *tls_check(void *arg) {
+    char *descriptor = (char *)pthread_self();
+    tcb_robust_head_t *robust = (tcb_robust_head_t *)(descriptor + TCB_ROBUST_HEAD);
+    *(int *)arg = *(pid_t *)(descriptor + TCB_TID) == (pid_t)syscall(SYS_gettid) && robust->list == robust;
+    tls_robust_futex_offset = robust->futex_offset;
+    return NULL;
+}
+#endif
+
+// Give foothreads TLS of their own if this glibc is one whose internals they rely on
+static void tls_init() {
+#ifdef FOOTHREAD_OWN_TLS
+    int major, minor;
+    if (sscanf(gnu_get_libc_version(), "%d.%d", &major, &minor) != 2 || major != 2 ||
+        minor < FOOTHREAD_GLIBC_MIN_MINOR || minor > FOOTHREAD_GLIBC_MAX_MINOR) return;
+    _dl_get_tls_static_info(&tls_static_size, &tls_static_align);
+    pthread_t thread;
+    int layout_ok = 0;
+    if (pthread_create(&thread, NULL, tls_check, &layout_ok) != 0 || pthread_join(thread, NULL) != 0) {
+        printf("ERROR: Unable to set up thread-local storage\n");
+        exit(EXIT_FAILURE);
+    }
+    tls_own = layout_ok;
+#endif
+}
+
+// Room taken for the TLS, or the stack record with shared TLS, at the top of a stack
+static size_t tls_reserve() {
+#ifdef FOOTHREAD_OWN_TLS
+    if (tls_own) return 2 * tls_static_size + tls_static_align;
+#endif
+    return sizeof(stack_record_t);
+}
+
+// Note the stack of the calling thread before its first foothread, which shares its TLS
+static void root_stack_init() {
+    pthread_attr_t attr;
+    void *low;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0 || pthread_attr_getstack(&attr, &low, &size) != 0) {
+        printf("ERROR: Unable to find the stack of the calling thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+    root_stack_low = (char *)low;
+    root_stack_high = (char *)low + size;
+}
+
+#ifdef FOOTHREAD_OWN_TLS
+
+// Set up the TLS of a new thread below top: the TCB at the thread pointer, with room above it for the rest of the
+// thread descriptor of glibc, and the static TLS blocks below it. Returns the thread pointer.
+static char *tls_setup(char *top) {
+    char *tp = (char *)(((uintptr_t)top - tls_static_size) & ~(uintptr_t)(tls_static_align - 1));
+    memset(tp - tls_static_size, 0, top - (tp - tls_static_size));
+    if (_dl_allocate_tls(tp) == NULL) {
+        printf("ERROR: Unable to allocate thread-local storage\n");
+        exit(EXIT_FAILURE);
+    }
+    uintptr_t guard;
+    *(void **)(tp + TCB_SELF) = tp;
+    *(void **)(tp + TCB_DESCRIPTOR) = tp;
+    *(int *)(tp + TCB_MULTIPLE_THREADS) = 1;
+    __asm__ ("mov %%fs:0x28, %0" : "=r" (guard));
+    *(uintptr_t *)(tp + TCB_STACK_GUARD) = guard;
+    __asm__ ("mov %%fs:0x30, %0" : "=r" (guard));
+    *(uintptr_t *)(tp + TCB_POINTER_GUARD) = guard;
+#ifdef RSEQ_SIG
+    // The thread is not registered for restartable sequences: glibc then asks the kernel for the CPU
+    if (__rseq_size > 0) ((struct rseq *)(tp + __rseq_offset))->cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+#endif
+    return tp;
+}
+#endif
+
+// Release the TLS and stack of an exited thread
+static void slot_release_stack(foothread_slot_t *slot) {
+#ifdef FOOTHREAD_OWN_TLS
+    if (slot->tcb != NULL) _dl_deallocate_tls(slot->tcb, 0);
+#endif
+    stack_release(slot->stack, slot->stack_size);
+    slot->stack = NULL;
+    slot->tcb = NULL;
+}
+
+// Release the TLS and stack of an exited thread and put its slot back on the free list
+static void slot_recycle(int idx) {
+    foothread_slot_t *slot = registry_slot(idx);
+    slot_release_stack(slot);
+    __atomic_add_fetch(&slot->gen, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state, FOOTHREAD_SLOT_FREE, __ATOMIC_RELEASE);
+    registry_push(idx);
+}
+
+// Initialize thread attributes to the defaults
+void foothread_attr_init(foothread_attr_t *attr) {
+    if(attr==NULL)return;
+    foothread_attr_t default_attr = FOOTHREAD_ATTR_INITIALIZER;
+    *attr = default_attr;
+}
+
 // Set join type attribute for thread
 void foothread_attr_setjointype(foothread_attr_t *attr, int join_type) {
     if(attr==NULL)return;
@@ -35,25 +484,255 @@ void foothread_attr_setstacksize(foothread_attr_t *attr, int stack_size) {
     attr->stack_size = stack_size;
 }
 
+// Set CPU affinity attribute for thread; NULL lets it run anywhere
+void foothread_attr_setaffinity(foothread_attr_t *attr, const cpu_set_t *cpus) {
+    if(attr==NULL)return;
+    attr->has_affinity = (cpus != NULL);
+    if (cpus != NULL) attr->cpus = *cpus;
+    else CPU_ZERO(&attr->cpus);
+}
+
+// Set NUMA node attribute for the stack of thread; a node out of range or FOOTHREAD_MEM_DEFAULT leaves it to the process
+void foothread_attr_setmemnode(foothread_attr_t *attr, int node, int policy) {
+    if(attr==NULL)return;
+    if (node < 0 || node >= FOOTHREAD_MEM_NODES_MAX || policy == FOOTHREAD_MEM_DEFAULT) {
+        attr->mem_node = -1;
+        attr->mem_policy = FOOTHREAD_MEM_DEFAULT;
+    } else if (policy == FOOTHREAD_MEM_PREFERRED || policy == FOOTHREAD_MEM_BIND) {
+        attr->mem_node = node;
+        attr->mem_policy = policy;
+    }
+}
+
+// A physical core: its hardware threads and NUMA node
+typedef struct {
+    int package;
+    int core;
+    int node;
+    int rank; // Order of the core within its package
+    cpu_set_t cpus;
+} cpu_core_t;
+
+static cpu_core_t *cpu_cores = NULL;
+static int cpu_ncores = 0;
+static pthread_once_t cpu_cores_once = PTHREAD_ONCE_INIT;
+
+static int read_sysfs_int(const char *path, int fallback) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return fallback;
+    int value;
+    if (fscanf(fp, "%d", &value) != 1) value = fallback;
+    fclose(fp);
+    return value;
+}
+
+// Physical cores of the CPUs the process may run on, from the topology in sysfs, ordered to spread: the first
+// core of every package, then the second of every package, and so on
+static void cpu_cores_init() {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+    cpu_cores = (cpu_core_t *)calloc(CPU_COUNT(&allowed), sizeof(cpu_core_t));
+    if (cpu_cores == NULL) {
+        printf("ERROR: Unable to read the CPU topology\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char path[128];
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        int package = read_sysfs_int(path, 0);
+        sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        int core = read_sysfs_int(path, cpu);
+
+        int c;
+        for (c = 0; c < cpu_ncores && (cpu_cores[c].package != package || cpu_cores[c].core != core); c++);
+        if (c == cpu_ncores) {
+            cpu_cores[c].package = package;
+            cpu_cores[c].core = core;
+            cpu_cores[c].rank = 0;
+            for (int d = 0; d < c; d++) cpu_cores[c].rank += (cpu_cores[d].package == package);
+            // The node of a CPU shows as a nodeN entry in its directory
+            cpu_cores[c].node = 0;
+            sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+            DIR *dir = opendir(path);
+            struct dirent *entry;
+            while (dir != NULL && (entry = readdir(dir)) != NULL) {
+                if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                    cpu_cores[c].node = atoi(entry->d_name + 4);
+                }
+            }
+            if (dir != NULL) closedir(dir);
+            CPU_ZERO(&cpu_cores[c].cpus);
+            cpu_ncores++;
+        }
+        CPU_SET(cpu, &cpu_cores[c].cpus);
+    }
+
+    // Insertion sort on (rank, package)
+    for (int i = 1; i < cpu_ncores; i++) {
+        cpu_core_t core = cpu_cores[i];
+        int j = i - 1;
+        while (j >= 0 && (cpu_cores[j].rank > core.rank || (cpu_cores[j].rank == core.rank && cpu_cores[j].package > core.package))) {
+            cpu_cores[j + 1] = cpu_cores[j];
+            j--;
+        }
+        cpu_cores[j + 1] = core;
+    }
+}
+
+// Spread a group of n threads over the physical cores: thread i runs on the hardware threads of one core, taken
+// round robin over the packages, with its stack preferably on the node of that core. The other attributes are
+// kept. Returns the number of cores used; threads beyond it share cores in the same order.
+int foothread_attr_spread(foothread_attr_t *attrs, int n) {
+    if(attrs==NULL || n<=0)return 0;
+    pthread_once(&cpu_cores_once, cpu_cores_init);
+    for(int i=0; i<n; i++){
+        cpu_core_t *core = &cpu_cores[i % cpu_ncores];
+        foothread_attr_setaffinity(&attrs[i], &core->cpus);
+        foothread_attr_setmemnode(&attrs[i], core->node, FOOTHREAD_MEM_PREFERRED);
+    }
+    return (n < cpu_ncores) ? n : cpu_ncores;
+}
+
+// Place a stack on a NUMA node, moving the pages a cached stack already has. Kernels without NUMA have node 0 only.
+static void stack_place(void *stack, size_t stack_size, int node, int policy) {
+    unsigned long mask[node / (8 * sizeof(unsigned long)) + 1];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_mbind, stack, stack_size, policy, mask, 8 * sizeof(mask) + 1, MPOL_MF_MOVE) == -1 && errno != ENOSYS) {
+        perror("Error placing the stack of the thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Thread-specific data keys. A key is in use while its sequence number is odd; each thread keeps its values
+// with the sequence number they were set under, so that a deleted key's value does not show through a new key.
+typedef struct {
+    uintptr_t seq;
+    void (*destructor)(void *);
+} foothread_key_entry_t;
+
+static foothread_key_entry_t foothread_keys[FOOTHREAD_KEYS_MAX];
+
+// Rounds of destructor calls at thread exit, as destructors may set values again
+#define FOOTHREAD_DESTRUCTOR_ITERATIONS 4
+
+// Create a key, with a destructor called at the exit of every thread holding a non-NULL value for it
+void foothread_key_create(foothread_key_t *key, void (*destructor)(void *)) {
+    // Check for NULL argument
+    if(key==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_key_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+    // Where values are kept depends on the TLS, so it is settled before the first value is set
+    pthread_once(&tls_once, tls_init);
+
+    for(int i=0; i<FOOTHREAD_KEYS_MAX; i++){
+        uintptr_t seq = __atomic_load_n(&foothread_keys[i].seq, __ATOMIC_RELAXED);
+        if((seq & 1) == 0 && __atomic_compare_exchange_n(&foothread_keys[i].seq, &seq, seq + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+            foothread_keys[i].destructor = destructor;
+            *key = i;
+            return;
+        }
+    }
+    printf("ERROR: Maximum number of keys reached\n");
+    exit(EXIT_FAILURE);
+}
+
+// Delete a key; the values threads hold for it are dropped without calling the destructor
+void foothread_key_delete(foothread_key_t key) {
+    uintptr_t seq = (key < FOOTHREAD_KEYS_MAX) ? __atomic_load_n(&foothread_keys[key].seq, __ATOMIC_RELAXED) : 0;
+    if((seq & 1) == 0 || !__atomic_compare_exchange_n(&foothread_keys[key].seq, &seq, seq + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+        printf("ERROR: Invalid key provided\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Value of a key in the calling thread, NULL if it set none
+void *foothread_getspecific(foothread_key_t key) {
+    if(key >= FOOTHREAD_KEYS_MAX)return NULL;
+    foothread_specific_t *specific = foothread_self_specific();
+    if(specific[key].seq != __atomic_load_n(&foothread_keys[key].seq, __ATOMIC_RELAXED))return NULL;
+    return specific[key].value;
+}
+
+// Set the value of a key in the calling thread
+void foothread_setspecific(foothread_key_t key, const void *value) {
+    uintptr_t seq = (key < FOOTHREAD_KEYS_MAX) ? __atomic_load_n(&foothread_keys[key].seq, __ATOMIC_RELAXED) : 0;
+    if((seq & 1) == 0){
+        printf("ERROR: Invalid key provided\n");
+        exit(EXIT_FAILURE);
+    }
+    foothread_specific_t *specific = foothread_self_specific();
+    specific[key].seq = seq;
+    specific[key].value = (void *)value;
+}
+
+// Call the destructors of the values the exiting thread holds
+static void key_run_destructors() {
+    foothread_specific_t *specific = foothread_self_specific();
+    for(int round=0; round<FOOTHREAD_DESTRUCTOR_ITERATIONS; round++){
+        int called = 0;
+        for(int i=0; i<FOOTHREAD_KEYS_MAX; i++){
+            void *value = foothread_getspecific(i);
+            void (*destructor)(void *) = foothread_keys[i].destructor;
+            if(value==NULL || destructor==NULL)continue;
+            specific[i].value = NULL;
+            destructor(value);
+            called = 1;
+        }
+        if(!called)break;
+    }
+}
+
+// End of a thread, from its start routine returning or foothread_exit(): a joinable thread stays live for its
+// joiner, a detached one gives its slot back at once. Its stack is released by whoever takes the slot next, once
+// the kernel reports the thread has exited.
+static void foothread_finish(int idx, int retval) {
+    foothread_slot_t *slot = registry_slot(idx);
+    slot->retval = retval;
+    key_run_destructors();
+    if (slot->join_type == FOOTHREAD_DETACHED) {
+        __atomic_add_fetch(&slot->gen, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->state, FOOTHREAD_SLOT_RETIRED, __ATOMIC_RELEASE);
+        registry_push(idx);
+    }
+}
+
 // Function to start a thread
 int foothread_start(void *param) {
-    func_and_args *new_func = (func_and_args *)param;
-    int (*start_routine)(void *) = new_func->start_routine;
-    void *args = new_func->args;
+    int idx = (int)(intptr_t)param;
+    foothread_slot_t *slot = registry_slot(idx);
+#ifdef FOOTHREAD_OWN_TLS
+    // Fill in what glibc reads from the descriptor of its caller: the thread id, which the kernel has written to
+    // the slot before the thread runs, and the robust list, which the kernel walks when the thread exits
+    if (tls_own) {
+        self_index = idx;
+        *(pid_t *)((char *)slot->tcb + TCB_TID) = slot->tid;
+        tcb_robust_head_t *robust = (tcb_robust_head_t *)((char *)slot->tcb + TCB_ROBUST_HEAD);
+        robust->list = robust;
+        robust->futex_offset = tls_robust_futex_offset;
+        syscall(SYS_set_robust_list, robust, sizeof(tcb_robust_head_t));
+    }
+#endif
+
+    // Move to the CPUs of the thread before running anything
+    if (slot->has_affinity && sched_setaffinity(0, sizeof(cpu_set_t), &slot->cpus) == -1) {
+        perror("Error setting the CPU affinity of the thread");
+        exit(EXIT_FAILURE);
+    }
 
-    start_routine(args);
+    foothread_finish(idx, slot->start_routine(slot->args));
     return 0;
 }
 
 // Function to create a thread
 void foothread_create(foothread_t *thread, foothread_attr_t *attr, int (*start_routine)(void*), void *arg) {
-    // Initialize manager if not done already
-    if(init_done==0){
-        sem_init(&manager_mutex, 0, 1); // Initialize manager_mutex with value 1
-        memset(&foothread_manager, 0, sizeof(foothread_manager_t)); // Initialize foothread_manager with null
-        foothread_manager.count = 0; // Set count to 0
-        init_done = 1; // Update init_done
-    }
+    init_done = 1;
 
     // Handle invalid arguments
     if (thread == NULL) {
@@ -61,68 +740,113 @@ void foothread_create(foothread_t *thread, foothread_attr_t *attr, int (*start_r
         exit(EXIT_FAILURE); 
     }
     if(attr!=NULL){
-        if(attr->join_type!=FOOTHREAD_JOINABLE && attr->join_type!=FOOTHREAD_DETACHED){
+        int bad_mem = (attr->mem_policy!=FOOTHREAD_MEM_DEFAULT && attr->mem_policy!=FOOTHREAD_MEM_PREFERRED && attr->mem_policy!=FOOTHREAD_MEM_BIND) ||
+                      (attr->mem_policy!=FOOTHREAD_MEM_DEFAULT && (attr->mem_node<0 || attr->mem_node>=FOOTHREAD_MEM_NODES_MAX));
+        if((attr->join_type!=FOOTHREAD_JOINABLE && attr->join_type!=FOOTHREAD_DETACHED) ||
+           (attr->has_affinity!=0 && attr->has_affinity!=1) || bad_mem){
             printf("ERROR: A non-null uninitialized attribute is being used.\n");
             exit(EXIT_FAILURE);
         }
     }
 
-    // Allocate stack for the thread
-    size_t stack_size = (attr != NULL) ? attr->stack_size : FOOTHREAD_DEFAULT_STACK_SIZE;
-    void *stack = malloc(stack_size);
+    pthread_once(&tls_once, tls_init);
+
+    // Allocate stack for the thread, from the cache if possible, with room for its TLS at the top
+    size_t stack_size;
+    void *stack = stack_alloc(((attr != NULL) ? attr->stack_size : FOOTHREAD_DEFAULT_STACK_SIZE) + tls_reserve(), &stack_size);
     if (stack == NULL) {
-        perror("Error allocating stack");
+        printf("ERROR: Unable to allocate the stack of the thread\n");
         exit(EXIT_FAILURE);
     }
+    if (attr != NULL && attr->mem_policy != FOOTHREAD_MEM_DEFAULT) stack_place(stack, stack_size, attr->mem_node, attr->mem_policy);
+    char *tp = NULL;
+    stack_record_t *record = NULL;
+    char *stack_top;
+#ifdef FOOTHREAD_OWN_TLS
+    if (tls_own) {
+        tp = tls_setup((char *)stack + stack_size);
+        stack_top = (char *)((uintptr_t)(tp - tls_static_size) & ~(uintptr_t)15);
+    } else
+#endif
+    {
+        if (root_stack_high == NULL) root_stack_init();
+        record = (stack_record_t *)((char *)stack + stack_size - sizeof(stack_record_t));
+        memset(record, 0, sizeof(stack_record_t));
+        record->top = (char *)stack + stack_size;
+        stack_top = (char *)((uintptr_t)record & ~(uintptr_t)15);
+    }
 
-    // Flags for cloning
-    int clone_flags = SIGCHLD|CLONE_SIGHAND|CLONE_FS|CLONE_VM|CLONE_FILES|CLONE_THREAD;
-
-    // Lock manager mutex
-    sem_wait(&manager_mutex);
+    // Flags for cloning; the kernel writes the thread id in the slot before the thread runs, and clears it
+    // with a futex wake when the thread has exited
+    int clone_flags = SIGCHLD|CLONE_SIGHAND|CLONE_FS|CLONE_VM|CLONE_FILES|CLONE_THREAD|CLONE_PARENT_SETTID|CLONE_CHILD_CLEARTID;
+    if (tp != NULL) clone_flags |= CLONE_SETTLS;
 
-    // Check if maximum threads limit reached
-    if(foothread_manager.count == FOOTHREAD_THREADS_MAX){
-        printf("ERROR: Maximum allowed number of threads already created\n");
-        free(stack);
-        sem_post(&manager_mutex);
-        exit(EXIT_FAILURE);
+    // Take a slot; a recycled one may still hold the stack of a detached thread on its way out
+    int idx = registry_alloc();
+    foothread_slot_t *slot = registry_slot(idx);
+    if (slot->stack != NULL) {
+        slot_wait_exited(slot);
+        slot_release_stack(slot);
     }
 
-    // Prepare function and arguments for the new thread
-    func_and_args *new_func = (func_and_args *)malloc(sizeof(func_and_args));
-    new_func->start_routine = start_routine;
-    new_func->args = arg;
+    // Fill in thread information in the slot before the thread runs
+    slot->join_type = (attr != NULL) ? attr->join_type : FOOTHREAD_DETACHED;
+    slot->stack = stack;
+    slot->stack_size = stack_size;
+    slot->tcb = tp;
+    if (record != NULL) record->index = idx;
+    slot->has_affinity = (attr != NULL) && attr->has_affinity;
+    if (slot->has_affinity) slot->cpus = attr->cpus;
+    slot->start_routine = start_routine;
+    slot->args = arg;
+    slot->retval = 0;
+    __atomic_store_n(&slot->state, FOOTHREAD_SLOT_LIVE, __ATOMIC_RELEASE);
+    thread->pid = getpid();
+    thread->slot = idx;
+    thread->gen = __atomic_load_n(&slot->gen, __ATOMIC_RELAXED);
 
     // Create the thread
-    int tid = clone(foothread_start, (char*)stack + stack_size, clone_flags, (void *)new_func);
+    int tid = clone(foothread_start, stack_top, clone_flags, (void *)(intptr_t)idx, &slot->tid, tp, &slot->tid);
     if (tid == -1) {
         perror("Error creating thread");
-        free(stack);
-        free(new_func);
-        sem_post(&manager_mutex);
         exit(EXIT_FAILURE);
     }
-
-    // Fill in thread information in manager
-    thread->pid = getpid();
     thread->tid = tid;
-    foothread_manager.threads[foothread_manager.count] = *thread;
-    if (attr != NULL) {
-        foothread_manager.attrs[foothread_manager.count] = *attr;
-    } else {
-        foothread_attr_t default_attr = FOOTHREAD_ATTR_INITIALIZER;
-        foothread_manager.attrs[foothread_manager.count] = default_attr;
+
+    return;
+}
+
+// Wait for a joinable thread to end and release it; its return value goes to retval unless NULL
+void foothread_join(foothread_t *thread, int *retval) {
+    // Handle invalid arguments
+    if (thread == NULL) {
+        printf("ERROR: First argument (foothread_t *) is NULL\n");
+        exit(EXIT_FAILURE);
+    }
+    foothread_slot_t *slot = (thread->slot >= 0 && thread->slot < __atomic_load_n(&foothread_registry.size, __ATOMIC_ACQUIRE)) ? registry_slot(thread->slot) : NULL;
+    if (slot == NULL || __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != thread->gen) {
+        printf("ERROR: Invalid thread provided (already joined or never created)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (slot->join_type != FOOTHREAD_JOINABLE) {
+        printf("ERROR: Attempt to join a detached thread\n");
+        exit(EXIT_FAILURE);
+    }
+    if (thread->slot == foothread_self()) {
+        printf("ERROR: Attempt to join the calling thread\n");
+        exit(EXIT_FAILURE);
     }
-    sem_init(&foothread_manager.mutex[foothread_manager.count], 0, 0);
-    foothread_manager.stack[foothread_manager.count] = stack;
-    foothread_manager.live[foothread_manager.count] = 1;
-    foothread_manager.count++;
 
-    // Release manager mutex
-    sem_post(&manager_mutex);
+    // Claim the thread, so that it is joined once
+    int state = FOOTHREAD_SLOT_LIVE;
+    if (!__atomic_compare_exchange_n(&slot->state, &state, FOOTHREAD_SLOT_JOINING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        printf("ERROR: Thread is already being joined\n");
+        exit(EXIT_FAILURE);
+    }
 
-    return;
+    slot_wait_exited(slot);
+    if (retval != NULL) *retval = slot->retval;
+    slot_recycle(thread->slot);
 }
 
 // Function to exit the thread
@@ -132,40 +856,25 @@ void foothread_exit() {
         exit(EXIT_FAILURE);
     }
 
-    int pid = getpid();
-    int tid = gettid();
-
-    // Lock manager mutex
-    sem_wait(&manager_mutex);
-    int maxt = foothread_manager.count;
-    sem_post(&manager_mutex);
+    int self = foothread_self();
 
-    // If called from main thread
-    if(pid==tid){
-        for(int i=0; i<maxt; i++){
-            if(foothread_manager.live[i]==0)continue;
-            if(foothread_manager.threads[i].pid == pid && foothread_manager.attrs[i].join_type == FOOTHREAD_JOINABLE){
-                sem_wait(&foothread_manager.mutex[i]);
-                sem_wait(&manager_mutex);
-                free(foothread_manager.stack[i]);
-                foothread_manager.live[i] = 0;
-                sem_post(&manager_mutex);
+    // If called from main thread: join every joinable thread not joined yet, the ones they create included
+    if(self < 0){
+        for(int i=0; i<__atomic_load_n(&foothread_registry.size, __ATOMIC_ACQUIRE); i++){
+            foothread_slot_t *slot = registry_slot(i);
+            if(slot==NULL || slot->join_type != FOOTHREAD_JOINABLE)continue;
+            int state = FOOTHREAD_SLOT_LIVE;
+            if(__atomic_compare_exchange_n(&slot->state, &state, FOOTHREAD_SLOT_JOINING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+                slot_wait_exited(slot);
+                slot_recycle(i);
             }
-            sem_wait(&manager_mutex);
-            maxt = foothread_manager.count;
-            sem_post(&manager_mutex);
         }
         exit(EXIT_SUCCESS);
     }
-    // If called from child thread
+    // If called from child thread: end it here
     else{
-        for(int i=0; i<maxt; i++){
-            if(foothread_manager.live[i]==0)continue;
-            if(foothread_manager.threads[i].pid == pid && foothread_manager.threads[i].tid == tid){
-                sem_post(&foothread_manager.mutex[i]);
-                break;
-            }
-        }
+        foothread_finish(self, 0);
+        syscall(SYS_exit, 0);
     }
 }
 
@@ -180,8 +889,8 @@ void foothread_mutex_init(foothread_mutex_t *mutex) {
 
     // Initialize mutex properties
     mutex->is_live = 1; // Mutex is live (active)
-    mutex->is_locked = 0; // Mutex is initially unlocked
-    sem_init(&(mutex->sem), 0, 1); // Initialize the semaphore used for locking
+    mutex->state = FOOTHREAD_MUTEX_UNLOCKED; // Mutex is initially unlocked
+    mutex->owner_tid = 0;
 
     return;
 }
@@ -200,13 +909,10 @@ void foothread_mutex_lock(foothread_mutex_t *mutex) {
         exit(EXIT_FAILURE);
     }
 
-    // Wait for semaphore to be available
-    sem_wait(&(mutex->sem));
-    
-    // Update mutex state
-    mutex->is_locked = 1; // Mutex is now locked
-    mutex->owner_pid = getpid(); // Record the owner process ID
-    mutex->owner_tid = gettid(); // Record the owner thread ID
+    lock_word_acquire(&mutex->state);
+
+    // Record the owner
+    mutex->owner_tid = foothread_self_tid();
 
     return;
 }
@@ -226,7 +932,7 @@ void foothread_mutex_unlock(foothread_mutex_t *mutex) {
     }
 
     // Check if mutex is already unlocked
-    if (!(mutex->is_locked)) {
+    if (__atomic_load_n(&mutex->state, __ATOMIC_RELAXED) == FOOTHREAD_MUTEX_UNLOCKED) {
         // Error: Attempt to unlock an unlocked mutex
         printf("ERROR: Attempt to unlock an unlocked mutex\n");
         // Handle error accordingly, e.g., print error message or terminate
@@ -234,16 +940,16 @@ void foothread_mutex_unlock(foothread_mutex_t *mutex) {
     }
 
     // Check if the current thread is the owner of the mutex
-    if (mutex->owner_pid != getpid() || mutex->owner_tid != gettid()) {
+    if (mutex->owner_tid != foothread_self_tid()) {
         // Error: Attempt to unlock a mutex by another thread
         printf("ERROR: Attempt to unlock a mutex by another thread");
         // Handle error accordingly, e.g., print error message or terminate
         exit(EXIT_FAILURE);
     }
 
-    // Update mutex state
-    mutex->is_locked = 0; // Mutex is now unlocked
-    sem_post(&(mutex->sem)); // Release the semaphore
+    // Release the mutex; only wake a waiter if there may be one
+    mutex->owner_tid = 0;
+    lock_word_release(&mutex->state);
 
     return;
 }
@@ -264,27 +970,394 @@ void foothread_mutex_destroy(foothread_mutex_t *mutex) {
 
     // Update mutex state
     mutex->is_live = 0; // Mark mutex as inactive
-    mutex->is_locked = 0; // Ensure mutex is unlocked before destruction
-    sem_destroy(&(mutex->sem)); // Destroy the semaphore
+    mutex->state = FOOTHREAD_MUTEX_UNLOCKED; // Ensure mutex is unlocked before destruction
+    mutex->owner_tid = 0;
+
+    return;
+}
+
+// Initialize a condition variable
+void foothread_cond_init(foothread_cond_t *cond) {
+    // Check for NULL argument
+    if(cond==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_cond_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Initialize condition variable properties
+    cond->is_live = 1; // Condition variable is live (active)
+    cond->seq = 0;
+    cond->waiters = 0;
+    cond->mutex = NULL;
 
     return;
 }
 
+// Wait on a condition variable, with the mutex locked by the caller; the mutex is locked again on return.
+// Wakeups may be spurious, so the caller checks its condition in a loop.
+void foothread_cond_wait(foothread_cond_t *cond, foothread_mutex_t *mutex) {
+    // Check for NULL arguments
+    if(cond==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_cond_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+    if(mutex==NULL){
+        printf("ERROR: NULL argument is provided as second argument (foothread_mutex_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if condition variable is valid
+    if(cond->is_live==0){
+        printf("ERROR: Invalid condition variable provided\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // All the waiters use the same mutex, the one broadcast requeues them onto
+    if(cond->mutex!=NULL && cond->mutex!=mutex){
+        printf("ERROR: Condition variable used with two different mutexes\n");
+        exit(EXIT_FAILURE);
+    }
+    cond->mutex = mutex;
+
+    // Take the sequence number before releasing the mutex: a signal after the release changes it, so the
+    // futex wait returns at once instead of missing it
+    __atomic_add_fetch(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_SEQ_CST);
+    foothread_mutex_unlock(mutex);
+    futex_wait(&cond->seq, seq);
+    __atomic_sub_fetch(&cond->waiters, 1, __ATOMIC_RELAXED);
+
+    // Lock again as contended: waiters requeued by a broadcast may be asleep on the mutex word, and each
+    // unlock has to wake the next one
+    while (__atomic_exchange_n(&mutex->state, FOOTHREAD_MUTEX_CONTENDED, __ATOMIC_ACQUIRE) != FOOTHREAD_MUTEX_UNLOCKED) {
+        futex_wait(&mutex->state, FOOTHREAD_MUTEX_CONTENDED);
+    }
+    mutex->owner_tid = foothread_self_tid();
+
+    return;
+}
+
+// Wake one thread waiting on a condition variable
+void foothread_cond_signal(foothread_cond_t *cond) {
+    // Check for NULL argument
+    if(cond==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_cond_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if condition variable is valid
+    if(cond->is_live==0){
+        printf("ERROR: Invalid condition variable provided\n");
+        exit(EXIT_FAILURE);
+    }
+
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) > 0){
+        futex_wake(&cond->seq, 1);
+    }
+
+    return;
+}
+
+// Wake all the threads waiting on a condition variable. Only one is woken; the others are moved to the futex of
+// the mutex, where each unlock wakes the next, instead of all rushing for the mutex at once.
+void foothread_cond_broadcast(foothread_cond_t *cond) {
+    // Check for NULL argument
+    if(cond==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_cond_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if condition variable is valid
+    if(cond->is_live==0){
+        printf("ERROR: Invalid condition variable provided\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t seq = __atomic_add_fetch(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) == 0)return;
+    foothread_mutex_t *mutex = cond->mutex;
+    // The requeue fails if the sequence number moved meanwhile: wake everybody then
+    if(mutex==NULL || syscall(SYS_futex, &cond->seq, FUTEX_CMP_REQUEUE_PRIVATE, 1, INT_MAX, &mutex->state, seq) == -1){
+        futex_wake(&cond->seq, INT_MAX);
+    }
+
+    return;
+}
+
+// Destroy a condition variable
+void foothread_cond_destroy(foothread_cond_t *cond) {
+    // Check for NULL argument
+    if(cond==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_cond_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if condition variable is valid
+    if(cond->is_live==0){
+        printf("ERROR: Invalid condition variable provided\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if threads still wait on it
+    if(__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) > 0){
+        printf("ERROR: Attempt to destroy a condition variable with waiting threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cond->is_live = 0; // Mark condition variable as inactive
+    cond->mutex = NULL;
+}
+
+// Initialize a reader-writer lock
+void foothread_rwlock_init(foothread_rwlock_t *rwlock) {
+    // Check for NULL argument
+    if(rwlock==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_rwlock_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Initialize lock properties
+    memset(rwlock, 0, sizeof(foothread_rwlock_t));
+    rwlock->is_live = 1; // Lock is live (active)
+
+    return;
+}
+
+static void rwlock_check(foothread_rwlock_t *rwlock) {
+    // Check for NULL argument
+    if(rwlock==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_rwlock_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Check if lock is valid
+    if(rwlock->is_live==0){
+        printf("ERROR: Invalid reader-writer lock provided\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Lock for reading. Readers only get in while no writer holds the lock or waits for it, so that a stream of
+// readers cannot starve the writers; the fast path is one compare-and-swap on the state word.
+void foothread_rwlock_rdlock(foothread_rwlock_t *rwlock) {
+    rwlock_check(rwlock);
+
+    uint32_t s = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    while (1) {
+        if (!(s & (FOOTHREAD_RWLOCK_WRITER|FOOTHREAD_RWLOCK_PENDING))) {
+            if (__atomic_compare_exchange_n(&rwlock->state, &s, s + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+            continue;
+        }
+        // Blocked: sleep until a writer lets the readers in, rechecking after announcing the sleep
+        uint32_t seq = __atomic_load_n(&rwlock->read_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&rwlock->readers_waiting, 1, __ATOMIC_SEQ_CST);
+        s = __atomic_load_n(&rwlock->state, __ATOMIC_SEQ_CST);
+        if (s & (FOOTHREAD_RWLOCK_WRITER|FOOTHREAD_RWLOCK_PENDING)) futex_wait(&rwlock->read_seq, seq);
+        __atomic_sub_fetch(&rwlock->readers_waiting, 1, __ATOMIC_SEQ_CST);
+        s = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    }
+}
+
+// Lock for writing. A waiting writer sets the pending bit, which keeps new readers out.
+void foothread_rwlock_wrlock(foothread_rwlock_t *rwlock) {
+    rwlock_check(rwlock);
+
+    __atomic_add_fetch(&rwlock->writers_waiting, 1, __ATOMIC_SEQ_CST);
+    uint32_t s = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    while (1) {
+        if ((s & ~FOOTHREAD_RWLOCK_PENDING) == 0) {
+            if (__atomic_compare_exchange_n(&rwlock->state, &s, FOOTHREAD_RWLOCK_WRITER|FOOTHREAD_RWLOCK_PENDING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+            continue;
+        }
+        // Held: keep readers out and sleep until the last reader or the writer leaves
+        uint32_t seq = __atomic_load_n(&rwlock->write_seq, __ATOMIC_SEQ_CST);
+        s = __atomic_or_fetch(&rwlock->state, FOOTHREAD_RWLOCK_PENDING, __ATOMIC_SEQ_CST);
+        if ((s & ~FOOTHREAD_RWLOCK_PENDING) != 0) futex_wait(&rwlock->write_seq, seq);
+        s = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    }
+
+    // Readers may come in again after this writer unless another one waits
+    if (__atomic_sub_fetch(&rwlock->writers_waiting, 1, __ATOMIC_SEQ_CST) == 0) {
+        __atomic_and_fetch(&rwlock->state, ~FOOTHREAD_RWLOCK_PENDING, __ATOMIC_SEQ_CST);
+    }
+    rwlock->writer_tid = foothread_self_tid();
+}
+
+// Unlock a reader-writer lock held for reading or writing
+void foothread_rwlock_unlock(foothread_rwlock_t *rwlock) {
+    rwlock_check(rwlock);
+
+    uint32_t s = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    if (s & FOOTHREAD_RWLOCK_WRITER) {
+        // Check if the current thread is the writer
+        if (rwlock->writer_tid != foothread_self_tid()) {
+            printf("ERROR: Attempt to unlock a reader-writer lock held for writing by another thread\n");
+            exit(EXIT_FAILURE);
+        }
+        rwlock->writer_tid = 0;
+        __atomic_and_fetch(&rwlock->state, ~FOOTHREAD_RWLOCK_WRITER, __ATOMIC_SEQ_CST);
+        // Hand over to the next writer if there is one, else let the readers in
+        if (__atomic_load_n(&rwlock->writers_waiting, __ATOMIC_SEQ_CST) > 0) {
+            __atomic_add_fetch(&rwlock->write_seq, 1, __ATOMIC_SEQ_CST);
+            futex_wake(&rwlock->write_seq, 1);
+        } else {
+            __atomic_add_fetch(&rwlock->read_seq, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&rwlock->readers_waiting, __ATOMIC_SEQ_CST) > 0) futex_wake(&rwlock->read_seq, INT_MAX);
+        }
+        return;
+    }
+
+    // Check if the lock is held at all
+    if ((s & ~FOOTHREAD_RWLOCK_PENDING) == 0) {
+        printf("ERROR: Attempt to unlock an unlocked reader-writer lock\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The last reader out wakes a waiting writer
+    if (__atomic_sub_fetch(&rwlock->state, 1, __ATOMIC_SEQ_CST) == FOOTHREAD_RWLOCK_PENDING) {
+        __atomic_add_fetch(&rwlock->write_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&rwlock->write_seq, 1);
+    }
+}
+
+// Destroy a reader-writer lock
+void foothread_rwlock_destroy(foothread_rwlock_t *rwlock) {
+    rwlock_check(rwlock);
+
+    // Check if the lock is still held
+    if ((__atomic_load_n(&rwlock->state, __ATOMIC_SEQ_CST) & ~FOOTHREAD_RWLOCK_PENDING) != 0) {
+        printf("ERROR: Attempt to destroy a locked reader-writer lock\n");
+        exit(EXIT_FAILURE);
+    }
+
+    rwlock->is_live = 0; // Mark lock as inactive
+}
+
+// Spins on a barrier flag before sleeping on the futex (none on a single CPU, where the spinning thread only
+// delays the threads it waits for)
+#define FOOTHREAD_BARRIER_SPINS 1000
+static int barrier_spins = -1;
+
+// Combining tree node, on a cache line of its own
+typedef struct {
+    uint32_t count; // Arrivals at the node in the current episode
+    uint32_t expected; // Children of the node
+    uint32_t release; // Release flag of the threads that stopped at the node
+    int parent; // Index of the parent node, -1 at the root
+} __attribute__((aligned(64))) barrier_node_t;
+
+// Dissemination flags are a cache line apart
+#define BARRIER_FLAG_STRIDE (64 / sizeof(uint32_t))
+
+// Barrier flags hold the sequence number of the last episode released through them, shifted left by one: the
+// low bit tells that a thread went to sleep on the flag, so that setting it only wakes when someone sleeps.
+// A flag only moves on once every thread waiting for its previous value has left the barrier, so waiting for
+// an exact value is enough.
+static void barrier_flag_wait(uint32_t *flag, uint32_t seq) {
+    uint32_t target = seq << 1;
+    uint32_t v = __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < barrier_spins && (v & ~1u) != target; i++) {
+        cpu_relax();
+        v = __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+    }
+    while ((v & ~1u) != target) {
+        // Announce the sleeper; if the flag moved meanwhile, the compare-and-swap fails and v is reread
+        if ((v & 1u) || __atomic_compare_exchange_n(flag, &v, v | 1u, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            futex_wait(flag, v | 1u);
+        }
+        v = __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void barrier_flag_set(uint32_t *flag, uint32_t seq) {
+    if (__atomic_exchange_n(flag, seq << 1, __ATOMIC_RELEASE) & 1u) {
+        futex_wake(flag, INT_MAX);
+    }
+}
+
+// Set algorithm attribute for barrier
+void foothread_barrierattr_setalgorithm(foothread_barrierattr_t *attr, int algorithm) {
+    if(attr==NULL)return;
+    if (algorithm == FOOTHREAD_BARRIER_CENTRAL || algorithm == FOOTHREAD_BARRIER_TREE || algorithm == FOOTHREAD_BARRIER_DISSEMINATION) {
+        attr->algorithm = algorithm;
+    }
+}
+
+// Set fan-in attribute for combining tree barrier
+void foothread_barrierattr_setfanin(foothread_barrierattr_t *attr, int fanin) {
+    if(attr==NULL)return;
+    if (fanin >= 2) {
+        attr->fanin = fanin;
+    }
+}
+
 // Initialize a barrier
 void foothread_barrier_init(foothread_barrier_t *barrier, int n){
+    foothread_barrier_init_attr(barrier, n, NULL);
+}
+
+// Initialize a barrier with the given algorithm
+void foothread_barrier_init_attr(foothread_barrier_t *barrier, int n, foothread_barrierattr_t *attr){
     // Check for NULL argument
     if(barrier==NULL){
         printf("ERROR: NULL argument is provided as first argument (foothread_barrier_t *)\n");
         exit(EXIT_FAILURE);
     }
+    if(n<1){
+        printf("ERROR: A barrier needs at least one thread\n");
+        exit(EXIT_FAILURE);
+    }
+    foothread_barrierattr_t default_attr = FOOTHREAD_BARRIERATTR_INITIALIZER;
+    if(attr==NULL)attr = &default_attr;
+    if((attr->algorithm!=FOOTHREAD_BARRIER_CENTRAL && attr->algorithm!=FOOTHREAD_BARRIER_TREE && attr->algorithm!=FOOTHREAD_BARRIER_DISSEMINATION) || attr->fanin<2){
+        printf("ERROR: A non-null uninitialized attribute is being used.\n");
+        exit(EXIT_FAILURE);
+    }
+    if(barrier_spins<0)barrier_spins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? FOOTHREAD_BARRIER_SPINS : 0;
 
     // Initialize barrier properties
+    memset(barrier, 0, sizeof(foothread_barrier_t));
     barrier->is_live = 1; // Barrier is live (active)
     barrier->n = n; // Number of threads to synchronize
-    barrier->count = 0; // Counter to track arrivals at the barrier
-    sem_init(&(barrier->mutex), 0, 1); // Initialize the semaphore used for mutual exclusion
-    sem_init(&(barrier->sem1), 0, 0); // Initialize the semaphore for signaling completion of arrivals
-    sem_init(&(barrier->sem2), 0, 1); // Initialize the semaphore for signaling completion of departures
+    barrier->algorithm = attr->algorithm;
+    barrier->fanin = attr->fanin;
+
+    if(barrier->algorithm == FOOTHREAD_BARRIER_TREE){
+        // Levels of the tree, from the leaves (fanin threads each) up to the root
+        int nodes = 0;
+        for(int width = n; ; width = (width + barrier->fanin - 1) / barrier->fanin){
+            nodes += (width + barrier->fanin - 1) / barrier->fanin;
+            if(width <= barrier->fanin)break;
+        }
+        barrier_node_t *node = (barrier_node_t *)aligned_alloc(64, nodes * sizeof(barrier_node_t));
+        if(node==NULL){
+            printf("ERROR: Unable to allocate the barrier\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(node, 0, nodes * sizeof(barrier_node_t));
+        int start = 0;
+        for(int width = n; ; width = (width + barrier->fanin - 1) / barrier->fanin){
+            int level = (width + barrier->fanin - 1) / barrier->fanin;
+            for(int i = 0; i < level; i++){
+                node[start + i].expected = (i < level - 1 || width % barrier->fanin == 0) ? barrier->fanin : width % barrier->fanin;
+                node[start + i].parent = (level == 1) ? -1 : start + level + i / barrier->fanin;
+            }
+            start += level;
+            if(width <= barrier->fanin)break;
+        }
+        barrier->nodes = node;
+    }
+    else if(barrier->algorithm == FOOTHREAD_BARRIER_DISSEMINATION){
+        while((1 << barrier->rounds) < n)barrier->rounds++;
+        size_t size = 2 * (size_t)(barrier->rounds > 0 ? barrier->rounds : 1) * n * BARRIER_FLAG_STRIDE * sizeof(uint32_t);
+        barrier->flags = (uint32_t *)aligned_alloc(64, size);
+        if(barrier->flags==NULL){
+            printf("ERROR: Unable to allocate the barrier\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(barrier->flags, 0, size);
+    }
 
     return;
 }
@@ -303,33 +1376,48 @@ void foothread_barrier_wait(foothread_barrier_t *barrier){
         exit(EXIT_FAILURE);
     }
 
-    // Increment arrival counter in a thread-safe manner
-    sem_wait(&barrier->mutex);
-    barrier->count++;
-    if(barrier->count == barrier->n){
-        // Last thread reached the barrier, signal others to proceed
-        sem_wait(&barrier->sem2);
-        sem_post(&barrier->sem1);
-    }
-    sem_post(&barrier->mutex);
-
-    // Wait for signal to proceed
-    sem_wait(&barrier->sem1);
-    sem_post(&barrier->sem1);
+    // Take a ticket: no thread leaves an episode before all n have arrived, so the n tickets of an episode are
+    // consecutive and give every thread its own index in it. Episodes are released as sequence numbers from 1.
+    unsigned long ticket = __atomic_fetch_add(&barrier->ticket, 1, __ATOMIC_ACQ_REL);
+    unsigned long episode = ticket / barrier->n;
+    int index = ticket % barrier->n;
+    uint32_t seq = (uint32_t)episode + 1;
 
-    // Decrement arrival counter in a thread-safe manner
-    sem_wait(&barrier->mutex);
-    barrier->count--;
-    if (barrier->count == 0){
-        // Last thread departed the barrier, signal others to reset
-        sem_wait(&barrier->sem1);
-        sem_post(&barrier->sem2);
+    if(barrier->algorithm == FOOTHREAD_BARRIER_CENTRAL){
+        // The last ticket of the episode is the last arrival: it releases everybody else
+        if(index == barrier->n - 1)barrier_flag_set(&barrier->release, seq);
+        else barrier_flag_wait(&barrier->release, seq);
+    }
+    else if(barrier->algorithm == FOOTHREAD_BARRIER_TREE){
+        // Climb while last at a node; stop at the first node where others are still to come and wait there.
+        // Once released, or at the root, release the nodes won on the way up, from the top down.
+        barrier_node_t *node = (barrier_node_t *)barrier->nodes;
+        int won[32], nwon = 0;
+        int cur = index / barrier->fanin;
+        while(1){
+            if(__atomic_add_fetch(&node[cur].count, 1, __ATOMIC_ACQ_REL) < node[cur].expected){
+                barrier_flag_wait(&node[cur].release, seq);
+                break;
+            }
+            // Nobody arrives here again before this episode is released
+            __atomic_store_n(&node[cur].count, 0, __ATOMIC_RELAXED);
+            won[nwon++] = cur;
+            if(node[cur].parent < 0)break;
+            cur = node[cur].parent;
+        }
+        while(nwon > 0)barrier_flag_set(&node[won[--nwon]].release, seq);
+    }
+    else{
+        // Round r: signal the thread 2^r ahead and wait for the one 2^r behind. After ceil(log2 n) rounds every
+        // thread has heard, directly or not, from all the others. Episodes alternate between two sets of flags,
+        // as a thread may signal in the next episode while its partner still waits in this one.
+        uint32_t *flags = barrier->flags + (episode & 1) * barrier->rounds * barrier->n * BARRIER_FLAG_STRIDE;
+        for(int r = 0; r < barrier->rounds; r++){
+            uint32_t *round = flags + (size_t)r * barrier->n * BARRIER_FLAG_STRIDE;
+            barrier_flag_set(&round[((index + (1 << r)) % barrier->n) * BARRIER_FLAG_STRIDE], seq);
+            barrier_flag_wait(&round[index * BARRIER_FLAG_STRIDE], seq);
+        }
     }
-    sem_post(&barrier->mutex);
-
-    // Wait for signal to reset
-    sem_wait(&barrier->sem2);
-    sem_post(&barrier->sem2);
 
     return;
 }
@@ -348,9 +1436,326 @@ void foothread_barrier_destroy(foothread_barrier_t *barrier){
         exit(EXIT_FAILURE);
     }
 
-    // Mark barrier as inactive and destroy associated semaphores
+    // Mark barrier as inactive and free the tree or flags
     barrier->is_live = 0;
-    sem_destroy(&(barrier->mutex));
-    sem_destroy(&(barrier->sem1));
-    sem_destroy(&(barrier->sem2));
+    free(barrier->nodes);
+    free(barrier->flags);
+    barrier->nodes = NULL;
+    barrier->flags = NULL;
+}
+
+// Task slabs are mapped rather than malloc'd, in blocks a worker only ever carves alone
+#define FOOTHREAD_TASK_SLAB 65536
+#define FOOTHREAD_DEQUE_INITIAL 256
+
+// Rounds of failed steals before an idle worker parks (none on a single CPU)
+#define FOOTHREAD_POOL_SPINS 64
+
+static void *pool_map(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        printf("ERROR: Unable to allocate memory for the task pool\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static foothread_deque_array_t *deque_array_new(long size) {
+    foothread_deque_array_t *array = (foothread_deque_array_t *)pool_map(sizeof(foothread_deque_array_t) + size * sizeof(foothread_task_t *));
+    array->size = size;
+    array->prev = NULL;
+    return array;
+}
+
+static void deque_array_unmap(foothread_deque_array_t *array) {
+    while (array != NULL) {
+        foothread_deque_array_t *prev = array->prev;
+        munmap(array, sizeof(foothread_deque_array_t) + array->size * sizeof(foothread_task_t *));
+        array = prev;
+    }
+}
+
+// Owner: push a task at the bottom, doubling the array when full
+static void deque_push(foothread_deque_t *deque, foothread_task_t *task) {
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    foothread_deque_array_t *array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    if (b - t > array->size - 1) {
+        foothread_deque_array_t *bigger = deque_array_new(2 * array->size);
+        for (long i = t; i < b; i++) {
+            bigger->buf[i & (bigger->size - 1)] = __atomic_load_n(&array->buf[i & (array->size - 1)], __ATOMIC_RELAXED);
+        }
+        bigger->prev = array;
+        __atomic_store_n(&deque->array, bigger, __ATOMIC_RELEASE);
+        array = bigger;
+    }
+    __atomic_store_n(&array->buf[b & (array->size - 1)], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+// Owner: take the task at the bottom, NULL if empty. Only the last task can race with a thief, settled on top.
+static foothread_task_t *deque_take(foothread_deque_t *deque) {
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    foothread_deque_array_t *array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    foothread_task_t *task = NULL;
+    if (t <= b) {
+        task = __atomic_load_n(&array->buf[b & (array->size - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) task = NULL;
+            __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+// Thief: steal the task at the top, NULL if empty or lost to another thief or the owner
+static foothread_task_t *deque_steal(foothread_deque_t *deque) {
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+    foothread_deque_array_t *array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    foothread_task_t *task = __atomic_load_n(&array->buf[t & (array->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return NULL;
+    return task;
+}
+
+// A task from the worker's free list, carving a new slab when it is empty
+static foothread_task_t *task_alloc(foothread_worker_t *self) {
+    if (self->free_tasks == NULL) {
+        char *slab = (char *)pool_map(FOOTHREAD_TASK_SLAB);
+        *(void **)slab = self->slabs;
+        self->slabs = slab;
+        foothread_task_t *task = (foothread_task_t *)(slab + 64);
+        for (size_t i = 0; i < (FOOTHREAD_TASK_SLAB - 64) / sizeof(foothread_task_t); i++, task++) {
+            task->pooled = 1;
+            task->next = self->free_tasks;
+            self->free_tasks = task;
+        }
+    }
+    foothread_task_t *task = self->free_tasks;
+    self->free_tasks = task->next;
+    return task;
+}
+
+// Wake a parked worker if there is one, after new work has been published
+static void pool_notify(foothread_pool_t *pool, int n) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(&pool->signal, 1, __ATOMIC_RELEASE);
+        futex_wake(&pool->signal, n);
+    }
+}
+
+static int pool_has_work(foothread_pool_t *pool) {
+    if (__atomic_load_n(&pool->submit_head, __ATOMIC_ACQUIRE) != NULL) return 1;
+    for (int i = 0; i < pool->nworkers; i++) {
+        foothread_deque_t *deque = &pool->workers[i].deque;
+        if (__atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) < __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE)) return 1;
+    }
+    return 0;
+}
+
+// Find a task for an idle worker: its own deque, then the others from a random one on, then the submitted tasks
+static foothread_task_t *pool_find_task(foothread_worker_t *self) {
+    foothread_pool_t *pool = self->pool;
+    foothread_task_t *task = deque_take(&self->deque);
+    if (task != NULL) return task;
+
+    self->rng ^= self->rng << 13;
+    self->rng ^= self->rng >> 7;
+    self->rng ^= self->rng << 17;
+    int start = self->rng % pool->nworkers;
+    for (int i = 0; i < pool->nworkers; i++) {
+        foothread_worker_t *victim = &pool->workers[(start + i) % pool->nworkers];
+        if (victim == self) continue;
+        task = deque_steal(&victim->deque);
+        if (task != NULL) return task;
+    }
+
+    if (__atomic_load_n(&pool->submit_head, __ATOMIC_ACQUIRE) != NULL) {
+        lock_word_acquire(&pool->submit_lock);
+        task = pool->submit_head;
+        if (task != NULL) {
+            __atomic_store_n(&pool->submit_head, task->next, __ATOMIC_RELEASE);
+            if (task->next == NULL) pool->submit_tail = NULL;
+        }
+        lock_word_release(&pool->submit_lock);
+    }
+    return task;
+}
+
+// Tell a group one of its tasks is done. The syncing thread may return as soon as the count drops, so the
+// group is not read again after it; a wake on a word that went away is only a spurious wakeup.
+static void taskgroup_done(foothread_taskgroup_t *group) {
+    if (__atomic_fetch_sub(&group->state, 2, __ATOMIC_ACQ_REL) == 3) {
+        futex_wake(&group->state, INT_MAX);
+    }
+}
+
+// Sleep until all the tasks of a group are done
+static void taskgroup_sleep(foothread_taskgroup_t *group) {
+    uint32_t v = __atomic_load_n(&group->state, __ATOMIC_ACQUIRE);
+    while ((v >> 1) != 0) {
+        if ((v & 1u) || __atomic_compare_exchange_n(&group->state, &v, v | 1u, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            futex_wait(&group->state, v | 1u);
+            v = __atomic_load_n(&group->state, __ATOMIC_ACQUIRE);
+        }
+    }
+}
+
+static void task_run(foothread_worker_t *self, foothread_task_t *task) {
+    foothread_taskgroup_t *group = task->group;
+    task->fn(self, task->arg);
+    if (task->pooled) {
+        task->next = self->free_tasks;
+        self->free_tasks = task;
+    }
+    taskgroup_done(group);
+}
+
+// Worker loop: run tasks while there are any, park on the pool signal when there are none
+static int pool_worker(void *arg) {
+    foothread_worker_t *self = (foothread_worker_t *)arg;
+    foothread_pool_t *pool = self->pool;
+    int idle = 0;
+    while (!__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+        foothread_task_t *task = pool_find_task(self);
+        if (task != NULL) {
+            task_run(self, task);
+            idle = 0;
+            continue;
+        }
+        if (++idle <= pool->spins) {
+            cpu_relax();
+            continue;
+        }
+        // Register as a sleeper before the last look for work, so that a spawn either sees the sleeper or is seen
+        uint32_t seq = __atomic_load_n(&pool->signal, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&pool->stop, __ATOMIC_SEQ_CST) && !pool_has_work(pool)) futex_wait(&pool->signal, seq);
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        idle = 0;
+    }
+    return 0;
+}
+
+// Start a pool of nworkers worker threads (one per online CPU if nworkers <= 0)
+void foothread_pool_init(foothread_pool_t *pool, int nworkers) {
+    // Check for NULL argument
+    if(pool==NULL){
+        printf("ERROR: NULL argument is provided as first argument (foothread_pool_t *)\n");
+        exit(EXIT_FAILURE);
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nworkers<=0)nworkers = (cpus > 0) ? cpus : 1;
+
+    memset(pool, 0, sizeof(foothread_pool_t));
+    pool->nworkers = nworkers;
+    pool->spins = (cpus > 1) ? FOOTHREAD_POOL_SPINS : 0;
+    pool->workers = (foothread_worker_t *)calloc(nworkers, sizeof(foothread_worker_t));
+    if(pool->workers==NULL){
+        printf("ERROR: Unable to allocate the task pool\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i=0; i<nworkers; i++){
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pool->workers[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pool->workers[i].deque.array = deque_array_new(FOOTHREAD_DEQUE_INITIAL);
+    }
+
+    foothread_attr_t attr = FOOTHREAD_ATTR_INITIALIZER;
+    foothread_attr_setjointype(&attr, FOOTHREAD_JOINABLE);
+    for(int i=0; i<nworkers; i++){
+        foothread_create(&pool->workers[i].thread, &attr, pool_worker, &pool->workers[i]);
+    }
+}
+
+// Run fn(worker, arg) as a task of the pool and wait until it and all the tasks it spawned are done. For threads
+// outside the pool; tasks use foothread_spawn and foothread_sync instead.
+void foothread_pool_run(foothread_pool_t *pool, void (*fn)(foothread_worker_t *, void *), void *arg) {
+    // Check for NULL argument
+    if(pool==NULL || pool->workers==NULL){
+        printf("ERROR: Invalid pool provided\n");
+        exit(EXIT_FAILURE);
+    }
+
+    foothread_taskgroup_t group = FOOTHREAD_TASKGROUP_INITIALIZER;
+    foothread_task_t task = {fn, arg, &group, NULL, 0};
+    __atomic_add_fetch(&group.state, 2, __ATOMIC_RELAXED);
+
+    lock_word_acquire(&pool->submit_lock);
+    if(pool->submit_tail!=NULL)pool->submit_tail->next = &task;
+    else __atomic_store_n(&pool->submit_head, &task, __ATOMIC_RELEASE);
+    pool->submit_tail = &task;
+    lock_word_release(&pool->submit_lock);
+    pool_notify(pool, 1);
+
+    taskgroup_sleep(&group);
+}
+
+// Stop the workers once they are idle and free the pool
+void foothread_pool_destroy(foothread_pool_t *pool) {
+    // Check for NULL argument
+    if(pool==NULL || pool->workers==NULL){
+        printf("ERROR: Invalid pool provided\n");
+        exit(EXIT_FAILURE);
+    }
+
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->signal, 1, __ATOMIC_RELEASE);
+    futex_wake(&pool->signal, INT_MAX);
+    for(int i=0; i<pool->nworkers; i++){
+        foothread_join(&pool->workers[i].thread, NULL);
+    }
+
+    for(int i=0; i<pool->nworkers; i++){
+        deque_array_unmap(pool->workers[i].deque.array);
+        void *slab = pool->workers[i].slabs;
+        while(slab!=NULL){
+            void *next = *(void **)slab;
+            munmap(slab, FOOTHREAD_TASK_SLAB);
+            slab = next;
+        }
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+}
+
+// Spawn fn(worker, arg) as a child of the running task, in group
+void foothread_spawn(foothread_worker_t *self, foothread_taskgroup_t *group, void (*fn)(foothread_worker_t *, void *), void *arg) {
+    foothread_task_t *task = task_alloc(self);
+    task->fn = fn;
+    task->arg = arg;
+    task->group = group;
+    __atomic_add_fetch(&group->state, 2, __ATOMIC_RELAXED);
+    deque_push(&self->deque, task);
+    pool_notify(self->pool, 1);
+}
+
+// Wait until the tasks spawned in group are done, running tasks meanwhile. The children still in the worker's
+// deque are on top of it, so they are taken back first; when nothing is left to run or steal, sleep on the group.
+void foothread_sync(foothread_worker_t *self, foothread_taskgroup_t *group) {
+    int idle = 0;
+    while ((__atomic_load_n(&group->state, __ATOMIC_ACQUIRE) >> 1) != 0) {
+        foothread_task_t *task = pool_find_task(self);
+        if (task != NULL) {
+            task_run(self, task);
+            idle = 0;
+        }
+        else if (++idle <= self->pool->spins) {
+            cpu_relax();
+        }
+        else {
+            taskgroup_sleep(group);
+        }
+    }
+    __atomic_store_n(&group->state, 0, __ATOMIC_RELAXED);
 }
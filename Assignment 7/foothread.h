@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include <err.h>
+#include <errno.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdint.h>
@@ -14,53 +15,220 @@
 #include <sys/sem.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#endif
+#ifdef __GLIBC__
+#include <gnu/libc-version.h>
+#endif
+
+// Thread-local storage. On x86-64 with glibc 2.26 to 2.40 every foothread gets TLS of its own, set up through
+// GLIBC_PRIVATE calls of ld.so and the TCB layout of glibc: errno, stdio, malloc and __thread variables are per
+// thread. Of the glibc thread descriptor only the TCB header (self pointers, multiple-threads flag, stack and
+// pointer guards), the thread id and the robust mutex list are filled in, so error-checking, recursive and robust
+// mutexes, dlopen and dl_iterate_phdr work; the rest stays zeroed, so a foothread must not use pthread calls on
+// itself (pthread_join, pthread_detach, pthread_cancel, pthread_getattr_np).
+// Elsewhere, or when built with -DFOOTHREAD_SHARED_TLS (make lib SHARED_TLS=1), foothreads share the TLS of the
+// thread that created them: keys still work, but pthread mutexes take every foothread for the thread that created
+// it, and a foothread must not create threads while others call malloc.
 
 #define FOOTHREAD_JOINABLE 26
 #define FOOTHREAD_DETACHED 27
 
-#define FOOTHREAD_THREADS_MAX 100
 #define FOOTHREAD_DEFAULT_STACK_SIZE 2097152 // 2MB
 
+// Placement of the stack of a thread on its NUMA node
+#define FOOTHREAD_MEM_DEFAULT MPOL_DEFAULT // Policy of the process
+#define FOOTHREAD_MEM_PREFERRED MPOL_PREFERRED // On the node if it has free memory
+#define FOOTHREAD_MEM_BIND MPOL_BIND // Only on the node
+
+#define FOOTHREAD_MEM_NODES_MAX 1024 // Nodes a stack can be placed on, as in the kernel (MAX_NUMNODES)
+
 typedef struct {
     int join_type; // FOOTHREAD_JOINABLE or FOOTHREAD_DETACHED
     size_t stack_size;
+    int has_affinity; // The thread only runs on cpus
+    cpu_set_t cpus;
+    int mem_node; // NUMA node of the stack, -1 for none
+    int mem_policy; // FOOTHREAD_MEM_*
 } foothread_attr_t;
 
-#define FOOTHREAD_ATTR_INITIALIZER {FOOTHREAD_DETACHED, FOOTHREAD_DEFAULT_STACK_SIZE}
+// An attribute must be set up with FOOTHREAD_ATTR_INITIALIZER or foothread_attr_init() before use; foothread_create
+// exits with an error on one whose fields are out of range, as an uninitialised one mostly is
+#define FOOTHREAD_ATTR_INITIALIZER {FOOTHREAD_DETACHED, FOOTHREAD_DEFAULT_STACK_SIZE, 0, {{0}}, -1, FOOTHREAD_MEM_DEFAULT}
 
 typedef struct {
     pid_t pid;
     pid_t tid;
+    int slot; // Registry slot of the thread
+    uint32_t gen; // Generation of the slot when the thread was created
 } foothread_t;
 
+// Thread-specific data
+#define FOOTHREAD_KEYS_MAX 128
+typedef unsigned int foothread_key_t;
+
+// Mutex on a futex word: 0 unlocked, 1 locked, 2 locked with (possibly) waiters
+#define FOOTHREAD_MUTEX_UNLOCKED 0
+#define FOOTHREAD_MUTEX_LOCKED 1
+#define FOOTHREAD_MUTEX_CONTENDED 2
+
 typedef struct {
     int is_live;
-    int is_locked;
-    pid_t owner_pid;
-    pid_t owner_tid;
-    sem_t sem;
+    uint32_t state; // FOOTHREAD_MUTEX_*, only accessed atomically
+    pid_t owner_tid; // Thread holding the mutex, 0 if none
 } foothread_mutex_t;
 
+// Condition variable on a futex sequence number, used with a foothread_mutex_t
+typedef struct {
+    int is_live;
+    uint32_t seq; // Bumped by every signal and broadcast, the futex word of the waiters
+    int waiters; // Threads in foothread_cond_wait
+    foothread_mutex_t *mutex; // Mutex of the waiters, where broadcast requeues them
+} foothread_cond_t;
+
+// Reader-writer lock state: count of readers in the low bits, and two flags
+#define FOOTHREAD_RWLOCK_WRITER 0x80000000u // Held by a writer
+#define FOOTHREAD_RWLOCK_PENDING 0x40000000u // A writer waits: new readers wait too
+
+typedef struct {
+    int is_live;
+    uint32_t state;
+    uint32_t read_seq; // Futex word of the waiting readers, bumped when a writer lets them in
+    uint32_t write_seq; // Futex word of the waiting writers, bumped when one may go
+    int readers_waiting;
+    int writers_waiting; // Writers in foothread_rwlock_wrlock, the holder excluded
+    pid_t writer_tid; // Writer holding the lock, 0 if none
+} foothread_rwlock_t;
+
+// Barrier algorithms
+#define FOOTHREAD_BARRIER_CENTRAL 40 // One counter and one release flag (sense-reversing)
+#define FOOTHREAD_BARRIER_TREE 41 // Combining tree of counters, released down the tree
+#define FOOTHREAD_BARRIER_DISSEMINATION 42 // log2(n) rounds of pairwise signals, no counter
+
+#define FOOTHREAD_BARRIER_DEFAULT_FANIN 4
+
+typedef struct {
+    int algorithm; // FOOTHREAD_BARRIER_*
+    int fanin; // Children of each node of the combining tree
+} foothread_barrierattr_t;
+
+#define FOOTHREAD_BARRIERATTR_INITIALIZER {FOOTHREAD_BARRIER_CENTRAL, FOOTHREAD_BARRIER_DEFAULT_FANIN}
+
 typedef struct {
     int is_live;
     int n;
-    int count;
-    sem_t mutex;
-    sem_t sem1;
-    sem_t sem2;
+    int algorithm;
+    int fanin;
+    unsigned long ticket; // Arrivals since init: ticket / n is the episode, ticket % n the index of the arrival in it
+    uint32_t release; // Central release flag
+    void *nodes; // Combining tree nodes, leaves first
+    int rounds; // Dissemination rounds
+    uint32_t *flags; // Dissemination flags, by episode parity, round and index
 } foothread_barrier_t;
 
+// Work-stealing task pool: a fixed set of worker foothreads, each with a deque of tasks. A task spawns
+// children into its worker's deque and syncs on them; idle workers steal from the other deques.
+typedef struct foothread_worker foothread_worker_t;
+
+// Children of a task to sync on
+typedef struct {
+    uint32_t state; // Children spawned and not done yet, times two; the low bit tells that the syncing thread sleeps
+} foothread_taskgroup_t;
+
+#define FOOTHREAD_TASKGROUP_INITIALIZER {0}
+
+typedef struct foothread_task {
+    void (*fn)(foothread_worker_t *, void *); // Called with the worker running the task
+    void *arg;
+    foothread_taskgroup_t *group; // Group told when the task is done
+    struct foothread_task *next; // Free list or queue of submitted tasks
+    int pooled; // Allocated from a worker's task slab
+} foothread_task_t;
+
+typedef struct foothread_deque_array {
+    long size; // A power of two
+    struct foothread_deque_array *prev; // Array it replaced, kept until the pool is destroyed as thieves may still read it
+    foothread_task_t *buf[];
+} foothread_deque_array_t;
+
+// Chase-Lev deque: the owner pushes and takes at the bottom, thieves steal at the top
+typedef struct {
+    long top __attribute__((aligned(64)));
+    long bottom __attribute__((aligned(64)));
+    foothread_deque_array_t *array;
+} foothread_deque_t;
 
+struct foothread_worker {
+    struct foothread_pool *pool;
+    int id;
+    foothread_t thread;
+    foothread_deque_t deque;
+    uint64_t rng; // Picks the victims of steals
+    foothread_task_t *free_tasks; // Tasks this worker ran, ready for its next spawns
+    void *slabs; // Task slabs allocated by this worker
+};
+
+typedef struct foothread_pool {
+    int nworkers;
+    int spins; // Rounds of failed steals before parking
+    foothread_worker_t *workers;
+    int stop;
+    uint32_t signal; // Bumped to wake parked workers
+    int sleepers; // Workers parked or about to park
+    uint32_t submit_lock; // Lock word of the queue of tasks submitted from outside the pool
+    foothread_task_t *submit_head;
+    foothread_task_t *submit_tail;
+} foothread_pool_t;
+
+
+void foothread_attr_init ( foothread_attr_t * ) ;
 void foothread_attr_setjointype ( foothread_attr_t * , int ) ;
 void foothread_attr_setstacksize ( foothread_attr_t * , int ) ;
+void foothread_attr_setaffinity ( foothread_attr_t * , const cpu_set_t * ) ;
+void foothread_attr_setmemnode ( foothread_attr_t * , int , int ) ;
+int foothread_attr_spread ( foothread_attr_t * , int ) ;
 void foothread_create ( foothread_t * , foothread_attr_t * , int (*)(void *) , void * ) ;
+void foothread_join ( foothread_t * , int * ) ;
 void foothread_exit ( ) ;
 
+void foothread_key_create ( foothread_key_t * , void (*)(void *) ) ;
+void foothread_key_delete ( foothread_key_t ) ;
+void * foothread_getspecific ( foothread_key_t ) ;
+void foothread_setspecific ( foothread_key_t , const void * ) ;
+
 void foothread_mutex_init(foothread_mutex_t *mutex);
 void foothread_mutex_lock(foothread_mutex_t *mutex);
 void foothread_mutex_unlock(foothread_mutex_t *mutex);
 void foothread_mutex_destroy(foothread_mutex_t *mutex);
 
+void foothread_cond_init ( foothread_cond_t * ) ;
+void foothread_cond_wait ( foothread_cond_t * , foothread_mutex_t * ) ;
+void foothread_cond_signal ( foothread_cond_t * ) ;
+void foothread_cond_broadcast ( foothread_cond_t * ) ;
+void foothread_cond_destroy ( foothread_cond_t * ) ;
+
+void foothread_rwlock_init ( foothread_rwlock_t * ) ;
+void foothread_rwlock_rdlock ( foothread_rwlock_t * ) ;
+void foothread_rwlock_wrlock ( foothread_rwlock_t * ) ;
+void foothread_rwlock_unlock ( foothread_rwlock_t * ) ;
+void foothread_rwlock_destroy ( foothread_rwlock_t * ) ;
+
+void foothread_barrierattr_setalgorithm ( foothread_barrierattr_t * , int ) ;
+void foothread_barrierattr_setfanin ( foothread_barrierattr_t * , int ) ;
 void foothread_barrier_init ( foothread_barrier_t * , int ) ;
+void foothread_barrier_init_attr ( foothread_barrier_t * , int , foothread_barrierattr_t * ) ;
 void foothread_barrier_wait ( foothread_barrier_t * ) ;
-void foothread_barrier_destroy ( foothread_barrier_t * ) ;
\ No newline at end of file
+void foothread_barrier_destroy ( foothread_barrier_t * ) ;
+
+void foothread_pool_init ( foothread_pool_t * , int ) ;
+void foothread_pool_run ( foothread_pool_t * , void (*)(foothread_worker_t *, void *) , void * ) ;
+void foothread_pool_destroy ( foothread_pool_t * ) ;
+void foothread_spawn ( foothread_worker_t * , foothread_taskgroup_t * , void (*)(foothread_worker_t *, void *) , void * ) ;
+void foothread_sync ( foothread_worker_t * , foothread_taskgroup_t * ) ;
\ No newline at end of file
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Benchmark of the master/sched/mmu/process pipeline: every configuration is run by ./master in batch mode
+// (no xterm, fixed seed), one at a time as the programs find their IPC objects through fixed keys.
+
+#define MAX_VALUES 256
+#define MAX_OUTPUT (1 << 16)
+
+// Values of one dimension of the sweep, kept as the strings handed to the master
+typedef struct {
+    char *vals[MAX_VALUES];
+    int n;
+} dim_t;
+
+// Dimensions, in the order of the report; the last varies fastest
+#define DIM_K 0
+#define DIM_M 1
+#define DIM_F 2
+#define DIM_SCHED 3
+#define DIM_QUANTUM 4
+#define DIM_CPUS 5
+#define DIM_THREADS 6
+#define DIM_MODEL 7
+#define DIM_SEED 8
+#define NUM_DIMS 9
+
+// Outcome of one run, as summarized by the master
+typedef struct {
+    const char *status; // ok, timeout or failed
+    double elapsed;     // Seconds from the first process to the last termination
+    long references;
+    long page_faults;
+    long no_victim;
+    long illegal_access;
+    long calls[3];      // IPC calls of the scheduler, the mmu and the processes
+} result_t;
+
+dim_t dims[NUM_DIMS];
+int repeats = 1;
+double timeout_s = 60.0;
+int json = 0;
+
+// Config file option names, and the flag each one stands for
+static const char *long_names[] = {"processes", "pages", "frames", "sched", "quantum", "cpus", "threads", "model", "seed",
+                                   "repeat", "timeout", "format", NULL};
+static const char *long_flags = "kmfsqcjgSrto";
+
+// Seconds on the monotonic clock
+double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Expand "a,b,c" with "lo:hi" or "lo:hi:step" ranges into the values of a numeric dimension
+void parse_numbers(dim_t *dim, const char *arg) {
+    dim->n = 0;
+    char *copy = strdup(arg);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        int lo, hi, step = 1;
+        int cnt = sscanf(tok, "%d:%d:%d", &lo, &hi, &step);
+        if (cnt == 1) hi = lo;
+        if (cnt < 1 || step < 1) {
+            fprintf(stderr, "Invalid value list: %s\n", arg);
+            exit(1);
+        }
+        for (int v = lo; v <= hi && dim->n < MAX_VALUES; v += step) {
+            char buf[16];
+            sprintf(buf, "%d", v);
+            dim->vals[dim->n++] = strdup(buf);
+        }
+    }
+    free(copy);
+}
+
+// Split "a,b,c" into the values of a dimension of names (schedulers, locality models)
+void parse_strings(dim_t *dim, const char *arg) {
+    dim->n = 0;
+    char *copy = strdup(arg);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL && dim->n < MAX_VALUES; tok = strtok_r(NULL, ",", &save)) {
+        dim->vals[dim->n++] = strdup(tok);
+    }
+    free(copy);
+}
+
+void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-F config file] [-k processes] [-m pages] [-f frames] [-s schedulers] [-q quanta] [-c cpus] [-j mmu threads] "
+                    "[-g models] [-S seeds] [-r repeats] [-t timeout s] [-o csv|json]\n", prog);
+    fprintf(stderr, "\tprocesses, pages, frames, quanta, cpus, mmu threads, seeds: comma separated values or lo:hi[:step] ranges\n"
+                    "\t(defaults 4, 10, 20, 5, 1, 1 and 1)\n");
+    fprintf(stderr, "\tschedulers: comma separated list of fifo, rr or mlfq (default fifo)\n");
+    fprintf(stderr, "\tmodels: comma separated locality models of the reference strings, as master -g (default uniform);\n"
+                    "\t        no illegal addresses unless a model ends in @p\n");
+    fprintf(stderr, "\trepeats: runs of every configuration (default 1); timeout: seconds before a run is interrupted (default 60)\n");
+    fprintf(stderr, "\tconfig file: lines '<option> <value>', the option a flag letter or one of processes, pages, frames, sched,\n"
+                    "\tquantum, cpus, threads, model, seed, repeat, timeout, format; flags after -F override the file\n");
+    fprintf(stderr, "Run from the directory of master, sched, mmu and process.\n");
+    exit(1);
+}
+
+// Apply one option, from the command line or the config file
+void set_option(char *prog, int opt, const char *arg) {
+    switch (opt) {
+        case 'k': parse_numbers(&dims[DIM_K], arg); break;
+        case 'm': parse_numbers(&dims[DIM_M], arg); break;
+        case 'f': parse_numbers(&dims[DIM_F], arg); break;
+        case 's': parse_strings(&dims[DIM_SCHED], arg); break;
+        case 'q': parse_numbers(&dims[DIM_QUANTUM], arg); break;
+        case 'c': parse_numbers(&dims[DIM_CPUS], arg); break;
+        case 'j': parse_numbers(&dims[DIM_THREADS], arg); break;
+        case 'g': parse_strings(&dims[DIM_MODEL], arg); break;
+        case 'S': parse_numbers(&dims[DIM_SEED], arg); break;
+        case 'r': repeats = atoi(arg); break;
+        case 't': timeout_s = atof(arg); break;
+        case 'o':
+            if (strcmp(arg, "json") == 0) json = 1;
+            else if (strcmp(arg, "csv") == 0) json = 0;
+            else usage(prog);
+            break;
+        default: usage(prog);
+    }
+}
+
+// Read the options of a config file
+void load_config(char *prog, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        char name[64], value[960];
+        if (line[0] == '#' || sscanf(line, "%63s %959s", name, value) < 1) continue;
+        int opt = -1;
+        if (strlen(name) == 1) opt = name[0];
+        for (int i = 0; long_names[i] != NULL; i++) {
+            if (strcmp(name, long_names[i]) == 0) opt = long_flags[i];
+        }
+        if (opt == -1 || sscanf(line, "%63s %959s", name, value) < 2) {
+            fprintf(stderr, "%s:%d: expected '<option> <value>'\n", path, lineno);
+            exit(1);
+        }
+        set_option(prog, opt, value);
+    }
+    fclose(fp);
+}
+
+// Run the master once: k, m and f go to its standard input, the summary comes back on its standard output.
+// The master leads a process group of its own, so that a run that overstays the timeout is interrupted whole.
+void run(char **vals, result_t *res) {
+    memset(res, 0, sizeof(result_t));
+    res->status = "failed";
+
+    int in[2], out[2];
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        char *argv[] = {"./master", "-B", "-S", vals[DIM_SEED], "-j", vals[DIM_THREADS], "-g", vals[DIM_MODEL],
+                        vals[DIM_SCHED], vals[DIM_QUANTUM], vals[DIM_CPUS], NULL};
+        execv("./master", argv);
+        perror("./master");
+        exit(1);
+    }
+    setpgid(pid, pid);
+    close(in[0]);
+    close(out[1]);
+    dprintf(in[1], "%s %s %s\n", vals[DIM_K], vals[DIM_M], vals[DIM_F]);
+    close(in[1]);
+
+    // Collect the output until the master exits or the run times out
+    char *output = (char *)malloc(MAX_OUTPUT);
+    size_t len = 0;
+    double deadline = now_s() + timeout_s;
+    int timed_out = 0;
+    while (1) {
+        double left = deadline - now_s();
+        if (left <= 0 && !timed_out) {
+            // SIGINT: the master removes the IPC objects on its way out
+            kill(-pid, SIGINT);
+            timed_out = 1;
+            deadline = now_s() + 5;
+            continue;
+        }
+        if (left <= 0) {
+            kill(-pid, SIGKILL);
+            break;
+        }
+        struct pollfd pfd = {out[0], POLLIN, 0};
+        int r = poll(&pfd, 1, (int)(left * 1000) + 1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) continue;
+        ssize_t n = read(out[0], output + len, MAX_OUTPUT - 1 - len);
+        if (n <= 0) break;
+        len += n;
+        if (len == MAX_OUTPUT - 1) len = 0; // Only the end of the output matters
+    }
+    output[len] = '\0';
+    close(out[0]);
+    int status;
+    waitpid(pid, &status, 0);
+
+    char *line = strstr(output, "Run: ");
+    if (timed_out) {
+        res->status = "timeout";
+    } else if (line != NULL && sscanf(line, "Run: elapsed %lf references %ld page_faults %ld no_victim %ld illegal_access %ld "
+                                            "sched_calls %ld mmu_calls %ld process_calls %ld",
+                                      &res->elapsed, &res->references, &res->page_faults, &res->no_victim, &res->illegal_access,
+                                      &res->calls[0], &res->calls[1], &res->calls[2]) == 8) {
+        res->status = "ok";
+    }
+    free(output);
+}
+
+int main(int argc, char *argv[]) {
+    // Defaults: a small run of the assignment's own setup
+    parse_numbers(&dims[DIM_K], "4");
+    parse_numbers(&dims[DIM_M], "10");
+    parse_numbers(&dims[DIM_F], "20");
+    parse_strings(&dims[DIM_SCHED], "fifo");
+    parse_numbers(&dims[DIM_QUANTUM], "5");
+    parse_numbers(&dims[DIM_CPUS], "1");
+    parse_numbers(&dims[DIM_THREADS], "1");
+    parse_strings(&dims[DIM_MODEL], "uniform");
+    parse_numbers(&dims[DIM_SEED], "1");
+
+    int opt;
+    while ((opt = getopt(argc, argv, "F:k:m:f:s:q:c:j:g:S:r:t:o:h")) != -1) {
+        if (opt == 'F') load_config(argv[0], optarg);
+        else set_option(argv[0], opt, optarg);
+    }
+    if (optind != argc || repeats < 1 || timeout_s <= 0) usage(argv[0]);
+    for (int d = 0; d < NUM_DIMS; d++) {
+        if (dims[d].n == 0) usage(argv[0]);
+    }
+    if (access("./master", X_OK) != 0) {
+        fprintf(stderr, "./master not found: run from the directory of the programs (make all)\n");
+        exit(1);
+    }
+
+    int num_configs = 1;
+    for (int d = 0; d < NUM_DIMS; d++) num_configs *= dims[d].n;
+
+    if (json) printf("[\n");
+    else printf("k,m,f,sched,quantum,cpus,threads,model,seed,run,status,elapsed_s,references,refs_per_s,page_faults,no_victim,"
+                "illegal_access,fault_rate,sched_calls,mmu_calls,process_calls,ipc_per_ref\n");
+    fflush(stdout);
+
+    double start = now_s();
+    int runs = 0, failed = 0;
+    for (int idx = 0; idx < num_configs; idx++) {
+        // Decode the configuration digit by digit
+        char *vals[NUM_DIMS];
+        int rest = idx;
+        for (int d = NUM_DIMS - 1; d >= 0; d--) {
+            vals[d] = dims[d].vals[rest % dims[d].n];
+            rest /= dims[d].n;
+        }
+        for (int r = 0; r < repeats; r++) {
+            result_t res;
+            run(vals, &res);
+            if (strcmp(res.status, "ok") != 0) failed++;
+
+            long calls = res.calls[0] + res.calls[1] + res.calls[2];
+            double refs_per_s = res.elapsed > 0 ? res.references / res.elapsed : 0.0;
+            double rate = res.references ? (double)res.page_faults / res.references : 0.0;
+            double per_ref = res.references ? (double)calls / res.references : 0.0;
+            if (json) {
+                printf("%s  {\"k\": %s, \"m\": %s, \"f\": %s, \"sched\": \"%s\", \"quantum\": %s, \"cpus\": %s, \"threads\": %s, "
+                       "\"model\": \"%s\", \"seed\": %s, \"run\": %d, \"status\": \"%s\", \"elapsed_s\": %.6f, \"references\": %ld, "
+                       "\"refs_per_s\": %.1f, \"page_faults\": %ld, \"no_victim\": %ld, \"illegal_access\": %ld, \"fault_rate\": %.6f, "
+                       "\"sched_calls\": %ld, \"mmu_calls\": %ld, \"process_calls\": %ld, \"ipc_per_ref\": %.3f}",
+                       runs ? ",\n" : "", vals[DIM_K], vals[DIM_M], vals[DIM_F], vals[DIM_SCHED], vals[DIM_QUANTUM], vals[DIM_CPUS],
+                       vals[DIM_THREADS], vals[DIM_MODEL], vals[DIM_SEED], r + 1, res.status, res.elapsed, res.references,
+                       refs_per_s, res.page_faults, res.no_victim, res.illegal_access, rate,
+                       res.calls[0], res.calls[1], res.calls[2], per_ref);
+            } else {
+                printf("%s,%s,%s,%s,%s,%s,%s,%s,%s,%d,%s,%.6f,%ld,%.1f,%ld,%ld,%ld,%.6f,%ld,%ld,%ld,%.3f\n",
+                       vals[DIM_K], vals[DIM_M], vals[DIM_F], vals[DIM_SCHED], vals[DIM_QUANTUM], vals[DIM_CPUS],
+                       vals[DIM_THREADS], vals[DIM_MODEL], vals[DIM_SEED], r + 1, res.status, res.elapsed, res.references,
+                       refs_per_s, res.page_faults, res.no_victim, res.illegal_access, rate,
+                       res.calls[0], res.calls[1], res.calls[2], per_ref);
+            }
+            fflush(stdout);
+            runs++;
+        }
+    }
+    if (json) printf("\n]\n");
+    fflush(stdout);
+    fprintf(stderr, "%d runs (%d failed or timed out) in %.3f s\n", runs, failed, now_s() - start);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <evlog.h>
+
+// Write all the bytes, retrying short writes
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Write out what the producer of a ring has published, in as few writes as possible. Returns the records taken.
+static uint64_t drain(evlog_t *log, evlog_ring_t *r) {
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == tail) return 0;
+
+    // Records up to the end of the ring, the rest is taken on the next pass
+    uint64_t idx = tail & (EVLOG_RING_SIZE - 1);
+    uint64_t n = head - tail;
+    if (n > EVLOG_RING_SIZE - idx) n = EVLOG_RING_SIZE - idx;
+    if (!log->error && write_all(log->fd, &r->ring[idx], n * sizeof(evlog_rec_t)) < 0) log->error = 1;
+
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    return n;
+}
+
+// Writer thread: drain the rings in turn
+static void *writer_main(void *arg) {
+    evlog_t *log = (evlog_t *)arg;
+
+    while (1) {
+        int stop = atomic_load_explicit(&log->stop, memory_order_acquire);
+        uint64_t n = 0;
+        for (int i = 0; i < log->nrings; i++) n += drain(log, &log->rings[i]);
+        if (n == 0) {
+            if (stop) break;
+            // Nothing to do: nap rather than spin, the rings absorb the bursts
+            struct timespec ts = {0, 200000};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void free_rings(evlog_t *log) {
+    for (int i = 0; i < log->nrings; i++) free(log->rings[i].ring);
+    free(log->rings);
+    log->rings = NULL;
+}
+
+// Create the log file with one ring per producer thread and start the writer thread
+int evlog_open(evlog_t *log, const char *path, int nrings) {
+    memset(log, 0, sizeof(evlog_t));
+    if (nrings < 1) return -1;
+    // The head and tail of each ring sit on cache lines of their own
+    log->rings = (evlog_ring_t *)aligned_alloc(64, nrings * sizeof(evlog_ring_t));
+    if (log->rings == NULL) return -1;
+    memset(log->rings, 0, nrings * sizeof(evlog_ring_t));
+    log->nrings = nrings;
+    for (int i = 0; i < nrings; i++) {
+        log->rings[i].ring = (evlog_rec_t *)malloc(EVLOG_RING_SIZE * sizeof(evlog_rec_t));
+        if (log->rings[i].ring == NULL) {
+            free_rings(log);
+            return -1;
+        }
+    }
+
+    log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (log->fd < 0) {
+        free_rings(log);
+        return -1;
+    }
+    evlog_hdr_t hdr = {EVLOG_MAGIC, EVLOG_VERSION, sizeof(evlog_rec_t), nrings};
+    if (write_all(log->fd, &hdr, sizeof(hdr)) < 0 || pthread_create(&log->writer, NULL, writer_main, log) != 0) {
+        close(log->fd);
+        free_rings(log);
+        return -1;
+    }
+    return 0;
+}
+
+// Append a record to the ring of a producer; only waits if the writer has fallen a whole ring behind
+void evlog_put(evlog_t *log, int ring, uint32_t timestamp, int slot, int pid, int page, int frame, int outcome) {
+    evlog_ring_t *r = &log->rings[ring];
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - r->cached_tail >= EVLOG_RING_SIZE) {
+        r->cached_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        while (head - r->cached_tail >= EVLOG_RING_SIZE) {
+            r->stalls++;
+            sched_yield();
+            r->cached_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        }
+    }
+
+    evlog_rec_t *rec = &r->ring[head & (EVLOG_RING_SIZE - 1)];
+    rec->timestamp = timestamp;
+    rec->slot = slot;
+    rec->pid = pid;
+    rec->page = page;
+    rec->frame = frame;
+    rec->outcome = outcome;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+// Drain the rings, stop the writer and close the file
+void evlog_close(evlog_t *log) {
+    if (log->rings == NULL) return;
+    atomic_store_explicit(&log->stop, 1, memory_order_release);
+    pthread_join(log->writer, NULL);
+    close(log->fd);
+    free_rings(log);
+}
+
+// Per-process totals gathered while rendering
+typedef struct {
+    int pid;
+    int page_faults;
+    int illegal_access;
+} render_proc_t;
+
+static int by_timestamp(const void *a, const void *b) {
+    uint32_t x = ((const evlog_rec_t *)a)->timestamp, y = ((const evlog_rec_t *)b)->timestamp;
+    return (x > y) - (x < y);
+}
+
+// Read the header of a log, -1 if the file is not a log of this build
+static int read_header(FILE *in, evlog_hdr_t *hdr) {
+    if (fread(hdr, sizeof(*hdr), 1, in) != 1 || hdr->magic != EVLOG_MAGIC || hdr->version != EVLOG_VERSION ||
+        hdr->rec_size != sizeof(evlog_rec_t)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Read the rest of the records of a log and put them in timestamp order
+static size_t read_records(FILE *in, evlog_rec_t **out) {
+    evlog_rec_t *recs = NULL;
+    size_t nrecs = 0, cap = 0;
+    while (1) {
+        if (nrecs == cap) {
+            cap = cap ? 2 * cap : EVLOG_RING_SIZE;
+            evlog_rec_t *r = (evlog_rec_t *)realloc(recs, cap * sizeof(evlog_rec_t));
+            if (r == NULL) break;
+            recs = r;
+        }
+        size_t n = fread(recs + nrecs, sizeof(evlog_rec_t), cap - nrecs, in);
+        nrecs += n;
+        if (n == 0) break;
+    }
+    qsort(recs, nrecs, sizeof(evlog_rec_t), by_timestamp);
+    *out = recs;
+    return nrecs;
+}
+
+// Read a whole log, in timestamp order whatever the number of producers. Returns the number of records
+// (to be freed by the caller), -1 if the log is not readable.
+long evlog_load(FILE *in, evlog_rec_t **recs) {
+    evlog_hdr_t hdr;
+    *recs = NULL;
+    if (read_header(in, &hdr) < 0) return -1;
+    return (long)read_records(in, recs);
+}
+
+// Turn a binary log into the text the mmu used to write to result.txt.
+// verbose adds the lines that only went to the terminal. Returns -1 if the log is not readable.
+int evlog_render(FILE *in, FILE *out, int verbose) {
+    evlog_hdr_t hdr;
+    if (read_header(in, &hdr) < 0) return -1;
+
+    // The rings of several producers interleave in the file: read the whole log and put it back in order
+    evlog_rec_t *recs = NULL;
+    size_t nrecs = 0, next = 0;
+    if (hdr.rings > 1) nrecs = read_records(in, &recs);
+
+    render_proc_t *procs = NULL;
+    int nprocs = 0;
+    int finished = 0; // Processes that terminated, as counted by the mmu
+    evlog_rec_t rec;
+    while (1) {
+        if (recs != NULL) {
+            if (next == nrecs) break;
+            rec = recs[next++];
+        } else if (fread(&rec, sizeof(rec), 1, in) != 1) {
+            break;
+        }
+        if (rec.slot < 0) continue;
+        if (rec.slot >= nprocs) {
+            int n = rec.slot + 1;
+            render_proc_t *p = (render_proc_t *)realloc(procs, n * sizeof(render_proc_t));
+            if (p == NULL) break;
+            memset(p + nprocs, 0, (n - nprocs) * sizeof(render_proc_t));
+            procs = p;
+            nprocs = n;
+        }
+        render_proc_t *p = &procs[rec.slot];
+        p->pid = rec.pid;
+
+        fprintf(out, "Global ordering - (Timestamp %u, Process %d, Page %d)\n", rec.timestamp, rec.slot + 1, rec.page);
+        switch (rec.outcome) {
+            case EVLOG_FAULT:
+            case EVLOG_NO_VICTIM:
+                p->page_faults++;
+                fprintf(out, "Page fault sequence - (Process %d, Page %d)\n", rec.slot + 1, rec.page);
+                if (verbose && rec.outcome == EVLOG_NO_VICTIM) {
+                    fprintf(out, "No page available for LRU replacement - (Process %d, Page %d)\n", rec.slot + 1, rec.page);
+                }
+                break;
+            case EVLOG_INVALID:
+                p->illegal_access++;
+                finished++;
+                fprintf(out, "Invalid Page Reference - (Process %d, Page %d)\n", rec.slot + 1, rec.page);
+                break;
+            case EVLOG_EXIT:
+                finished++;
+                break;
+        }
+    }
+
+    // Summary, as printed by the mmu when it is interrupted
+    fprintf(out, "*********************************************\n");
+    for (int i = 0; i < finished && i < nprocs; i++) {
+        fprintf(out, "=> Process no. %d (pid: %d):-\n", i + 1, procs[i].pid);
+        fprintf(out, "\t-Total no. of page faults: %d\n", procs[i].page_faults);
+        fprintf(out, "\t-Total no. of invalid page references: %d\n", procs[i].illegal_access);
+    }
+    free(procs);
+    free(recs);
+    return 0;
+}
+
+// Buckets of the inter-fault distance histograms: bucket b holds distances 2^b to 2^(b+1) - 1
+#define TIMELINE_BUCKETS 32
+
+// State of one process while its timeline is built
+typedef struct {
+    int pid;
+    int alive;          // Seen and not terminated yet
+    long refs;          // References made so far: the virtual time of the process
+    long win_refs;      // References and faults in the current window
+    long win_faults;
+    int rss;            // Frames held
+    int wss;            // Distinct pages among the last delta references, W(t, delta)
+    int *ring;          // Pages of the last delta references, by virtual time modulo delta
+    long *last;         // Virtual time of the latest reference to each page (0: none)
+    int npages;
+    long last_fault;    // Virtual time of the previous fault (0: none)
+    long hist[TIMELINE_BUCKETS];
+} timeline_proc_t;
+
+// Grow an array of n elements of the given size to hold index i, zeroing the new elements
+static void *grow(void *arr, int *n, int i, size_t size) {
+    if (i < *n) return arr;
+    int m = (*n > 0) ? *n : 16;
+    while (m <= i) m *= 2;
+    char *a = (char *)realloc(arr, m * size);
+    if (a == NULL) return NULL;
+    memset(a + *n * size, 0, (m - *n) * size);
+    *n = m;
+    return a;
+}
+
+// One row per process active in the window that ends at timestamp t
+static void timeline_rows(FILE *out, timeline_proc_t *procs, int nprocs, uint32_t t, int frames_used) {
+    for (int i = 0; i < nprocs; i++) {
+        timeline_proc_t *p = &procs[i];
+        if (!p->alive && p->win_refs == 0) continue;
+        fprintf(out, "%d,%d,%u,%ld,%ld,%.4f,%d,%d,%d,%d\n", i + 1, p->pid, t, p->win_refs, p->win_faults,
+                p->win_refs ? (double)p->win_faults / p->win_refs : 0.0, p->rss, p->wss, p->wss - p->rss, frames_used);
+        p->win_refs = p->win_faults = 0;
+    }
+}
+
+// Time series of every process from a binary log, in windows of the mmu's global timestamps: references and faults
+// in the window, and at its end the resident set, the working set W(t, delta) over the last delta references of the
+// process, the pages of the working set that are not resident, and the frames in use over all the processes.
+// A process keeps faulting when its working set does not fit in its resident set, which the frames in use explain.
+// With hist, also writes the histogram of the references between consecutive faults of each process.
+// Returns -1 if the log is not readable.
+int evlog_timeline(FILE *in, FILE *out, FILE *hist, int window, int delta) {
+    evlog_rec_t *recs;
+    long nrecs = evlog_load(in, &recs);
+    if (nrecs < 0) return -1;
+
+    timeline_proc_t *procs = NULL;
+    int nprocs = 0;
+    int *owner = NULL; // Slot plus one of the process holding each frame, 0 if free
+    int nframes = 0, frames_used = 0;
+    uint32_t win_end = window;
+
+    fprintf(out, "proc,pid,t,references,page_faults,fault_rate,rss,wss,wss_not_resident,frames_used\n");
+    for (long r = 0; r < nrecs; r++) {
+        evlog_rec_t *rec = &recs[r];
+        while (rec->timestamp > win_end) {
+            timeline_rows(out, procs, nprocs, win_end, frames_used);
+            win_end += window;
+        }
+        if (rec->slot < 0) continue;
+        int n = nprocs;
+        timeline_proc_t *grown = (timeline_proc_t *)grow(procs, &n, rec->slot, sizeof(timeline_proc_t));
+        if (grown == NULL) break;
+        procs = grown;
+        nprocs = n;
+        timeline_proc_t *p = &procs[rec->slot];
+        if (p->ring == NULL) {
+            p->ring = (int *)calloc(delta, sizeof(int));
+            p->alive = 1;
+        }
+        p->pid = rec->pid;
+
+        if (rec->outcome == EVLOG_EXIT || rec->outcome == EVLOG_INVALID) {
+            if (rec->outcome == EVLOG_INVALID) {
+                p->refs++;
+                p->win_refs++;
+            }
+            // The mmu frees the frames of a process that terminates
+            for (int f = 0; f < nframes; f++) {
+                if (owner[f] == rec->slot + 1) {
+                    owner[f] = 0;
+                    frames_used--;
+                }
+            }
+            p->alive = 0;
+            p->rss = p->wss = 0;
+            continue;
+        }
+
+        long vt = ++p->refs;
+        p->win_refs++;
+        int page = rec->page;
+        if (page >= p->npages) {
+            int m = p->npages;
+            long *last = (long *)grow(p->last, &m, page, sizeof(long));
+            if (last == NULL) break;
+            p->last = last;
+            p->npages = m;
+        }
+        // W(t, delta): the reference made delta references ago leaves the window, this one enters it
+        int *oldest = &p->ring[vt % delta];
+        if (vt > delta && p->last[*oldest] == vt - delta) p->wss--;
+        if (p->last[page] == 0 || p->last[page] <= vt - delta) p->wss++;
+        p->last[page] = vt;
+        *oldest = page;
+
+        if (rec->outcome == EVLOG_FAULT || rec->outcome == EVLOG_NO_VICTIM) {
+            p->win_faults++;
+            if (p->last_fault > 0) {
+                int b = 0;
+                for (long d = vt - p->last_fault; d > 1 && b < TIMELINE_BUCKETS - 1; d >>= 1) b++;
+                p->hist[b]++;
+            }
+            p->last_fault = vt;
+        }
+        if (rec->outcome == EVLOG_FAULT && rec->frame >= 0) {
+            int *grown_owner = (int *)grow(owner, &nframes, rec->frame, sizeof(int));
+            if (grown_owner == NULL) break;
+            owner = grown_owner;
+            // A frame taken from another page of the same process (LRU replacement) leaves the resident set as it is
+            if (owner[rec->frame] != rec->slot + 1) {
+                if (owner[rec->frame] > 0) procs[owner[rec->frame] - 1].rss--;
+                else frames_used++;
+                owner[rec->frame] = rec->slot + 1;
+                p->rss++;
+            }
+        }
+    }
+    timeline_rows(out, procs, nprocs, win_end, frames_used);
+
+    if (hist != NULL) {
+        fprintf(hist, "proc,pid,distance_lo,distance_hi,count\n");
+        for (int i = 0; i < nprocs; i++) {
+            for (int b = 0; b < TIMELINE_BUCKETS; b++) {
+                if (procs[i].hist[b] == 0) continue;
+                fprintf(hist, "%d,%d,%ld,%ld,%ld\n", i + 1, procs[i].pid, 1L << b, (2L << b) - 1, procs[i].hist[b]);
+            }
+        }
+    }
+
+    for (int i = 0; i < nprocs; i++) {
+        free(procs[i].ring);
+        free(procs[i].last);
+    }
+    free(procs);
+    free(owner);
+    free(recs);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef __EVLOG_H
+#define __EVLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Outcome of a reference
+#define EVLOG_HIT 0       // Page was resident
+#define EVLOG_FAULT 1     // Page fault, a frame was found
+#define EVLOG_NO_VICTIM 2 // Page fault, no frame could be found (the process retries later)
+#define EVLOG_INVALID 3   // Page outside the address space, the process is terminated
+#define EVLOG_EXIT 4      // Process finished its reference string (page is -9)
+
+#define EVLOG_MAGIC 0x474f4c45 // "ELOG"
+#define EVLOG_VERSION 1
+
+// Records held by the ring (a power of two)
+#define EVLOG_RING_SIZE (1 << 16)
+
+// Start of a log file
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size; // sizeof(evlog_rec_t) of the writer
+    uint32_t rings;    // Producers of the log; with more than one, records are not in timestamp order
+} evlog_hdr_t;
+
+// One reference seen by the mmu
+typedef struct {
+    uint32_t timestamp; // Global ordering timestamp
+    int32_t slot;       // Index of the process in SM1
+    int32_t pid;        // Process id
+    int32_t page;       // Page referenced
+    int32_t frame;      // Frame the page is in, -1 if none
+    int32_t outcome;    // One of EVLOG_*
+} evlog_rec_t;
+
+// Single-producer ring
+typedef struct {
+    evlog_rec_t *ring;
+    _Alignas(64) _Atomic uint64_t head; // Next record the producer fills
+    uint64_t cached_tail;               // Producer's last view of tail
+    uint64_t stalls;                    // Times the producer found the ring full
+    _Alignas(64) _Atomic uint64_t tail; // Next record the writer drains
+} evlog_ring_t;
+
+// One ring per producer thread, all drained to a file by a writer thread
+typedef struct {
+    evlog_ring_t *rings;
+    int nrings;
+    _Atomic int stop;                   // Set when the writer should drain and exit
+    int fd;
+    int error;                          // Set if a write failed
+    pthread_t writer;
+} evlog_t;
+
+int evlog_open ( evlog_t * , const char * , int ) ;
+void evlog_put ( evlog_t * , int , uint32_t , int , int , int , int , int ) ;
+void evlog_close ( evlog_t * ) ;
+int evlog_render ( FILE * , FILE * , int ) ;
+long evlog_load ( FILE * , evlog_rec_t ** ) ;
+int evlog_timeline ( FILE * , FILE * , FILE * , int , int ) ;
+
+#endif
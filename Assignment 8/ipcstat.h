@@ -0,0 +1,21 @@
+#ifndef __IPCSTAT_H
+#define __IPCSTAT_H
+
+#include <stdatomic.h>
+
+// Programs that count their IPC system calls
+#define IPCSTAT_SCHED 0
+#define IPCSTAT_MMU 1
+#define IPCSTAT_PROCESS 2
+#define IPCSTAT_NUM 3
+
+// Counters of a run (Shared Memory 3), created by the master and found by every program through
+// ftok("mmu.c", 'C'), as the scheduler finds the synchronization semaphore. Each program counts in
+// private variables and adds them here before it tells the next program that it is done.
+typedef struct {
+    _Atomic long calls[IPCSTAT_NUM]; // msgsnd, msgrcv and semop calls of each program
+    _Atomic long references;         // References served by the mmu, the retries after a fault included
+    _Atomic long no_victim;          // Faults the mmu could not serve (the process retried later)
+} ipcstat_t;
+
+#endif
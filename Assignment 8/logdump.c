@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <evlog.h>
+
+void usage(char *prog) {
+    printf("Usage: %s [-v] [-t [-w <Window>] [-d <Delta>] [-H <Histogram File>]] <Event Log> [<Output File>]\n", prog);
+    printf("\t-v: also the lines the mmu only printed to its terminal\n");
+    printf("\t-t: per-process time series as CSV instead of the text of result.txt, one row per process and window of\n");
+    printf("\t    <Window> references of the mmu (default 100), with the working set over the last <Delta> references\n");
+    printf("\t    of the process (default 10); -H also writes the histograms of the references between faults\n");
+    exit(1);
+}
+
+// Render the binary event log written by the mmu in the text format of result.txt, or as time series
+int main(int argc, char *argv[]) {
+    int verbose = 0, timeline = 0, window = 100, delta = 10;
+    char *hist_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "vtw:d:H:")) != -1) {
+        switch (opt) {
+            case 'v': verbose = 1; break;
+            case 't': timeline = 1; break;
+            case 'w': window = atoi(optarg); break;
+            case 'd': delta = atoi(optarg); break;
+            case 'H': hist_file = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    int argi = optind;
+    if (argc - argi < 1 || argc - argi > 2 || window < 1 || delta < 1 || (hist_file != NULL && !timeline)) usage(argv[0]);
+
+    FILE *in = fopen(argv[argi], "rb");
+    if (in == NULL) {
+        perror(argv[argi]);
+        exit(1);
+    }
+    FILE *out = stdout;
+    if (argc - argi == 2) {
+        out = fopen(argv[argi + 1], "w");
+        if (out == NULL) {
+            perror(argv[argi + 1]);
+            exit(1);
+        }
+    }
+    FILE *hist = NULL;
+    if (hist_file != NULL) {
+        hist = fopen(hist_file, "w");
+        if (hist == NULL) {
+            perror(hist_file);
+            exit(1);
+        }
+    }
+
+    int status = timeline ? evlog_timeline(in, out, hist, window, delta) : evlog_render(in, out, verbose);
+    if (status < 0) {
+        fprintf(stderr, "%s: not an mmu event log\n", argv[argi]);
+        exit(1);
+    }
+
+    fclose(in);
+    if (out != stdout) fclose(out);
+    if (hist != NULL) fclose(hist);
+    return 0;
+}
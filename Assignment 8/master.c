@@ -13,13 +13,15 @@
 #include <time.h>
 #include <fcntl.h>
 #include <signal.h>
-
-// Define probability of illegal address
-#define PROB_ILLEGAL_ADDR 0.1
+#include <refgen.h>
+#include <ipcstat.h>
 
 // Maximum virtual address space and maximum number of processes
 #define MAX_VIRTUAL_ADDR_SPACE 25
-#define MAX_PROCESSES 100
+#define MAX_PROCESSES 10000
+
+// Maximum number of mmu worker threads, each with a Message Queue 3 of its own
+#define MAX_MMU_WORKERS 64
 
 // Define P() and V() macros for semaphore operations
 #define P(s) semop(s, &pop, 1)
@@ -45,10 +47,13 @@ typedef struct SM1
 int sched_pid = -1;
 int mmu_pid = -1;
 int pid_mmu = -1;
-int sm1_id = -1, sm2_id = -1;
+int sm1_id = -1, sm2_id = -1, sm3_id = -1;
 SM1 *sm1 = NULL;
 int *sm2 = NULL;
-int msg_id1 = -1, msg_id2 = -1, msg_id3 = -1;
+ipcstat_t *sm3 = NULL;
+int msg_id1 = -1, msg_id2 = -1;
+int msg_id3[MAX_MMU_WORKERS];
+int num_workers = 1;
 int sync_sem = -1;
 
 // Function to cleanup resources on exit
@@ -57,11 +62,15 @@ void cleanup_on_exit() {
     if (pid_mmu > 0) kill(pid_mmu, SIGINT);
     if (sm1 != NULL) shmdt(sm1);
     if (sm2 != NULL) shmdt(sm2);
+    if (sm3 != NULL) shmdt(sm3);
     if (sm1_id > 0) shmctl(sm1_id, IPC_RMID, NULL);
     if (sm2_id > 0) shmctl(sm2_id, IPC_RMID, NULL);
+    if (sm3_id > 0) shmctl(sm3_id, IPC_RMID, NULL);
     if (msg_id1 > 0) msgctl(msg_id1, IPC_RMID, NULL);
     if (msg_id2 > 0) msgctl(msg_id2, IPC_RMID, NULL);
-    if (msg_id3 > 0) msgctl(msg_id3, IPC_RMID, NULL);
+    for (int i = 0; i < num_workers; i++) {
+        if (msg_id3[i] > 0) msgctl(msg_id3[i], IPC_RMID, NULL);
+    }
     if (sync_sem > 0) semctl(sync_sem, 0, IPC_RMID, 0);
 }
 
@@ -77,19 +86,64 @@ void sighand(int signo) {
 typedef struct message2 {
     long mtype; // Message type
     int pid;    // Process ID
+    int slot;   // Index of the process in SM1
 } Msg2;
 
+// Wall clock time in seconds
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
+// Send the output of a child to /dev/null (batch mode)
+static void quiet() {
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+}
 
-int main(){
+
+int main(int argc, char *argv[]){
+    // Locality model and seed of the reference strings, and the file to save them to
+    refgen_spec_t model;
+    refgen_parse(&model, "uniform");
+    int illegal_given = 0; // The model sets the probability of an illegal address
+    uint64_t seed = time(0);
+    char *trace_file = NULL;
+    // Batch mode, for benchmarks: the mmu runs without an xterm, the processes start at once and only
+    // the master prints, a summary of the run at the end
+    int batch = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:S:w:j:B")) != -1) {
+        if (opt == 'g' && refgen_parse(&model, optarg) == 0) {
+            illegal_given = (strchr(optarg, '@') != NULL);
+            continue;
+        }
+        if (opt == 'S') seed = strtoull(optarg, NULL, 10);
+        else if (opt == 'w') trace_file = optarg;
+        else if (opt == 'j') num_workers = atoi(optarg);
+        else if (opt == 'B') batch = 1;
+        else argc = 0; // Force the usage message
+    }
+
+    // Optional scheduling arguments, handed on to the scheduler
+    if (argc - optind > 3 || argc == 0 || num_workers < 1 || num_workers > MAX_MMU_WORKERS) {
+        printf("Usage: %s [-g <Locality Model>] [-S <Seed>] [-w <Trace File>] [-j <MMU Threads>] [-B] [fifo|rr|mlfq] [<Quantum>] [<No. of CPUs>]\n", argv[0]);
+        printf("Locality models: uniform, zipf[:s], phase[:pages[:refs]], seq[:pages], loop[:pages[:iterations]], or a mixture such as zipf*3+seq:8*1\n");
+        printf("Append @p to a model for a probability p of an illegal address (default 0.1 as in the assignment, 0 with -B)\n");
+        printf("-B: batch mode (see bench): no xterm, the processes start at once with their output discarded, and a summary line ends the run\n");
+        exit(1);
+    }
+    // Illegal addresses end a process, so benchmarks only get them when they ask
+    if (!illegal_given) model.illegal = batch ? 0.0 : REFGEN_PROB_ILLEGAL_ADDR;
 
     // Set up signal handlers for SIGINT and SIGQUIT
     signal(SIGINT, sighand);
     signal(SIGQUIT, sighand);
 
-    // Initialize random number generator with current time
-    srand(time(0));
-
     // Structure for semaphore 'wait' operation
     struct sembuf pop;
     pop.sem_flg = 0;
@@ -120,6 +174,12 @@ int main(){
     sm2_id = shmget(key, (f + 1) * sizeof(int), IPC_CREAT | 0666);
     sm2 = (int *)shmat(sm2_id, NULL, 0);
 
+    // Create shared memory for the counters of the run, which every program finds through the key
+    key = ftok("mmu.c", 'C');
+    sm3_id = shmget(key, sizeof(ipcstat_t), IPC_CREAT | 0666);
+    sm3 = (ipcstat_t *)shmat(sm3_id, NULL, 0);
+    memset(sm3, 0, sizeof(ipcstat_t));
+
     // Create a semaphore for synchronization between master and scheduler
     //Scheduler notifies master when all the processes are terminated
     key = ftok("mmu.c", 'S'); // Generate a key for the semaphore
@@ -134,9 +194,13 @@ int main(){
     key = ftok("master.c", '2');
     msg_id2 = msgget(key, IPC_CREAT | 0666);
 
-    // Create Message Queue 3 for communication between mmu and process
+    // Create Message Queue 3 for communication between mmu and process.
+    // With several mmu threads every thread serves a shard of the processes on a queue of its own.
     key = ftok("master.c", '3');
-    msg_id3 = msgget(key, IPC_CREAT | 0666);
+    msg_id3[0] = msgget(key, IPC_CREAT | 0666);
+    for (int i = 1; i < num_workers; i++) {
+        msg_id3[i] = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+    }
 
 
     // Initialize total_page_faults and total_illegal_access to 0 for each process
@@ -170,17 +234,24 @@ int main(){
     sprintf(sm2_id_str, "%d", sm2_id);
 
     // Convert message queue IDs to strings
-    char msg_id1_str[15], msg_id2_str[15], msg_id3_str[15];
+    // (all the Message Queue 3 IDs go to the mmu, separated by commas)
+    char msg_id1_str[15], msg_id2_str[15], msg_id3_str[MAX_MMU_WORKERS * 15];
     sprintf(msg_id1_str, "%d", msg_id1);
     sprintf(msg_id2_str, "%d", msg_id2);
-    sprintf(msg_id3_str, "%d", msg_id3);
+    char *id_end = msg_id3_str;
+    for (int i = 0; i < num_workers; i++) {
+        id_end += sprintf(id_end, "%s%d", i ? "," : "", msg_id3[i]);
+    }
 
 
     // Create the scheduler process
     sched_pid = fork(); // Fork a child process
     if (sched_pid == 0) { // If this is the child process
+        if (batch) quiet();
         // Execute the 'sched' program with necessary arguments
-        execl("./sched", "./sched", msg_id1_str, msg_id2_str, k_str, NULL);
+        char *sched_argv[8] = {"./sched", msg_id1_str, msg_id2_str, k_str};
+        for (int i = optind; i < argc; i++) sched_argv[4 + i - optind] = argv[i];
+        execv("./sched", sched_argv);
         // If execl fails, print an error message and exit
         printf("Error in running 'sched' process...\n");
         exit(1);
@@ -189,6 +260,13 @@ int main(){
     // Create the memory management unit (mmu) process
     mmu_pid = fork(); // Fork another child process
     if (mmu_pid == 0) { // If this is the child process
+        if (batch) {
+            // No terminal: run the mmu directly, telling it not to wait for input when it is interrupted
+            quiet();
+            execl("./mmu", "./mmu", "-b", msg_id2_str, msg_id3_str, sm1_id_str, sm2_id_str, NULL);
+            printf("Error in running 'mmu' process...\n");
+            exit(1);
+        }
         // Execute the 'mmu' program in a new xterm window with necessary arguments
         execlp("xterm", "xterm", "-T", "Memory Management Unit", "-e", "./mmu", msg_id2_str, msg_id3_str, sm1_id_str, sm2_id_str, NULL);
         // If execlp fails, print an error message and exit
@@ -198,53 +276,68 @@ int main(){
 
     // Receive a message from Message Queue 2 (from mmu) to get mmu_pid
     Msg2 msg2;
-    msgrcv(msg_id2, (void *)&msg2, sizeof(Msg2), 100, 0);
+    msgrcv(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 100, 0);
     pid_mmu = msg2.pid; // Assign the received PID from the message to pid_mmu
 
-    // Array to store reference pages for each process
-    int ref_pages[MAX_PROCESSES][MAX_VIRTUAL_ADDR_SPACE * 11];
+    // Array to store reference pages for each process (on the heap, as k can be large)
+    int64_t (*ref_pages)[MAX_VIRTUAL_ADDR_SPACE * 11] = malloc(k * sizeof(*ref_pages));
+    int *ref_str_num_pages = malloc(k * sizeof(int));
 
     // Array to store reference strings for each process
-    char reference_str[MAX_PROCESSES][MAX_VIRTUAL_ADDR_SPACE * 110];
+    char (*reference_str)[MAX_VIRTUAL_ADDR_SPACE * 110] = malloc(k * sizeof(*reference_str));
 
     // Initialize reference_str to all zeros
-    memset(reference_str, 0, sizeof(reference_str));
+    memset(reference_str, 0, k * sizeof(*reference_str));
 
     // Loop through each process
     for (int i = 0; i < k; i++) {
         // Generate random number of pages between 1 to m for each process
-        sm1[i].mi = (rand() % m) + 1;
+        sm1[i].mi = (refgen_rand64(&seed) % m) + 1;
+
+        ref_str_num_pages[i] = 2 * sm1[i].mi + (refgen_rand64(&seed) % (8 * sm1[i].mi + 1));
 
-        int ref_str_num_pages = 2 * sm1[i].mi + (rand() % (8 * sm1[i].mi + 1));
+        // Generate reference string for each process with the locality model (illegal addresses included)
+        refgen_fill(&model, ref_pages[i], ref_str_num_pages[i], sm1[i].mi, m, &seed);
 
-        // Generate reference string for each process
-        for (int j = 0; j < ref_str_num_pages; j++) {
-            if ((float)rand() / RAND_MAX < PROB_ILLEGAL_ADDR && m > sm1[i].mi) {
-                ref_pages[i][j] = sm1[i].mi + (rand() % (m - sm1[i].mi)); // Generate illegal address with probability
-            } else {
-                ref_pages[i][j] = rand() % sm1[i].mi; // Generate random page within process's address space
-            }  
+        char *end = reference_str[i];
+        for (int j = 0; j < ref_str_num_pages[i]; j++) {
+            end += sprintf(end, "%d.", (int)ref_pages[i][j]); // Append each page number to the reference string
         }
+    }
 
-        char temp_buff[15];
-        for (int j = 0; j < ref_str_num_pages; j++) {
-            memset(temp_buff, 0, sizeof(temp_buff));
-            sprintf(temp_buff, "%d.", ref_pages[i][j]);
-            strcat(reference_str[i], temp_buff); // Concatenate each page number to the reference string
+    // Save the reference strings in the trace format read by the simulator (sweep -t)
+    if (trace_file != NULL) {
+        FILE *fp = fopen(trace_file, "w");
+        if (fp == NULL) {
+            perror("Error creating trace file");
+        } else {
+            fprintf(fp, "%d %d\n", k, m);
+            for (int i = 0; i < k; i++) {
+                fprintf(fp, "%d %d %s\n", sm1[i].mi, ref_str_num_pages[i], reference_str[i]);
+            }
+            fclose(fp);
         }
     }
 
     // Create processes
+    double start = now_s();
     for (int i = 0; i < k; i++) {
-        usleep(250000); // Sleep to stagger process creation
+        if (!batch) usleep(250000); // Sleep to stagger process creation
 
         // Fork a child process
         int pid = fork();
         if (pid == 0) { // If this is the child process
+            if (batch) quiet();
             sm1[i].pid = getpid(); // Set the PID for the process
 
+            // Pass the slot of the process in SM1, so that the mmu does not have to search for its pid,
+            // and the Message Queue 3 of the mmu thread serving the slot
+            char slot_str[15], queue_str[15];
+            sprintf(slot_str, "%d", i);
+            sprintf(queue_str, "%d", msg_id3[i % num_workers]);
+
             // Execute the 'process' program with necessary arguments
-            execl("./process", "./process", reference_str[i], msg_id1_str, msg_id3_str, NULL);
+            execl("./process", "./process", reference_str[i], msg_id1_str, queue_str, slot_str, msg_id2_str, NULL);
             
             // If execl fails, print an error message and exit
             printf("Error in running 'process', quitting this child process...\n");
@@ -253,22 +346,49 @@ int main(){
     }
 
 
+    free(ref_pages);
+    free(ref_str_num_pages);
+    free(reference_str);
+
     // Wait till scheduler notifies that all the processes have terminated
     P(sync_sem);
+    double elapsed = now_s() - start;
 
     // Print a message indicating that the master received notification from scheduler
     printf("Master received notification from scheduler as all the processes are completed.\n");
 
+    if (batch) {
+        // Stop the scheduler and the mmu, and wait for every child: the processes add their counts as they exit,
+        // and the mmu must be done with result.log before another run starts
+        if (sched_pid > 0) kill(sched_pid, SIGINT);
+        if (pid_mmu > 0) kill(pid_mmu, SIGINT);
+        sched_pid = pid_mmu = -1;
+        while (wait(NULL) > 0);
+
+        long faults = 0, illegal = 0;
+        for (int i = 0; i < k; i++) {
+            faults += sm1[i].total_page_faults;
+            illegal += sm1[i].total_illegal_access;
+        }
+        printf("Run: elapsed %.6f references %ld page_faults %ld no_victim %ld illegal_access %ld sched_calls %ld mmu_calls %ld process_calls %ld\n",
+               elapsed, (long)sm3->references, faults, (long)sm3->no_victim, illegal,
+               (long)sm3->calls[IPCSTAT_SCHED], (long)sm3->calls[IPCSTAT_MMU], (long)sm3->calls[IPCSTAT_PROCESS]);
+    }
+
     // Clean up resources
     if (sched_pid > 0) kill(sched_pid, SIGINT); // Terminate scheduler process
     if (pid_mmu > 0) kill(pid_mmu, SIGINT); // Terminate memory management unit process
     if (sm1 != NULL) shmdt(sm1); // Detach shared memory segment for page tables
     if (sm2 != NULL) shmdt(sm2); // Detach shared memory segment for free frames list
+    if (sm3 != NULL) shmdt(sm3); // Detach shared memory segment for the counters of the run
     if (sm1_id > 0) shmctl(sm1_id, IPC_RMID, NULL); // Remove shared memory segment for page tables
     if (sm2_id > 0) shmctl(sm2_id, IPC_RMID, NULL); // Remove shared memory segment for free frames list
+    if (sm3_id > 0) shmctl(sm3_id, IPC_RMID, NULL); // Remove shared memory segment for the counters of the run
     if (msg_id1 > 0) msgctl(msg_id1, IPC_RMID, NULL); // Remove message queue 1
     if (msg_id2 > 0) msgctl(msg_id2, IPC_RMID, NULL); // Remove message queue 2
-    if (msg_id3 > 0) msgctl(msg_id3, IPC_RMID, NULL); // Remove message queue 3
+    for (int i = 0; i < num_workers; i++) {
+        if (msg_id3[i] > 0) msgctl(msg_id3[i], IPC_RMID, NULL); // Remove message queue 3 of each mmu thread
+    }
     if (sync_sem > 0) semctl(sync_sem, 0, IPC_RMID, 0); // Remove synchronization semaphore
 
     // Exit the program
@@ -13,14 +13,22 @@
 #include <time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <evlog.h>
+#include <ipcstat.h>
 
 // Define P() and V() macros for semaphore operations
 #define P(s) semop(s, &pop, 1) //for semaphore 'wait' operation
 #define V(s) semop(s, &vop, 1) //for semaphore 'signal' operation
 
-// Define constants for maximum virtual address space and maximum processes
+// Define constant for maximum virtual address space
 #define MAX_VIRTUAL_ADDR_SPACE 25
-#define MAX_PROCESSES 100
+
+// Maximum number of worker threads, and the free frames a worker keeps for itself
+#define MAX_WORKERS 64
+#define FRAME_CACHE 32
+#define FRAME_BATCH 8
 
 // Structure for process memory information
 typedef struct SM1 {
@@ -41,24 +49,57 @@ typedef struct SM1 {
 typedef struct message2 {
     long mtype; // Message type
     int pid;    // Process id
+    int slot;   // Index of the process in SM1
 } Msg2;
 
 // Structure for message type 3
 typedef struct message3 {
     long mtype;     // Message type
     int pid;        // Process id
+    int slot;       // Index of the process in SM1
     int page_frame; // Page frame
 } Msg3;
 
+// A worker thread serving the processes of one shard (slots with slot % num_workers == id) on its own queue
+typedef struct {
+    int id;                     // Shard number, also the worker's ring in the event log
+    int msg_id3;                // Request queue of the shard
+    pthread_t thread;
+    pthread_mutex_t lock;       // Guards the frame cache (only contended when another worker steals)
+    int cache[FRAME_CACHE];     // Free frames taken from SM2 by this worker
+    int ncached;
+    long calls;                 // IPC calls, references and unserved faults not yet added to the run's counters
+    long refs;
+    long no_victim;
+} worker_t;
+
 // Global variables
-int total_num_processes = 0;
+_Atomic int total_num_processes = 0;
 SM1 *sm1 = NULL;
 int *sm2 = NULL;
-int fd = -1;
+int num_slots = 0;
+int msg_id2 = -1;
+evlog_t elog; // Binary log of every reference, rendered to result.txt on exit
+_Atomic int timestamp = 0; // Global ordering of the references over all the workers
+worker_t workers[MAX_WORKERS];
+int num_workers = 1;
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER; // Guards SM2, the global pool of free frames
+ipcstat_t *counters = NULL; // Counters of the run (Shared Memory 3), NULL if the master keeps none
+int batch = 0; // Run by a benchmark: exit on SIGINT without waiting for input
+volatile sig_atomic_t stop = 0; // Set by SIGINT: the main thread stops the workers and exits
+int exit_status = 0; // Set by a worker that gave up before it raised SIGINT
 
-// Signal handler function
+// Signal handler function: the workers may be in the middle of a reference, so the main thread shuts down
 void sig_handler(int signo) {
-    char buff[1001];
+    stop = 1;
+}
+
+// Stop the workers, then report and render the event log, which no worker can touch any more
+void shutdown_mmu(void) {
+    // A worker can only be cancelled while it waits for a message
+    for (int i = 0; i < num_workers; i++) pthread_cancel(workers[i].thread);
+    for (int i = 0; i < num_workers; i++) pthread_join(workers[i].thread, NULL);
+
     printf("*********************************************\n");
     // Print process information
     if (sm1 != NULL) {
@@ -68,171 +109,188 @@ void sig_handler(int signo) {
             printf("\t-Total no. of invalid page references: %d\n", sm1[i].total_illegal_access);
         }
     }
-    // Write process information to file descriptor if open
-    if (fd != -1) {
-        sprintf(buff, "*********************************************\n");
-        write(fd, buff, strlen(buff));
-        for (int i = 0; i < total_num_processes; i++) {
-            sprintf(buff, "=> Process no. %d (pid: %d):-\n", i + 1, sm1[i].pid);
-            write(fd, buff, strlen(buff));
-            sprintf(buff, "\t-Total no. of page faults: %d\n", sm1[i].total_page_faults);
-            write(fd, buff, strlen(buff));
-            sprintf(buff, "\t-Total no. of invalid page references: %d\n", sm1[i].total_illegal_access);
-            write(fd, buff, strlen(buff));
+    // Flush the event log and render it as text
+    evlog_close(&elog);
+    FILE *in = fopen("result.log", "rb");
+    FILE *out = fopen("result.txt", "w");
+    if (in != NULL && out != NULL) evlog_render(in, out, 0);
+    if (in != NULL) fclose(in);
+    if (out != NULL) fclose(out);
+    if (!batch) {
+        char c;
+        scanf("%c", &c); // Wait for input before exiting
+    }
+    exit(exit_status); // Exit the program
+}
+
+// Take a free frame out of SM2, the lowest numbered one (-1 if none). The caller holds pool_lock.
+static int pool_take(void) {
+    for (int frame = 0; sm2[frame] != -1; frame++) {
+        if (sm2[frame] == 1) {
+            sm2[frame] = 0;
+            return frame;
         }
     }
-    char c;
-    scanf("%c", &c); // Wait for input before exiting
-    exit(0); // Exit the program
+    return -1;
 }
 
+// Find a free frame for a worker, -1 if there is none anywhere.
+// A single worker takes frames straight from SM2, as the mmu always did. With several, each worker refills
+// a cache of its own from SM2 a batch at a time, and only when SM2 is empty looks into the others' caches.
+static int frame_alloc(worker_t *w) {
+    int frame = -1;
+    if (num_workers == 1) {
+        pthread_mutex_lock(&pool_lock);
+        frame = pool_take();
+        pthread_mutex_unlock(&pool_lock);
+        return frame;
+    }
 
-int main(int argc, char *argv[]){
-    // Check if the correct number of command-line arguments are provided
-    if (argc != 5){
-        printf("Provide these four arguments in order: <Message Queue 2 ID> <Message Queue 3 ID> <Shared Memory 1 ID> <Shared Memory 2 ID>\n");
-        exit(1);  // Exit program if arguments are not provided correctly
+    pthread_mutex_lock(&w->lock);
+    if (w->ncached == 0) {
+        pthread_mutex_lock(&pool_lock);
+        while (w->ncached < FRAME_BATCH && (frame = pool_take()) != -1) {
+            w->cache[w->ncached++] = frame;
+        }
+        pthread_mutex_unlock(&pool_lock);
     }
+    frame = (w->ncached > 0) ? w->cache[--w->ncached] : -1;
+    pthread_mutex_unlock(&w->lock);
 
-    // Structure for semaphore 'wait' operation
-    struct sembuf pop;
-    pop.sem_flg = 0;
-    pop.sem_num = 0;
-    pop.sem_op = -1;
-    // Structure for semaphore 'signal' operation
-    struct sembuf vop;
-    vop.sem_flg = 0;
-    vop.sem_num = 0;
-    vop.sem_op = 1;
+    for (int i = 1; frame == -1 && i < num_workers; i++) {
+        worker_t *other = &workers[(w->id + i) % num_workers];
+        pthread_mutex_lock(&other->lock);
+        if (other->ncached > 0) frame = other->cache[--other->ncached];
+        pthread_mutex_unlock(&other->lock);
+    }
+    return frame;
+}
 
-    // Set up signal handler for SIGINT
-    signal(SIGINT, sig_handler);
+// Give a frame back: to the worker's cache, or to SM2 with half the cache when the cache is full
+static void frame_free(worker_t *w, int frame) {
+    if (num_workers == 1) {
+        pthread_mutex_lock(&pool_lock);
+        sm2[frame] = 1;
+        pthread_mutex_unlock(&pool_lock);
+        return;
+    }
 
-    // Open file descriptor for writing results
-    fd = open("result.txt", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-    char buff[1001];
+    pthread_mutex_lock(&w->lock);
+    if (w->ncached == FRAME_CACHE) {
+        pthread_mutex_lock(&pool_lock);
+        while (w->ncached > FRAME_CACHE / 2) sm2[w->cache[--w->ncached]] = 1;
+        pthread_mutex_unlock(&pool_lock);
+    }
+    w->cache[w->ncached++] = frame;
+    pthread_mutex_unlock(&w->lock);
+}
 
-    // Convert command-line arguments to integers
-    int msg_id2 = atoi(argv[1]); // Message Queue 2 ID
-    int msg_id3 = atoi(argv[2]); // Message Queue 3 ID
-    int shm_id1 = atoi(argv[3]); // Shared Memory 1 ID
-    int shm_id2 = atoi(argv[4]); // Shared Memory 2 ID
+// Free the frames of a terminated process and tell the scheduler (through message queue 2)
+static void terminate(worker_t *w, int process_idx, int pid) {
+    for (int i = 0; i < sm1[process_idx].mi; i++) {
+        if (sm1[process_idx].pagetable[i][0] != -1) {
+            frame_free(w, sm1[process_idx].pagetable[i][0]);
+            sm1[process_idx].pagetable[i][0] = -1;
+            sm1[process_idx].pagetable[i][1] = 0;
+            sm1[process_idx].pagetable[i][2] = INT_MAX;
+        }
+    }
+    // Increment total number of processes
+    total_num_processes++;
+    // Add the worker's counts to the run's before the scheduler hears of the termination (this msgsnd included),
+    // so that they are complete when the last process is reported
+    w->calls++;
+    if (counters != NULL) {
+        atomic_fetch_add(&counters->calls[IPCSTAT_MMU], w->calls);
+        atomic_fetch_add(&counters->references, w->refs);
+        atomic_fetch_add(&counters->no_victim, w->no_victim);
+    }
+    w->calls = w->refs = w->no_victim = 0;
+    Msg2 msg2;
+    msg2.mtype = 2;
+    msg2.pid = pid;
+    msg2.slot = process_idx;
+    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
+}
 
-    // Attach shared memory segments
-    sm1 = (SM1 *)shmat(shm_id1, NULL, 0);
-    sm2 = (int *)shmat(shm_id2, NULL, 0);
+// Worker thread: serve the references of the processes of one shard
+void *worker_main(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    int msg_id3 = w->msg_id3;
 
     // Initialize message structures
     Msg2 msg2;
     Msg3 msg3;
 
-    // Set message type and process id for message 2
-    msg2.mtype = 100;
-    msg2.pid = getpid();
-    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2), 0);
-
-
-    int timestamp = 0;
+    // Cancellation only while waiting for a message, so that a reference is never left half served
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
     while (1) {
         // Wait for message from process
-        msgrcv(msg_id3, (void *)&msg3, sizeof(Msg3), 1, 0);
-        timestamp++; // Increment timestamp
+        w->calls++;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        int received = msgrcv(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), 1, 0);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (received < 0) continue;
+        int now = ++timestamp; // Increment timestamp
 
-        // Find process index corresponding to the received process ID
-        int process_idx = 0;
-        while (sm1[process_idx].pid != msg3.pid && process_idx < MAX_PROCESSES) {
-            process_idx++;
-        }
-        // Check if process ID is not found in SM1
-        if (process_idx == MAX_PROCESSES) {
+        // The message carries the process's slot in SM1, the pid is only used to validate it
+        int process_idx = msg3.slot;
+        if (process_idx < 0 || process_idx >= num_slots || process_idx % num_workers != w->id || sm1[process_idx].pid != msg3.pid) {
             printf("=> MMU received a process pid which it could not find in SM1.\n");
-            sprintf(buff, "=> MMU received a process pid which it could not find in SM1.\n");
-            write(fd, buff, strlen(buff));
-            exit(1); // Exit the program
+            // Let the main thread stop the other workers before the log is closed
+            exit_status = 1;
+            kill(getpid(), SIGINT);
+            return NULL;
         }
 
-        // Print global ordering information
-        printf("Global ordering - (Timestamp %d, Process %d, Page %d)\n", timestamp, process_idx + 1, msg3.page_frame);
-        sprintf(buff, "Global ordering - (Timestamp %d, Process %d, Page %d)\n", timestamp, process_idx + 1, msg3.page_frame);
-        write(fd, buff, strlen(buff));
-
         int page = msg3.page_frame;
+        if (page != -9) w->refs++;
         if (page == -9) {
             // Handle process termination
-            for (int i = 0; i < sm1[process_idx].mi; i++) {
-                if (sm1[process_idx].pagetable[i][0] != -1) {
-                    sm2[sm1[process_idx].pagetable[i][0]] = 1;
-                    sm1[process_idx].pagetable[i][0] = -1;
-                    sm1[process_idx].pagetable[i][1] = 0;
-                    sm1[process_idx].pagetable[i][2] = INT_MAX;
-                }
-            }
-            // Increment total number of processes
-            total_num_processes++;
-            // Send termination message to message queue 2 (to scheduler)
-            msg2.mtype = 2;
-            msg2.pid = msg3.pid;
-            msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2), 0);
+            evlog_put(&elog, w->id, now, process_idx, msg3.pid, page, -1, EVLOG_EXIT);
+            terminate(w, process_idx, msg3.pid);
         } else if (page >= sm1[process_idx].mi) {
             // Handle illegal page reference
             sm1[process_idx].total_illegal_access++;
-            printf("Invalid Page Reference - (Process %d, Page %d)\n", process_idx + 1, page);
-            sprintf(buff, "Invalid Page Reference - (Process %d, Page %d)\n", process_idx + 1, page);
-            write(fd, buff, strlen(buff));
-            // Increment total number of processes
-            total_num_processes++;
+            evlog_put(&elog, w->id, now, process_idx, msg3.pid, page, -1, EVLOG_INVALID);
             // Send invalid page reference message to process
             msg3.mtype = msg3.pid;
             msg3.page_frame = -2;
-            msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3), 0);
+            w->calls++;
+            msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), 0);
             // Free frames and send termination message to message queue 2 (to scheduler)
-            for (int i = 0; i < sm1[process_idx].mi; i++) {
-                if (sm1[process_idx].pagetable[i][0] != -1) {
-                    sm2[sm1[process_idx].pagetable[i][0]] = 1;
-                    sm1[process_idx].pagetable[i][0] = -1;
-                    sm1[process_idx].pagetable[i][1] = 0;
-                    sm1[process_idx].pagetable[i][2] = INT_MAX;
-                }
-            }
-            msg2.mtype = 2;
-            msg2.pid = msg3.pid;
-            msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2), 0);
+            terminate(w, process_idx, msg3.pid);
         } else if (sm1[process_idx].pagetable[page][0] != -1 && sm1[process_idx].pagetable[page][1] == 1) {
             // Handle page hit
-            sm1[process_idx].pagetable[page][2] = timestamp;
+            sm1[process_idx].pagetable[page][2] = now;
+            evlog_put(&elog, w->id, now, process_idx, msg3.pid, page, sm1[process_idx].pagetable[page][0], EVLOG_HIT);
             // Send message with page frame to process (through message queue 3)
             msg3.mtype = msg3.pid;
             msg3.page_frame = sm1[process_idx].pagetable[page][0];
-            msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3), 0);
+            w->calls++;
+            msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), 0);
         } else {
             // Handle page fault
             sm1[process_idx].total_page_faults++;
             // Send message indicating page fault to process (through message queue 3)
             msg3.mtype = msg3.pid;
             msg3.page_frame = -1;
-            msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3), 0);
-            // Print page fault sequence
-            printf("Page fault sequence - (Process %d, Page %d)\n", process_idx + 1, page);
-            sprintf(buff, "Page fault sequence - (Process %d, Page %d)\n", process_idx + 1, page);
-            write(fd, buff, strlen(buff));
+            w->calls++;
+            msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), 0);
             // Find a free frame for page allocation
-            int frame = 0;
-            while (sm2[frame] != -1) {
-                if (sm2[frame] == 1) {
-                    sm2[frame] = 0;
-                    break;
-                }
-                frame++;
-            }
+            int frame = frame_alloc(w);
             // Allocate page to the frame if free frame found
-            if (sm2[frame] != -1) {
+            if (frame != -1) {
                 sm1[process_idx].pagetable[page][0] = frame;
                 sm1[process_idx].pagetable[page][1] = 1;
-                sm1[process_idx].pagetable[page][2] = timestamp;
+                sm1[process_idx].pagetable[page][2] = now;
+                evlog_put(&elog, w->id, now, process_idx, msg3.pid, page, frame, EVLOG_FAULT);
                 // Send message to scheduler indicating page fault handled for the process and to enqueue it to the ready queue
                 msg2.mtype = 1;
                 msg2.pid = msg3.pid;
-                msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2), 0);
+                msg2.slot = process_idx;
+                w->calls++;
+                msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
             } else {
                 // Perform LRU replacement if no free frame is available
                 int min_time = INT_MAX;
@@ -249,28 +307,115 @@ int main(int argc, char *argv[]){
                 if (idx != -1) {
                     sm1[process_idx].pagetable[page][0] = req_page;
                     sm1[process_idx].pagetable[page][1] = 1;
-                    sm1[process_idx].pagetable[page][2] = timestamp;
+                    sm1[process_idx].pagetable[page][2] = now;
                     sm1[process_idx].pagetable[idx][0] = -1;
                     sm1[process_idx].pagetable[idx][1] = 0;
                     sm1[process_idx].pagetable[idx][2] = INT_MAX;
+                    evlog_put(&elog, w->id, now, process_idx, msg3.pid, page, req_page, EVLOG_FAULT);
                     // Send the message to scheduler indicating page fault handled and to enqueue the process to the ready queue
                     msg2.mtype = 1;
                     msg2.pid = msg3.pid;
-                    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2), 0);
+                    msg2.slot = process_idx;
+                    w->calls++;
+                    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
                 } else {
                     // If no available page for replacement
                     //Send the message to scheduler to enqueue the process to ready queue to try handling the page fault later
                     msg2.mtype = 1;
                     msg2.pid = msg3.pid;
-                    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2), 0);
-                    printf("No page available for LRU replacement - (Process %d, Page %d)\n", process_idx + 1, page);
-                    // sprintf(buff, "No page available for LRU replacement - (Process %d, Page %d)\n", process_idx + 1, page);
-                    // write(fd, buff, strlen(buff));
+                    msg2.slot = process_idx;
+                    w->calls++;
+                    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
+                    w->no_victim++;
+                    evlog_put(&elog, w->id, now, process_idx, msg3.pid, page, -1, EVLOG_NO_VICTIM);
                 }
             }
         }
     }
+    return NULL;
+}
+
+
+int main(int argc, char *argv[]){
+    // Batch mode, when started by a benchmark rather than in a terminal
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        batch = 1;
+        argv++;
+        argc--;
+    }
+    // Check if the correct number of command-line arguments are provided
+    if (argc != 5){
+        printf("Provide these four arguments in order: [-b] <Message Queue 2 ID> <Message Queue 3 ID>[,<Message Queue 3 ID>...] <Shared Memory 1 ID> <Shared Memory 2 ID>\n");
+        printf("With several queue 3 IDs, one worker thread serves each queue; -b exits on interrupt without waiting for input\n");
+        exit(1);  // Exit program if arguments are not provided correctly
+    }
+
+    // Convert command-line arguments to integers
+    msg_id2 = atoi(argv[1]); // Message Queue 2 ID
+    int shm_id1 = atoi(argv[3]); // Shared Memory 1 ID
+    int shm_id2 = atoi(argv[4]); // Shared Memory 2 ID
+
+    // Counters of the run, if the master keeps them
+    int stat_id = shmget(ftok("mmu.c", 'C'), sizeof(ipcstat_t), 0666);
+    if (stat_id >= 0) {
+        counters = (ipcstat_t *)shmat(stat_id, NULL, 0);
+        if (counters == (void *)-1) counters = NULL;
+    }
+
+    // One worker per Message Queue 3 ID
+    num_workers = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(argv[2], ",", &save); tok != NULL && num_workers < MAX_WORKERS; tok = strtok_r(NULL, ",", &save)) {
+        workers[num_workers].id = num_workers;
+        workers[num_workers].msg_id3 = atoi(tok);
+        pthread_mutex_init(&workers[num_workers].lock, NULL);
+        num_workers++;
+    }
+    if (num_workers == 0) {
+        printf("No Message Queue 3 ID given\n");
+        exit(1);
+    }
+
+    // Start the event log; a writer thread drains it to result.log so references never wait on I/O
+    if (evlog_open(&elog, "result.log", num_workers) < 0) {
+        perror("result.log");
+        exit(1);
+    }
+
+    // Attach shared memory segments
+    sm1 = (SM1 *)shmat(shm_id1, NULL, 0);
+    sm2 = (int *)shmat(shm_id2, NULL, 0);
+
+    // Number of process slots in SM1, from the size of the segment
+    struct shmid_ds shm_info;
+    shmctl(shm_id1, IPC_STAT, &shm_info);
+    num_slots = shm_info.shm_segsz / sizeof(SM1);
+
+    // The workers never take SIGINT, so that the handler runs on this thread while they are at work
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    for (int i = 0; i < num_workers; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    // Set up signal handler for SIGINT
+    signal(SIGINT, sig_handler);
+
+    // Set message type and process id for message 2
+    Msg2 msg2;
+    msg2.mtype = 100;
+    msg2.pid = getpid();
+    msg2.slot = -1;
+    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
 
+    // The workers run until the master interrupts the mmu (or a worker does); SIGINT stays blocked but while
+    // this thread waits, so that it cannot slip in between the test and the wait
+    sigset_t wait_set;
+    pthread_sigmask(SIG_BLOCK, NULL, &wait_set);
+    sigdelset(&wait_set, SIGINT);
+    while (!stop) sigsuspend(&wait_set);
+    shutdown_mmu();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sim.h>
+
+// Stack distances of a reference stream (Mattson et al.): the distance of a reference is the number of
+// distinct pages referenced since the previous reference to the same page, itself included. LRU with f frames
+// hits exactly the references at distance <= f, so one pass gives the faults of every frame count.
+//
+// The distinct pages between two references are counted with a Fenwick tree over the reference times,
+// holding a 1 at the time of the latest reference to each page: O(log n) per reference.
+
+// Last reference time of each page, open addressing on the page key
+typedef struct {
+    uint64_t *keys;  // Page keys plus one (0 marks an empty slot)
+    int *times;      // Time of the last reference, 1-based
+    size_t cap;      // Slots, a power of two
+    size_t used;     // Keys held
+} last_map_t;
+
+// Distance histogram and totals of one stream
+typedef struct {
+    long long *hist;     // hist[d]: references at stack distance d (d >= 1)
+    int maxd;            // Largest distance seen
+    long long cold;      // First references to a page: a fault for every frame count
+    long long refs;      // References analysed
+    long long illegal;   // Illegal references (they end the process, as in mmu.c)
+} mrc_t;
+
+static size_t hash_key(uint64_t key, size_t cap) {
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(key ^ (key >> 29)) & (cap - 1);
+}
+
+static void map_init(last_map_t *map) {
+    map->cap = 1024;
+    map->used = 0;
+    map->keys = (uint64_t *)calloc(map->cap, sizeof(uint64_t));
+    map->times = (int *)malloc(map->cap * sizeof(int));
+}
+
+static void map_free(last_map_t *map) {
+    free(map->keys);
+    free(map->times);
+}
+
+// Slot of a key, inserted with time 0 if absent
+static size_t map_slot(last_map_t *map, uint64_t key) {
+    if (2 * (map->used + 1) > map->cap) {
+        // Grow to keep the table at most half full
+        last_map_t big = {(uint64_t *)calloc(2 * map->cap, sizeof(uint64_t)), (int *)malloc(2 * map->cap * sizeof(int)), 2 * map->cap, map->used};
+        for (size_t i = 0; i < map->cap; i++) {
+            if (map->keys[i] == 0) continue;
+            size_t j = hash_key(map->keys[i], big.cap);
+            while (big.keys[j] != 0) j = (j + 1) & (big.cap - 1);
+            big.keys[j] = map->keys[i];
+            big.times[j] = map->times[i];
+        }
+        map_free(map);
+        *map = big;
+    }
+    size_t i = hash_key(key + 1, map->cap);
+    while (map->keys[i] != 0 && map->keys[i] != key + 1) i = (i + 1) & (map->cap - 1);
+    if (map->keys[i] == 0) {
+        map->keys[i] = key + 1;
+        map->times[i] = 0;
+        map->used++;
+    }
+    return i;
+}
+
+// Fenwick tree over the reference times 1..n
+static void bit_add(int *bit, int n, int i, int v) {
+    for (; i <= n; i += i & -i) bit[i] += v;
+}
+
+static int bit_sum(const int *bit, int i) {
+    int s = 0;
+    for (; i > 0; i -= i & -i) s += bit[i];
+    return s;
+}
+
+static void mrc_count(mrc_t *mrc, int d) {
+    if (d > mrc->maxd) {
+        mrc->hist = (long long *)realloc(mrc->hist, (d + 1) * sizeof(long long));
+        memset(mrc->hist + mrc->maxd + 1, 0, (d - mrc->maxd) * sizeof(long long));
+        mrc->maxd = d;
+    }
+    mrc->hist[d]++;
+}
+
+// Stack distances of a stream of n page keys
+static void analyse(mrc_t *mrc, const uint64_t *keys, int n) {
+    int *bit = (int *)calloc(n + 1, sizeof(int));
+    last_map_t last;
+    map_init(&last);
+    for (int t = 1; t <= n; t++) {
+        size_t slot = map_slot(&last, keys[t - 1]);
+        int prev = last.times[slot];
+        if (prev == 0) {
+            mrc->cold++;
+        } else {
+            // Pages whose latest reference falls between the two references to this one, plus the page itself
+            mrc_count(mrc, bit_sum(bit, t - 1) - bit_sum(bit, prev) + 1);
+            bit_add(bit, n, prev, -1);
+        }
+        bit_add(bit, n, t, 1);
+        last.times[slot] = t;
+    }
+    mrc->refs += n;
+    map_free(&last);
+    free(bit);
+}
+
+// Faults of LRU with f frames: cold misses and references further down the stack than f
+static long long mrc_faults(const mrc_t *mrc, int f) {
+    long long faults = mrc->cold;
+    for (int d = f + 1; d <= mrc->maxd; d++) faults += mrc->hist[d];
+    return faults;
+}
+
+static void print_curve(const mrc_t *mrc, const char *proc, int lo, int hi, int step) {
+    // Beyond the largest distance every frame count gives the cold misses only
+    if (hi <= 0) hi = mrc->maxd > 0 ? mrc->maxd : 1;
+    long long faults = mrc_faults(mrc, lo);
+    for (int f = lo, d = lo; f <= hi; f += step) {
+        for (; d < f && d < mrc->maxd; d++) faults -= mrc->hist[d + 1];
+        printf("%s,%d,%lld,%lld,%lld,%.6f\n", proc, f, mrc->refs, mrc->illegal, faults, mrc->refs ? (double)faults / mrc->refs : 0.0);
+    }
+}
+
+void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-f lo:hi[:step]] [-q refs] <Trace File>\n", prog);
+    fprintf(stderr, "\tframes: frame counts to report (default 1 up to the largest stack distance of each curve)\n");
+    fprintf(stderr, "\trefs: the overall curve interleaves the processes this many references at a time (default 1)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int lo = 1, hi = 0, step = 1, quantum = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:q:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (sscanf(optarg, "%d:%d:%d", &lo, &hi, &step) < 1) usage(argv[0]);
+                break;
+            case 'q': quantum = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || lo < 1 || step < 1 || quantum < 1 || (hi != 0 && hi < lo)) usage(argv[0]);
+
+    sim_trace_t trace;
+    if (sim_trace_load(&trace, argv[optind]) != 0) exit(1);
+
+    // Every process runs until its first illegal reference, like under the mmu
+    int *len = (int *)malloc(trace.k * sizeof(int));
+    int maxn = 0, total = 0;
+    for (int i = 0; i < trace.k; i++) {
+        const sim_proc_trace_t *p = &trace.procs[i];
+        for (len[i] = 0; len[i] < p->n && REFGEN_PAGE(p->refs[len[i]]) < p->mi; len[i]++);
+        if (len[i] > maxn) maxn = len[i];
+        total += len[i];
+    }
+
+    // One curve per process: each process replacing among its own frames, as mmu.c does
+    printf("proc,f,references,illegal_access,page_faults,miss_ratio\n");
+    uint64_t *keys = (uint64_t *)malloc((total > 0 ? total : 1) * sizeof(uint64_t));
+    mrc_t all;
+    memset(&all, 0, sizeof(mrc_t));
+    for (int i = 0; i < trace.k; i++) {
+        const sim_proc_trace_t *p = &trace.procs[i];
+        mrc_t mrc;
+        memset(&mrc, 0, sizeof(mrc_t));
+        for (int j = 0; j < len[i]; j++) keys[j] = REFGEN_PAGE(p->refs[j]);
+        analyse(&mrc, keys, len[i]);
+        mrc.illegal = (len[i] < p->n);
+        all.illegal += mrc.illegal;
+
+        char proc[16];
+        sprintf(proc, "%d", i + 1);
+        print_curve(&mrc, proc, lo, hi, step);
+        free(mrc.hist);
+    }
+
+    // Overall curve: one LRU stack over the pages of all the processes, the reference strings interleaved
+    // round robin, quantum references at a time
+    int n = 0;
+    for (int start = 0; start < maxn; start += quantum) {
+        for (int i = 0; i < trace.k; i++) {
+            for (int j = start; j < start + quantum && j < len[i]; j++) {
+                keys[n++] = (uint64_t)REFGEN_PAGE(trace.procs[i].refs[j]) * trace.k + i;
+            }
+        }
+    }
+    analyse(&all, keys, n);
+    print_curve(&all, "all", lo, hi, step);
+
+    free(all.hist);
+    free(keys);
+    free(len);
+    sim_trace_free(&trace);
+    return 0;
+}
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pagetable.h>
+
+// Allocations are aligned to this many bytes
+#define PT_ALIGN 16
+
+// Entry of a hashed table, followed by entry_size bytes of page table entry
+typedef struct {
+    int64_t page;  // Virtual page number
+    int asid;      // Process slot owning the page
+    int pad;
+    size_t next;   // Next entry of the bucket chain (0 ends the chain)
+} pt_hnode_t;
+
+// Offset of the first allocation: offset 0 is never handed out and serves as the null link
+static size_t arena_start() {
+    return (sizeof(pt_arena_hdr_t) + PT_ALIGN - 1) / PT_ALIGN * PT_ALIGN;
+}
+
+// Create a growable arena in malloc'd memory
+int pt_arena_create(pt_arena_t *arena, size_t size) {
+    if (size < 4096) size = 4096;
+    void *mem = malloc(size);
+    if (mem == NULL) return -1;
+    pt_arena_init(arena, mem, size);
+    arena->growable = 1;
+    return 0;
+}
+
+// Format a block of memory (e.g. a segment returned by shmat()) as an empty fixed-size arena
+int pt_arena_init(pt_arena_t *arena, void *mem, size_t size) {
+    if (size <= arena_start()) return -1;
+    arena->base = (char *)mem;
+    arena->growable = 0;
+    pt_arena_hdr_t *hdr = (pt_arena_hdr_t *)mem;
+    hdr->size = size;
+    hdr->used = arena_start();
+    return 0;
+}
+
+// Use an arena formatted by another process (the memory must be mapped already)
+void pt_arena_attach(pt_arena_t *arena, void *mem) {
+    arena->base = (char *)mem;
+    arena->growable = 0;
+}
+
+// Allocate zeroed bytes from the arena, returns the offset or 0 if the arena is full
+size_t pt_arena_alloc(pt_arena_t *arena, size_t bytes) {
+    pt_arena_hdr_t *hdr = (pt_arena_hdr_t *)arena->base;
+    bytes = (bytes + PT_ALIGN - 1) / PT_ALIGN * PT_ALIGN;
+
+    if (hdr->used + bytes > hdr->size) {
+        if (!arena->growable) return 0;
+        // Grow geometrically; links are offsets so moving the block is harmless
+        size_t size = hdr->size;
+        while (hdr->used + bytes > size) size *= 2;
+        char *base = (char *)realloc(arena->base, size);
+        if (base == NULL) return 0;
+        arena->base = base;
+        hdr = (pt_arena_hdr_t *)base;
+        hdr->size = size;
+    }
+
+    size_t off = hdr->used;
+    hdr->used += bytes;
+    memset(arena->base + off, 0, bytes);
+    return off;
+}
+
+// Bytes handed out by the arena
+size_t pt_arena_used(pt_arena_t *arena) {
+    return ((pt_arena_hdr_t *)arena->base)->used;
+}
+
+// Release a growable arena (arenas over external memory are left to their owner)
+void pt_arena_destroy(pt_arena_t *arena) {
+    if (arena->growable) free(arena->base);
+    arena->base = NULL;
+}
+
+// Parse "dense", "hashed[:buckets]", "radix[N]" or "radix:b1,b2,..." (or "radix:b1-b2-..." as printed by
+// pt_spec_name()) into a table shape
+int pt_spec_parse(pt_spec_t *spec, const char *str) {
+    memset(spec, 0, sizeof(pt_spec_t));
+
+    if (strcmp(str, "dense") == 0) {
+        spec->type = PT_DENSE;
+        return 0;
+    }
+    if (strncmp(str, "hashed", 6) == 0) {
+        spec->type = PT_HASHED;
+        if (str[6] == ':') spec->nbuckets = atoi(str + 7);
+        else if (str[6] != '\0') return -1;
+        return spec->nbuckets < 0 ? -1 : 0;
+    }
+    if (strncmp(str, "radix", 5) == 0) {
+        spec->type = PT_RADIX;
+        if (str[5] == '\0') {
+            spec->levels = PT_MAX_LEVELS;
+        } else if (str[5] == ':') {
+            // Explicit bits per level
+            const char *p = str + 6;
+            int total = 0;
+            while (*p != '\0') {
+                if (spec->levels == PT_MAX_LEVELS) return -1;
+                char *end;
+                long b = strtol(p, &end, 10);
+                if (end == p || b < 1 || b > 30) return -1;
+                total += (int)b;
+                if (total > PT_MAX_BITS) return -1;
+                spec->bits[spec->levels++] = (int)b;
+                p = (*end == ',' || *end == '-') ? end + 1 : end;
+                if (*end != ',' && *end != '-' && *end != '\0') return -1;
+            }
+        } else {
+            spec->levels = atoi(str + 5);
+        }
+        return (spec->levels >= 2 && spec->levels <= PT_MAX_LEVELS) ? 0 : -1;
+    }
+    return -1;
+}
+
+// Fill in unspecified bits of a radix table so it covers pages 0 to npages-1, -1 if it cannot or if its levels
+// take more than PT_MAX_BITS bits
+int pt_spec_fit(pt_spec_t *spec, int64_t npages) {
+    if (spec->type != PT_RADIX) return 0;
+
+    int need = 1;
+    while (need < PT_MAX_BITS && ((int64_t)1 << need) < npages) need++;
+
+    if (spec->bits[0] == 0) {
+        // Split the bits evenly, giving the remainder to the levels nearest the root
+        for (int i = 0; i < spec->levels; i++) {
+            spec->bits[i] = need / spec->levels + (i < need % spec->levels ? 1 : 0);
+            if (spec->bits[i] == 0) spec->bits[i] = 1;
+        }
+    }
+
+    int total = 0;
+    for (int i = 0; i < spec->levels; i++) total += spec->bits[i];
+    return (total >= need && total <= PT_MAX_BITS) ? 0 : -1;
+}
+
+// Printable form of a table shape, e.g. "radix:9-9-9-9" (no commas, so it fits in a CSV field)
+void pt_spec_name(const pt_spec_t *spec, char *buf, size_t len) {
+    if (spec->type == PT_DENSE) {
+        snprintf(buf, len, "dense");
+    } else if (spec->type == PT_HASHED) {
+        snprintf(buf, len, "hashed:%d", spec->nbuckets);
+    } else {
+        int n = snprintf(buf, len, "radix:");
+        for (int i = 0; i < spec->levels && n < (int)len; i++) {
+            n += snprintf(buf + n, len - n, i ? "-%d" : "%d", spec->bits[i]);
+        }
+    }
+}
+
+// Size of a radix node at the given level (leaves hold entries, the others hold offsets)
+static size_t radix_node_size(pagetable_t *pt, int level) {
+    size_t slot = (level == pt->spec.levels - 1) ? (size_t)pt->entry_size : sizeof(size_t);
+    return ((size_t)1 << pt->spec.bits[level]) * slot;
+}
+
+// Create an empty table; npages is the number of entries of a dense table
+int pt_init(pagetable_t *pt, pt_arena_t *arena, const pt_spec_t *spec, int entry_size, int64_t npages) {
+    memset(pt, 0, sizeof(pagetable_t));
+    pt->spec = *spec;
+    pt->entry_size = entry_size;
+    pt->npages = npages;
+
+    switch (spec->type) {
+        case PT_DENSE:
+            pt->root = pt_arena_alloc(arena, (size_t)npages * entry_size);
+            break;
+        case PT_RADIX:
+            if (spec->levels < 2 || spec->levels > PT_MAX_LEVELS) return -1;
+            pt->root = pt_arena_alloc(arena, radix_node_size(pt, 0));
+            pt->nodes = 1;
+            break;
+        case PT_HASHED:
+            if (pt->spec.nbuckets <= 0) pt->spec.nbuckets = 1024;
+            pt->root = pt_arena_alloc(arena, pt->spec.nbuckets * sizeof(size_t));
+            break;
+        default:
+            return -1;
+    }
+    return pt->root == 0 ? -1 : 0;
+}
+
+// Bucket of a (process, page) pair in a hashed table
+static size_t hash_bucket(pagetable_t *pt, int asid, int64_t page) {
+    uint64_t h = (uint64_t)page * 0x9E3779B97F4A7C15ULL ^ (uint64_t)asid * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    return (size_t)(h % (uint64_t)pt->spec.nbuckets);
+}
+
+// Find the entry of a page, creating it (zeroed) if create is set; NULL if absent or out of memory.
+// The returned pointer is only valid until the next lookup that creates an entry.
+// steps (if not NULL) receives the number of table memory references made.
+void *pt_lookup(pagetable_t *pt, pt_arena_t *arena, int asid, int64_t page, int create, int *steps) {
+    int n = 0;
+    void *entry = NULL;
+
+    pt->walks++;
+    switch (pt->spec.type) {
+        case PT_DENSE:
+            n = 1;
+            if (page >= 0 && page < pt->npages) {
+                entry = arena->base + pt->root + (size_t)page * pt->entry_size;
+            }
+            break;
+
+        case PT_RADIX: {
+            int shift = 0;
+            for (int i = 0; i < pt->spec.levels; i++) shift += pt->spec.bits[i];
+            if (page < 0 || (shift < 63 && page >= ((int64_t)1 << shift))) break;
+
+            size_t node = pt->root;
+            for (int level = 0; level < pt->spec.levels; level++) {
+                shift -= pt->spec.bits[level];
+                size_t idx = (size_t)(page >> shift) & (((size_t)1 << pt->spec.bits[level]) - 1);
+                n++;
+                if (level == pt->spec.levels - 1) {
+                    entry = arena->base + node + idx * pt->entry_size;
+                    break;
+                }
+                size_t next = ((size_t *)(arena->base + node))[idx];
+                if (next == 0) {
+                    if (!create) break;
+                    // Allocation may move a growable arena, so the slot is re-derived afterwards
+                    next = pt_arena_alloc(arena, radix_node_size(pt, level + 1));
+                    if (next == 0) break;
+                    ((size_t *)(arena->base + node))[idx] = next;
+                    pt->nodes++;
+                }
+                node = next;
+            }
+            break;
+        }
+
+        case PT_HASHED: {
+            size_t bucket = hash_bucket(pt, asid, page);
+            size_t cur = ((size_t *)(arena->base + pt->root))[bucket];
+            n = 1;
+            while (cur != 0) {
+                pt_hnode_t *hn = (pt_hnode_t *)(arena->base + cur);
+                n++;
+                if (hn->page == page && hn->asid == asid) {
+                    entry = (char *)hn + sizeof(pt_hnode_t);
+                    break;
+                }
+                cur = hn->next;
+            }
+            if (entry != NULL || !create) break;
+
+            // Take a node from the free list or the arena, and push it on the chain
+            if (pt->free_list != 0) {
+                cur = pt->free_list;
+                pt->free_list = ((pt_hnode_t *)(arena->base + cur))->next;
+                memset(arena->base + cur, 0, sizeof(pt_hnode_t) + pt->entry_size);
+            } else {
+                cur = pt_arena_alloc(arena, sizeof(pt_hnode_t) + pt->entry_size);
+                if (cur == 0) break;
+                pt->nodes++;
+            }
+            pt_hnode_t *hn = (pt_hnode_t *)(arena->base + cur);
+            hn->page = page;
+            hn->asid = asid;
+            hn->next = ((size_t *)(arena->base + pt->root))[bucket];
+            ((size_t *)(arena->base + pt->root))[bucket] = cur;
+            entry = (char *)hn + sizeof(pt_hnode_t);
+            break;
+        }
+    }
+
+    pt->walk_steps += n;
+    if (steps != NULL) *steps = n;
+    return entry;
+}
+
+// Drop the entry of a page: hashed entries go back to the free list, other tables just clear it
+void pt_remove(pagetable_t *pt, pt_arena_t *arena, int asid, int64_t page) {
+    if (pt->spec.type != PT_HASHED) {
+        void *entry = pt_lookup(pt, arena, asid, page, 0, NULL);
+        if (entry != NULL) memset(entry, 0, pt->entry_size);
+        return;
+    }
+
+    size_t *link = &((size_t *)(arena->base + pt->root))[hash_bucket(pt, asid, page)];
+    while (*link != 0) {
+        pt_hnode_t *hn = (pt_hnode_t *)(arena->base + *link);
+        if (hn->page == page && hn->asid == asid) {
+            size_t cur = *link;
+            *link = hn->next;
+            hn->next = pt->free_list;
+            pt->free_list = cur;
+            return;
+        }
+        link = &hn->next;
+    }
+}
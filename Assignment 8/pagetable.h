@@ -0,0 +1,62 @@
+#ifndef __PAGETABLE_H
+#define __PAGETABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Page table organisations
+#define PT_DENSE 0   // One flat array of entries per process (the SM1 layout)
+#define PT_RADIX 1   // Hierarchical table with 2 to 4 levels, nodes created on first use
+#define PT_HASHED 2  // One hashed table for all processes, keyed by (process, page)
+
+#define PT_MAX_LEVELS 4
+#define PT_MAX_BITS 62  // Index bits of all the levels of a radix table, so page numbers are never shifted by 64
+
+// Shape of a page table
+typedef struct {
+    int type;                 // One of PT_*
+    int levels;               // Number of levels of a radix table
+    int bits[PT_MAX_LEVELS];  // Index bits per level, root first (0 means chosen by pt_spec_fit())
+    int nbuckets;             // Buckets of a hashed table (0 means chosen by the user of the table)
+} pt_spec_t;
+
+// Header kept at the start of the arena memory, so processes sharing the memory share the allocations
+typedef struct {
+    size_t size;  // Bytes in the arena
+    size_t used;  // Bytes handed out so far
+} pt_arena_hdr_t;
+
+// Bump allocator over a block of memory; all links inside the arena are offsets, never pointers
+typedef struct {
+    char *base;     // Start of the memory (shared memory segment or malloc'd block)
+    int growable;   // 1 if base is malloc'd and may be reallocated when full
+} pt_arena_t;
+
+// A page table; it holds only offsets into its arena, so it can itself be placed in shared memory
+typedef struct {
+    pt_spec_t spec;        // Shape of the table
+    int entry_size;        // Bytes per entry (entries start zeroed, which means not mapped)
+    int64_t npages;        // Entries of a dense table
+    size_t root;           // Dense array, radix root node or hash bucket array
+    size_t free_list;      // Removed entries of a hashed table, for reuse
+    long long walks;       // Lookups performed
+    long long walk_steps;  // Table memory references made by the lookups
+    long long nodes;       // Radix nodes or hash entries allocated
+} pagetable_t;
+
+int pt_arena_create ( pt_arena_t * , size_t ) ;
+int pt_arena_init ( pt_arena_t * , void * , size_t ) ;
+void pt_arena_attach ( pt_arena_t * , void * ) ;
+size_t pt_arena_alloc ( pt_arena_t * , size_t ) ;
+size_t pt_arena_used ( pt_arena_t * ) ;
+void pt_arena_destroy ( pt_arena_t * ) ;
+
+int pt_spec_parse ( pt_spec_t * , const char * ) ;
+int pt_spec_fit ( pt_spec_t * , int64_t ) ;
+void pt_spec_name ( const pt_spec_t * , char * , size_t ) ;
+
+int pt_init ( pagetable_t * , pt_arena_t * , const pt_spec_t * , int , int64_t ) ;
+void *pt_lookup ( pagetable_t * , pt_arena_t * , int , int64_t , int , int * ) ;
+void pt_remove ( pagetable_t * , pt_arena_t * , int , int64_t ) ;
+
+#endif
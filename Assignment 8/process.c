@@ -13,16 +13,29 @@
 #include <time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <ipcstat.h>
 
 /* 
    Struct definition for message type 1. 
    Represents a message containing a message type and a process ID.
 */
 typedef struct message1
+{
+    long mtype;  // Type of the message
+    int pid;     // Process ID
+    int quantum; // References allowed before yielding the CPU (0: no limit)
+} Msg1;
+
+/* 
+   Struct definition for message type 2. 
+   Sent to the scheduler when the process arrives and when its quantum expires.
+*/
+typedef struct message2
 {
     long mtype; // Type of the message
     int pid;    // Process ID
-} Msg1;
+    int slot;   // Index of the process in SM1
+} Msg2;
 
 /* 
    Struct definition for message type 3. 
@@ -32,20 +45,34 @@ typedef struct message3
 {
     long mtype;       // Type of the message
     int pid;          // Process ID
+    int slot;         // Index of the process in SM1
     int page_frame;   // Page frame
 } Msg3;
 
 // Initialize an array to store the reference string.
 char refstr[10010];
 
+// IPC system calls made by this process
+long ipc_calls = 0;
+
+// Add this process's IPC calls to the counters of the run, if the master keeps them
+void publish_calls() {
+    int id = shmget(ftok("mmu.c", 'C'), sizeof(ipcstat_t), 0666);
+    if (id < 0) return;
+    ipcstat_t *counters = (ipcstat_t *)shmat(id, NULL, 0);
+    if (counters == (void *)-1) return;
+    atomic_fetch_add(&counters->calls[IPCSTAT_PROCESS], ipc_calls);
+    shmdt(counters);
+}
+
 int main(int argc, char *argv[]){
     /*
        Check if the correct number of command-line arguments are provided.
        If not, print an error message and exit the program.
     */
-    if (argc != 4)
+    if (argc != 6)
     {
-        printf("Provide these three arguments in order: <Reference String> <Message Queue 1 ID> <Message Queue 3 ID>\n");
+        printf("Provide these five arguments in order: <Reference String> <Message Queue 1 ID> <Message Queue 3 ID> <Process Slot> <Message Queue 2 ID>\n");
         exit(1);
     }
 
@@ -57,6 +84,10 @@ int main(int argc, char *argv[]){
     int msg_id1 = atoi(argv[2]);
     // Convert the provided Message Queue 3 ID argument to an integer.
     int msg_id3 = atoi(argv[3]);
+    // Convert the provided slot of this process in SM1 to an integer.
+    int slot = atoi(argv[4]);
+    // Convert the provided Message Queue 2 ID argument to an integer.
+    int msg_id2 = atoi(argv[5]);
 
     // Get the process ID of the current process.
     int pid = getpid();
@@ -64,17 +95,19 @@ int main(int argc, char *argv[]){
     // Print a message indicating that the process has started, along with its process ID.
     printf("Process (pid: %d) has started\n", pid);
 
+    // Tell the scheduler (through Message Queue 2) that this process is ready.
+    Msg2 msg2;
+    msg2.mtype = 4;
+    msg2.pid = pid;
+    msg2.slot = slot;
+    msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
+
     // Initialize a message of type Msg1.
     Msg1 msg1;
-    // Set the message type to 1.
-    msg1.mtype = 1;
-    // Set the process ID in the message to the current process ID.
-    msg1.pid = pid;
-    // Send the process ID to Message Queue 1 (ready queue).
-    msgsnd(msg_id1, (void *)&msg1, sizeof(Msg1), 0);
 
     // Receive a message from Message Queue 1 targeted specifically to this process ID.
-    msgrcv(msg_id1, (void *)&msg1, sizeof(Msg1), pid, 0);
+    msgrcv(msg_id1, (void *)&msg1, sizeof(Msg1) - sizeof(long), pid, 0);
+    ipc_calls += 2;
 
 
     /*
@@ -84,6 +117,8 @@ int main(int argc, char *argv[]){
     Msg3 msg3;
     int i = 0;
     int prev_i = -1;
+    // References made since the last dispatch.
+    int used = 0;
 
     // Iterate through the reference string until the end.
     while (refstr[i] != '\0')
@@ -106,17 +141,20 @@ int main(int argc, char *argv[]){
         // Set the message type, process ID, and page frame in Msg3.
         msg3.mtype = 1;
         msg3.pid = pid;
+        msg3.slot = slot;
         msg3.page_frame = page;
         
         // Send the message containing page information to Message Queue 3 (mmu).
-        msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3), 0);
+        msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), 0);
 
         // Receive a response from Message Queue 3 regarding the page frame allocation.
-        msgrcv(msg_id3, (void *)&msg3, sizeof(Msg3), pid, 0);
+        msgrcv(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), pid, 0);
+        ipc_calls += 2;
 
         if (msg3.page_frame == -2)
         {// If the sent page is invalid
             printf("Process with pid %d -> Illegal Page Number - Terminating\n", pid);
+            publish_calls();
             exit(1);
         }
         else if (msg3.page_frame == -1)
@@ -124,7 +162,9 @@ int main(int argc, char *argv[]){
             printf("Process with pid %d -> Page Fault - Waiting for page to be loaded\n", pid);
 
             // Wait for a message indicating that the page has been loaded.
-            msgrcv(msg_id1, (void *)&msg1, sizeof(Msg1), pid, 0);
+            msgrcv(msg_id1, (void *)&msg1, sizeof(Msg1) - sizeof(long), pid, 0);
+            ipc_calls++;
+            used = 0;
             // Reset the index to the position before encountering the page fault.
             i = prev_i;
         }
@@ -132,6 +172,18 @@ int main(int argc, char *argv[]){
         {
             // Print a message indicating successful page frame allocation.
             printf("Process with pid %d -> Frame %d allocated for page %d\n", pid, msg3.page_frame, page);
+
+            // Give the CPU back when the quantum is used up and references remain.
+            used++;
+            if (msg1.quantum > 0 && used >= msg1.quantum && refstr[i] != '\0')
+            {
+                printf("Process with pid %d -> Quantum expired - Yielding\n", pid);
+                msg2.mtype = 3;
+                msgsnd(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), 0);
+                msgrcv(msg_id1, (void *)&msg1, sizeof(Msg1) - sizeof(long), pid, 0);
+                ipc_calls += 2;
+                used = 0;
+            }
         }
     }
 
@@ -140,8 +192,11 @@ int main(int argc, char *argv[]){
     // Send a termination message to Message Queue 3 (mmu)
     msg3.mtype = 1;
     msg3.pid = pid;
+    msg3.slot = slot;
     msg3.page_frame = -9;
-    msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3), 0);
+    msgsnd(msg_id3, (void *)&msg3, sizeof(Msg3) - sizeof(long), 0);
+    ipc_calls++;
+    publish_calls();
     // Print a message indicating process termination.
     printf("Process with pid %d -> Terminating\n", (int)pid);
 
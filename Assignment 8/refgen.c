@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <refgen.h>
+
+// Names of the models, indexed by REFGEN_*
+static const char *model_names[REFGEN_NUM_MODELS] = {"uniform", "zipf", "phase", "seq", "loop"};
+
+// xorshift64* generator, so that runs are reproducible from a seed on any platform
+uint32_t refgen_rand(uint64_t *state) {
+    uint64_t x = *state;
+    if (x == 0) x = 0x9E3779B97F4A7C15ULL; // The generator must never hold 0
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// 64 random bits
+uint64_t refgen_rand64(uint64_t *state) {
+    uint64_t hi = refgen_rand(state);
+    return (hi << 32) | refgen_rand(state);
+}
+
+// Uniform random number in [0, 1)
+double refgen_randf(uint64_t *state) {
+    return refgen_rand(state) / 4294967296.0;
+}
+
+// Parse a model spec such as "zipf:0.8", "phase:20:500", "seq:32*1+zipf*3" or "uniform@0.1"
+int refgen_parse(refgen_spec_t *spec, const char *str) {
+    memset(spec, 0, sizeof(refgen_spec_t));
+    spec->burst = 16;
+
+    char *copy = strdup(str);
+    char *save = NULL;
+    int status = 0;
+    // Optional probability of an illegal address after '@'
+    char *at = strchr(copy, '@');
+    if (at != NULL) {
+        *at = '\0';
+        char *end;
+        spec->illegal = strtod(at + 1, &end);
+        if (end == at + 1 || *end != '\0' || spec->illegal < 0 || spec->illegal >= 1) status = -1;
+    }
+    for (char *tok = strtok_r(copy, "+", &save); status == 0 && tok != NULL; tok = strtok_r(NULL, "+", &save)) {
+        if (spec->nparts == REFGEN_MAX_PARTS) {
+            status = -1;
+            break;
+        }
+        refgen_part_t *part = &spec->part[spec->nparts];
+        part->weight = 1.0;
+
+        // Optional weight after '*'
+        char *star = strchr(tok, '*');
+        if (star != NULL) {
+            *star = '\0';
+            part->weight = atof(star + 1);
+        }
+        // Model name, then up to two parameters separated by ':'
+        char *colon = strchr(tok, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            if (sscanf(colon + 1, "%lf:%lf", &part->param[0], &part->param[1]) < 1) status = -1;
+        }
+        part->model = -1;
+        for (int i = 0; i < REFGEN_NUM_MODELS; i++) {
+            if (strcmp(tok, model_names[i]) == 0) part->model = i;
+        }
+        if (part->model == -1 || part->weight <= 0 || part->param[0] < 0 || part->param[1] < 0) status = -1;
+        if (status != 0) break;
+        spec->nparts++;
+    }
+    free(copy);
+    return (status == 0 && spec->nparts > 0) ? 0 : -1;
+}
+
+// Printable form of a model spec
+void refgen_name(const refgen_spec_t *spec, char *buf, int len) {
+    int n = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < spec->nparts && n < len; i++) {
+        const refgen_part_t *part = &spec->part[i];
+        n += snprintf(buf + n, len - n, "%s%s", i ? "+" : "", model_names[part->model]);
+        for (int j = 0; j < 2 && part->param[j] > 0 && n < len; j++) {
+            n += snprintf(buf + n, len - n, ":%g", part->param[j]);
+        }
+        if (spec->nparts > 1 && n < len) n += snprintf(buf + n, len - n, "*%g", part->weight);
+    }
+    if (spec->illegal > 0 && n < len) snprintf(buf + n, len - n, "@%g", spec->illegal);
+}
+
+// State of one part while a reference string is generated
+typedef struct {
+    const refgen_part_t *part;
+    int64_t mi;          // Pages of the process
+    // Zipf: rejection-inversion sampling (Hormann and Derflinger), O(1) memory for any number of pages
+    double s, h_x1, h_n, s_cut;
+    uint64_t mul, add;   // Affine permutation scattering the ranks over the pages
+    // Phase, seq, loop
+    int64_t base;        // First page of the working set, scan or loop body
+    int64_t size;        // Pages of the working set, scan or loop body
+    int64_t pos;         // Position in the scan or loop body
+    int64_t left;        // References left in the phase, or iterations left of the loop
+    int64_t length;      // References per phase, or iterations per loop
+} part_state_t;
+
+// (exp(x) - 1) / x, accurate near 0
+static double expm1_x(double x) {
+    return fabs(x) > 1e-8 ? expm1(x) / x : 1.0 + x / 2.0;
+}
+
+// log(1 + x) / x, accurate near 0
+static double log1p_x(double x) {
+    return fabs(x) > 1e-8 ? log1p(x) / x : 1.0 - x / 2.0;
+}
+
+// Integral of the Zipf density x^-s, and its inverse
+static double zipf_h_integral(double s, double x) {
+    double lx = log(x);
+    return expm1_x((1.0 - s) * lx) * lx;
+}
+
+static double zipf_h_inverse(double s, double x) {
+    double t = x * (1.0 - s);
+    if (t < -1.0) t = -1.0; // Rounding at the edge of the domain
+    return exp(log1p_x(t) * x);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b != 0) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Default parameters, scaled to the address space of the process
+static void part_init(part_state_t *st, const refgen_part_t *part, int64_t mi, uint64_t *rng) {
+    memset(st, 0, sizeof(part_state_t));
+    st->part = part;
+    st->mi = mi;
+
+    switch (part->model) {
+        case REFGEN_ZIPF:
+            st->s = part->param[0] > 0 ? part->param[0] : 1.0;
+            st->h_x1 = zipf_h_integral(st->s, 1.5) - 1.0;
+            st->h_n = zipf_h_integral(st->s, mi + 0.5);
+            st->s_cut = 2.0 - zipf_h_inverse(st->s, zipf_h_integral(st->s, 2.5) - pow(2.0, -st->s));
+            // The popular pages are spread over the address space instead of being the first ones
+            st->mul = (refgen_rand64(rng) % (uint64_t)mi) | 1;
+            while (gcd(st->mul, (uint64_t)mi) != 1) st->mul++;
+            st->add = refgen_rand64(rng) % (uint64_t)mi;
+            break;
+        case REFGEN_PHASE:
+            st->size = part->param[0] > 0 ? (int64_t)part->param[0] : (mi >= 10 ? mi / 10 : 1);
+            st->length = part->param[1] > 0 ? (int64_t)part->param[1] : 10 * st->size;
+            break;
+        case REFGEN_SEQ:
+            st->size = part->param[0] > 0 ? (int64_t)part->param[0] : mi;
+            break;
+        case REFGEN_LOOP:
+            st->size = part->param[0] > 0 ? (int64_t)part->param[0] : (mi >= 20 ? mi / 10 : 2);
+            st->length = part->param[1] > 0 ? (int64_t)part->param[1] : 10;
+            st->base = refgen_rand64(rng) % mi;
+            st->left = st->length;
+            break;
+    }
+    if (st->size > mi) st->size = mi;
+}
+
+// Next page of a part
+static int64_t part_next(part_state_t *st, uint64_t *rng) {
+    int64_t mi = st->mi;
+
+    switch (st->part->model) {
+        case REFGEN_ZIPF: {
+            int64_t rank;
+            while (1) {
+                double u = st->h_n + refgen_randf(rng) * (st->h_x1 - st->h_n);
+                double x = zipf_h_inverse(st->s, u);
+                rank = (int64_t)(x + 0.5);
+                if (rank < 1) rank = 1;
+                else if (rank > mi) rank = mi;
+                if (rank - x <= st->s_cut || u >= zipf_h_integral(st->s, rank + 0.5) - pow((double)rank, -st->s)) break;
+            }
+            return (int64_t)(((unsigned __int128)(rank - 1) * st->mul + st->add) % (uint64_t)mi);
+        }
+        case REFGEN_PHASE:
+            // A new working set at the start of every phase
+            if (st->left == 0) {
+                st->base = refgen_rand64(rng) % mi;
+                st->left = st->length;
+            }
+            st->left--;
+            return (st->base + refgen_rand64(rng) % st->size) % mi;
+        case REFGEN_SEQ: {
+            // A new scan when the previous one is over
+            if (st->pos == 0) st->base = refgen_rand64(rng) % mi;
+            int64_t page = (st->base + st->pos) % mi;
+            st->pos = (st->pos + 1) % st->size;
+            return page;
+        }
+        case REFGEN_LOOP: {
+            // The inner loop walks the body; the outer loop moves to the next body after its iterations
+            int64_t page = (st->base + st->pos) % mi;
+            if (++st->pos == st->size) {
+                st->pos = 0;
+                if (--st->left == 0) {
+                    st->base = (st->base + st->size) % mi;
+                    st->left = st->length;
+                }
+            }
+            return page;
+        }
+        default:
+            return refgen_rand64(rng) % mi;
+    }
+}
+
+// Fill refs with n references of a process of mi pages in an address space of m pages.
+// The uniform model alone with illegal at REFGEN_PROB_ILLEGAL_ADDR draws from the same distribution as master.c's
+// original rand() generator, though not the same sequence, as it runs on the seeded xorshift64*.
+void refgen_fill(const refgen_spec_t *spec, int64_t *refs, int n, int64_t mi, int64_t m, uint64_t *rng) {
+    part_state_t st[REFGEN_MAX_PARTS];
+    double total = 0.0;
+    for (int i = 0; i < spec->nparts; i++) {
+        part_init(&st[i], &spec->part[i], mi, rng);
+        total += spec->part[i].weight;
+    }
+
+    int cur = 0, left = 0;
+    for (int j = 0; j < n; j++) {
+        if (refgen_randf(rng) < spec->illegal && m > mi) {
+            refs[j] = mi + (refgen_rand64(rng) % (m - mi)); // Illegal address
+            continue;
+        }
+        // Mixtures switch part every burst references, in proportion to the weights
+        if (spec->nparts > 1 && left-- == 0) {
+            double r = refgen_randf(rng) * total;
+            for (cur = 0; cur < spec->nparts - 1 && r >= spec->part[cur].weight; cur++) {
+                r -= spec->part[cur].weight;
+            }
+            left = spec->burst - 1;
+        }
+        refs[j] = part_next(&st[cur], rng);
+        if (spec->writes > 0 && refgen_randf(rng) < spec->writes) refs[j] |= REFGEN_WRITE;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef __REFGEN_H
+#define __REFGEN_H
+
+#include <stdint.h>
+
+// Locality models of a reference string
+#define REFGEN_UNIFORM 0 // Every page equally likely (master.c's original generator)
+#define REFGEN_ZIPF 1    // Page popularity follows a Zipf law:            zipf[:exponent]
+#define REFGEN_PHASE 2   // Uniform over a working set that moves:         phase[:pages[:refs per phase]]
+#define REFGEN_SEQ 3     // Sequential scans from random starting pages:   seq[:pages per scan]
+#define REFGEN_LOOP 4    // Nested loops: a body of pages repeated, then the next body: loop[:pages[:iterations]]
+#define REFGEN_NUM_MODELS 5
+
+#define REFGEN_MAX_PARTS 8
+
+// Probability of an illegal address of master.c; generated traces have none unless the spec asks for them
+#define REFGEN_PROB_ILLEGAL_ADDR 0.1
+
+// A reference that writes its page carries this bit on top of the page number
+#define REFGEN_WRITE ((int64_t)1 << 62)
+#define REFGEN_PAGE(ref) ((ref) & ~REFGEN_WRITE)
+
+// One model of a mixture; parameters left at 0 take defaults scaled to the address space
+typedef struct {
+    int model;        // One of REFGEN_*
+    double param[2];  // Model parameters, in the order of the spec
+    double weight;    // Share of the references drawn from this model
+} refgen_part_t;
+
+// A locality model, possibly a mixture: "model[:p1[:p2]][*weight]" joined by '+', then "@p" for a probability p of
+// an illegal address (default 0)
+typedef struct {
+    int nparts;
+    refgen_part_t part[REFGEN_MAX_PARTS];
+    int burst;        // References drawn from a part of a mixture before switching
+    double illegal;   // Probability of an illegal address
+    double writes;    // Probability that a legal reference is a write
+} refgen_spec_t;
+
+uint32_t refgen_rand ( uint64_t * ) ;
+uint64_t refgen_rand64 ( uint64_t * ) ;
+double refgen_randf ( uint64_t * ) ;
+
+int refgen_parse ( refgen_spec_t * , const char * ) ;
+void refgen_name ( const refgen_spec_t * , char * , int ) ;
+void refgen_fill ( const refgen_spec_t * , int64_t * , int , int64_t , int64_t , uint64_t * ) ;
+
+#endif
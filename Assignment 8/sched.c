@@ -13,28 +13,52 @@
 #include <time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <ipcstat.h>
 
 // Define P() and V() macros for semaphore operations
 #define P(s) semop(s, &pop, 1) //for semaphore 'wait' operation
 #define V(s) semop(s, &vop, 1) //for semaphore 'signal' operation
 
+// Scheduling policies
+#define SCHED_FIFO 0 // Run each process until it faults or terminates
+#define SCHED_RR 1   // As FIFO, but a process also yields after a quantum of references
+#define SCHED_MLFQ 2 // Round robin over feedback levels, the quantum doubling at each level
+
+#define MLFQ_LEVELS 3          // Number of feedback levels
+#define MLFQ_BOOST_PERIOD 200  // Dispatches between two boosts of every process to the top level
+
+// Messages on MQ2: 1 and 2 come from the mmu, 3 and 4 from the processes (100 is only used at start-up)
+#define EVENT_FAULT_DONE 1 // Page fault handled, the process is ready again
+#define EVENT_TERMINATED 2 // Process terminated
+#define EVENT_YIELD 3      // Process used up its quantum
+#define EVENT_ARRIVAL 4    // New process is ready
+
 // Structure for message type 1
 typedef struct message1 {
-    long mtype; // Message type
-    int pid;    // Process ID
+    long mtype;  // Message type
+    int pid;     // Process ID
+    int quantum; // References the process may make before it yields (0: no limit)
 } Msg1;
 
 // Structure for message type 2
 typedef struct message2 {
     long mtype; // Message type
     int pid;    // Process ID
+    int slot;   // Index of the process in SM1
 } Msg2;
 
+// Wall clock time in microseconds
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
 
 int main(int argc, char *argv[]){
     // Check if the correct number of command-line arguments are provided
-    if (argc != 4) {
-        printf("Provide these three arguments in order: <Message Queue 1 ID> <Message Queue 2 ID> <No. of Processes>\n");
+    if (argc < 4 || argc > 7) {
+        printf("Provide these arguments in order: <Message Queue 1 ID> <Message Queue 2 ID> <No. of Processes> [fifo|rr|mlfq] [<Quantum>] [<No. of CPUs>]\n");
         exit(1); // Exit program if arguments are not provided correctly
     }
 
@@ -63,44 +87,150 @@ int main(int argc, char *argv[]){
     int sync_sem = semget(key, 1, 0666);
 
 
+    // Scheduling policy (FIFO by default), quantum in references, and CPUs that may run processes at once
+    int policy = SCHED_FIFO;
+    if (argc > 4) {
+        if (strcmp(argv[4], "rr") == 0) policy = SCHED_RR;
+        else if (strcmp(argv[4], "mlfq") == 0) policy = SCHED_MLFQ;
+        else if (strcmp(argv[4], "fifo") != 0) {
+            printf("Unknown scheduling policy '%s' (use fifo, rr or mlfq)\n", argv[4]);
+            exit(1);
+        }
+    }
+    int quantum = (argc > 5) ? atoi(argv[5]) : 5;
+    int ncpus = (argc > 6) ? atoi(argv[6]) : 1;
+    if (quantum < 1 || ncpus < 1) {
+        printf("Quantum and number of CPUs must be positive\n");
+        exit(1);
+    }
+    int nlevels = (policy == SCHED_MLFQ) ? MLFQ_LEVELS : 1;
+
+    // Per-process state, indexed by slot in SM1
+    int *level = (int *)calloc(k, sizeof(int));            // Feedback level
+    double *arrival = (double *)calloc(k, sizeof(double)); // Time the process became ready first
+    double *started = (double *)calloc(k, sizeof(double)); // Time of the current dispatch
+    int *pids = (int *)calloc(k, sizeof(int));
+
+    // One circular ready queue per level; a process is in at most one queue at a time
+    int *ready[MLFQ_LEVELS];
+    int head[MLFQ_LEVELS] = {0}, len[MLFQ_LEVELS] = {0};
+    for (int l = 0; l < nlevels; l++) ready[l] = (int *)malloc(k * sizeof(int));
+
+    // Statistics
+    int running = 0, remaining = k;
+    long dispatches = 0, yields = 0, faults = 0;
+    long ipc_calls = 0;
+    double busy_us = 0, turnaround_us = 0, first_arrival = -1, last_exit = 0;
+
     // Declare message variables
     Msg1 msg1;
-    Msg2 msg2; 
+    Msg2 msg2;
 
     // Loop until all processes are scheduled
-    while (k > 0) {
-        // Wait for a message from process to schedule itself
-        msgrcv(msg_id1, (void *)&msg1, sizeof(Msg1), 1, 0);
-
-        // Print scheduling message
-        printf("\t***Scheduling Process with pid: %d\n", msg1.pid);
+    while (remaining > 0) {
+        // Dispatch ready processes, highest level first, while CPUs are free
+        while (running < ncpus) {
+            int l = 0;
+            while (l < nlevels && len[l] == 0) l++;
+            if (l == nlevels) break;
+            int slot = ready[l][head[l]];
+            head[l] = (head[l] + 1) % k;
+            len[l]--;
+
+            // Print scheduling message
+            printf("\t***Scheduling Process with pid: %d\n", pids[slot]);
+
+            // Signal the process to start itself, telling it how many references it may make
+            msg1.mtype = pids[slot];
+            msg1.pid = pids[slot];
+            msg1.quantum = (policy == SCHED_FIFO) ? 0 : quantum << level[slot];
+            msgsnd(msg_id1, (void *)&msg1, sizeof(Msg1) - sizeof(long), 0);
+            ipc_calls++;
+            started[slot] = now_us();
+            running++;
+            dispatches++;
+
+            // Periodically move every process back to the top level so none starves
+            if (policy == SCHED_MLFQ && dispatches % MLFQ_BOOST_PERIOD == 0) {
+                for (int i = 0; i < k; i++) level[i] = 0;
+                for (int l = 1; l < nlevels; l++) {
+                    while (len[l] > 0) {
+                        ready[0][(head[0] + len[0]) % k] = ready[l][head[l]];
+                        len[0]++;
+                        head[l] = (head[l] + 1) % k;
+                        len[l]--;
+                    }
+                }
+            }
+        }
 
-        // Signal the process to start itself
-        msg1.mtype = msg1.pid;
-        msgsnd(msg_id1, (void *)&msg1, sizeof(Msg1), 0);
+        // Wait for the next event from the mmu or a process
+        msgrcv(msg_id2, (void *)&msg2, sizeof(Msg2) - sizeof(long), -EVENT_ARRIVAL, 0);
+        ipc_calls++;
+        int slot = msg2.slot;
+        if (slot < 0 || slot >= k) continue;
+        double t = now_us();
+        if (msg2.mtype != EVENT_ARRIVAL) {
+            // The process left its CPU
+            busy_us += t - started[slot];
+            running--;
+        }
 
-        // Wait for message from mmu
-        msgrcv(msg_id2, (void *)&msg2, sizeof(Msg2), 0, 0);
+        // Check the type of the message
+        if (msg2.mtype == EVENT_ARRIVAL) {
+            pids[slot] = msg2.pid;
+            arrival[slot] = t;
+            if (first_arrival < 0) first_arrival = t;
+        } else if (msg2.mtype == EVENT_FAULT_DONE) {
+            faults++;
+        } else if (msg2.mtype == EVENT_YIELD) {
+            // The process used its whole quantum: it goes one level down
+            yields++;
+            if (level[slot] < nlevels - 1) level[slot]++;
+        } else if (msg2.mtype == EVENT_TERMINATED) {
+            printf("\t***Process with pid %d terminated.\n", msg2.pid);
+            turnaround_us += t - arrival[slot];
+            last_exit = t;
+            remaining--; // Decrement the number of processes
+            continue;
+        }
 
-        // Check the type of message from mmu
-        if (msg2.mtype == 1) {
+        // Add the process to the end of the ready queue of its level
+        if (msg2.mtype != EVENT_ARRIVAL) {
             printf("\t***Process with pid %d added to the end of the ready queue\n", msg2.pid);
-            // Send message to process to indicate it's added to the ready queue
-            msg1.mtype = 1;
-            msg1.pid = msg2.pid;
-            msgsnd(msg_id1, (void *)&msg1, sizeof(Msg1), 0);
-        } else if (msg2.mtype == 2) {
-            printf("\t***Process with pid %d terminated.\n", msg2.pid);
-            k--; // Decrement the number of processes
         }
+        int l = level[slot];
+        ready[l][(head[l] + len[l]) % k] = slot;
+        len[l]++;
     }
 
-    // Print exit message
+    // Print exit message and the scheduling statistics
     printf("\t***Scheduler exiting: all processes are completed.\n");
+    double elapsed = last_exit - first_arrival;
+    printf("\t***Policy %s, quantum %d, %d CPU(s): %ld dispatches, %ld page faults, %ld quantum expiries\n",
+           policy == SCHED_FIFO ? "fifo" : (policy == SCHED_RR ? "rr" : "mlfq"), quantum, ncpus, dispatches, faults, yields);
+    if (elapsed > 0) {
+        printf("\t***CPU utilization %.2f%%, throughput %.2f processes/s, mean turnaround %.3f ms\n",
+               100.0 * busy_us / (ncpus * elapsed), k / (elapsed / 1e6), turnaround_us / k / 1e3);
+    }
+
+    for (int l = 0; l < nlevels; l++) free(ready[l]);
+    free(level);
+    free(arrival);
+    free(started);
+    free(pids);
+
+    // Add the IPC calls to the counters of the run (the semop below included) before the master reads them
+    int stat_id = shmget(ftok("mmu.c", 'C'), sizeof(ipcstat_t), 0666);
+    ipcstat_t *counters = (stat_id >= 0) ? (ipcstat_t *)shmat(stat_id, NULL, 0) : NULL;
+    if (counters != NULL && counters != (void *)-1) {
+        atomic_fetch_add(&counters->calls[IPCSTAT_SCHED], ipc_calls + 1);
+        shmdt(counters);
+    }
 
     // Signal synchronization semaphore to indicate completion to master
     V(sync_sem);
 
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sim.h>
+
+// Names of the replacement policies, indexed by SIM_POLICY_*
+static const char *policy_names[SIM_NUM_POLICIES] = {"lru", "fifo", "clock", "random"};
+
+// Names of the scheduling policies, indexed by SIM_SCHED_*
+static const char *sched_names[SIM_NUM_SCHEDS] = {"fifo", "rr", "mlfq"};
+
+// Names of the prefetch strategies, indexed by SIM_PREFETCH_*
+static const char *prefetch_names[SIM_NUM_PREFETCH] = {"none", "readahead", "stride", "cluster"};
+
+// Names of the page sizes, indexed by SIM_PAGE_*
+static const char *page_size_names[SIM_NUM_PAGE_SIZES] = {"4k", "2m", "1g"};
+
+// Base pages in a page of the given order
+#define ORDER_PAGES(order) ((int64_t)1 << (SIM_HUGE_SHIFT * (order)))
+
+// Random numbers come from the trace generator's xorshift64*, so that parallel runs do not share the state of rand()
+uint32_t sim_rand(uint64_t *state) {
+    return refgen_rand(state);
+}
+
+// 64 random bits
+uint64_t sim_rand64(uint64_t *state) {
+    return refgen_rand64(state);
+}
+
+// Uniform random number in [0, 1)
+double sim_randf(uint64_t *state) {
+    return refgen_randf(state);
+}
+
+// Generate reference strings for k processes the same way master.c does, with the given locality
+// model (NULL for uniform references with the illegal addresses of master.c's original generator).
+// maxn (if > 0) caps the length of each reference string, for very large address spaces.
+void sim_trace_generate(sim_trace_t *trace, int k, int64_t m, int maxn, uint64_t seed, const refgen_spec_t *model) {
+    uint64_t rng = seed;
+    refgen_spec_t uniform;
+    if (model == NULL) {
+        refgen_parse(&uniform, "uniform");
+        uniform.illegal = REFGEN_PROB_ILLEGAL_ADDR;
+        model = &uniform;
+    }
+
+    trace->k = k;
+    trace->m = m;
+    trace->procs = (sim_proc_trace_t *)malloc(k * sizeof(sim_proc_trace_t));
+    trace->nmaps = 0;
+    trace->maps = NULL;
+
+    for (int i = 0; i < k; i++) {
+        sim_proc_trace_t *p = &trace->procs[i];
+
+        // Random number of pages between 1 to m, and between 2*mi and 10*mi references
+        p->mi = (sim_rand64(&rng) % m) + 1;
+        int64_t n = 2 * p->mi + (sim_rand64(&rng) % (8 * p->mi + 1));
+        p->n = (maxn > 0 && n > maxn) ? maxn : (int)n;
+        p->refs = (int64_t *)malloc(p->n * sizeof(int64_t));
+        refgen_fill(model, p->refs, p->n, p->mi, m, &rng);
+    }
+}
+
+// Read a trace file: "k m", optional "seg" lines declaring shared segments, then one "mi n p1.p2.p3." line per process
+int sim_trace_load(sim_trace_t *trace, const char *fname) {
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL) {
+        perror("Error opening trace file");
+        return -1;
+    }
+
+    memset(trace, 0, sizeof(sim_trace_t));
+    if (fscanf(fp, "%d %" SCNd64, &trace->k, &trace->m) != 2 || trace->k <= 0 || trace->m <= 0) {
+        fprintf(stderr, "Malformed trace header in %s\n", fname);
+        fclose(fp);
+        return -1;
+    }
+
+    // Shared segment mappings: "seg <process> <first page> <pages> <segment> s|c"
+    char word[4], mode;
+    while (fscanf(fp, " %3[a-z]", word) == 1) {
+        sim_map_t map;
+        if (strcmp(word, "seg") != 0 ||
+            fscanf(fp, "%d %" SCNd64 " %" SCNd64 " %d %c", &map.proc, &map.first, &map.pages, &map.seg, &mode) != 5 ||
+            map.proc < 1 || map.proc > trace->k || map.first < 0 || map.pages < 1 || map.seg < 0 || (mode != 's' && mode != 'c')) {
+            fprintf(stderr, "Malformed segment line in %s\n", fname);
+            free(trace->maps);
+            fclose(fp);
+            return -1;
+        }
+        map.proc--;
+        map.cow = (mode == 'c');
+        trace->maps = (sim_map_t *)realloc(trace->maps, (trace->nmaps + 1) * sizeof(sim_map_t));
+        trace->maps[trace->nmaps++] = map;
+    }
+
+    trace->procs = (sim_proc_trace_t *)calloc(trace->k, sizeof(sim_proc_trace_t));
+    for (int i = 0; i < trace->k; i++) {
+        sim_proc_trace_t *p = &trace->procs[i];
+        if (fscanf(fp, "%" SCNd64 " %d", &p->mi, &p->n) != 2 || p->mi <= 0 || p->n < 0) {
+            fprintf(stderr, "Malformed trace line for process %d in %s\n", i + 1, fname);
+            trace->k = i;
+            sim_trace_free(trace);
+            fclose(fp);
+            return -1;
+        }
+        p->refs = (int64_t *)malloc((p->n + 1) * sizeof(int64_t));
+        for (int j = 0; j < p->n; j++) {
+            // A 'w' after the page number marks a write
+            int c = EOF;
+            if (fscanf(fp, "%" SCNd64, &p->refs[j]) == 1 && p->refs[j] >= 0) {
+                c = fgetc(fp);
+                if (c == 'w') {
+                    p->refs[j] |= REFGEN_WRITE;
+                    c = fgetc(fp);
+                }
+            }
+            if (c != '.') {
+                fprintf(stderr, "Malformed reference string for process %d in %s\n", i + 1, fname);
+                trace->k = i + 1;
+                sim_trace_free(trace);
+                fclose(fp);
+                return -1;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    // Segments must lie within the pages of their process
+    for (int i = 0; i < trace->nmaps; i++) {
+        if (trace->maps[i].first + trace->maps[i].pages > trace->procs[trace->maps[i].proc].mi) {
+            fprintf(stderr, "Segment %d goes beyond the pages of process %d in %s\n", trace->maps[i].seg, trace->maps[i].proc + 1, fname);
+            sim_trace_free(trace);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Write a trace in the format read by sim_trace_load()
+int sim_trace_save(const sim_trace_t *trace, const char *fname) {
+    FILE *fp = fopen(fname, "w");
+    if (fp == NULL) {
+        perror("Error creating trace file");
+        return -1;
+    }
+
+    fprintf(fp, "%d %" PRId64 "\n", trace->k, trace->m);
+    for (int i = 0; i < trace->nmaps; i++) {
+        const sim_map_t *map = &trace->maps[i];
+        fprintf(fp, "seg %d %" PRId64 " %" PRId64 " %d %c\n", map->proc + 1, map->first, map->pages, map->seg, map->cow ? 'c' : 's');
+    }
+    for (int i = 0; i < trace->k; i++) {
+        const sim_proc_trace_t *p = &trace->procs[i];
+        fprintf(fp, "%" PRId64 " %d ", p->mi, p->n);
+        for (int j = 0; j < p->n; j++) {
+            fprintf(fp, "%" PRId64 "%s.", REFGEN_PAGE(p->refs[j]), (p->refs[j] & REFGEN_WRITE) ? "w" : "");
+        }
+        fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// Release the reference strings of a trace
+void sim_trace_free(sim_trace_t *trace) {
+    if (trace->procs != NULL) {
+        for (int i = 0; i < trace->k; i++) {
+            free(trace->procs[i].refs);
+        }
+        free(trace->procs);
+    }
+    free(trace->maps);
+    trace->procs = NULL;
+    trace->maps = NULL;
+    trace->nmaps = 0;
+}
+
+// Map one segment at the start of every process's address space, like a shared library
+// (or, with cow set, like the memory of processes forked from a common parent)
+void sim_trace_share(sim_trace_t *trace, int64_t pages, int cow) {
+    trace->maps = (sim_map_t *)realloc(trace->maps, (trace->nmaps + trace->k) * sizeof(sim_map_t));
+    for (int i = 0; i < trace->k; i++) {
+        sim_map_t *map = &trace->maps[trace->nmaps++];
+        map->proc = i;
+        map->first = 0;
+        map->pages = (pages < trace->procs[i].mi) ? pages : trace->procs[i].mi;
+        map->seg = 0;
+        map->cow = cow;
+    }
+}
+
+// Name of a replacement policy
+const char *sim_policy_name(int policy) {
+    if (policy < 0 || policy >= SIM_NUM_POLICIES) return "unknown";
+    return policy_names[policy];
+}
+
+// Replacement policy from its name, -1 if there is no such policy
+int sim_policy_parse(const char *name) {
+    for (int i = 0; i < SIM_NUM_POLICIES; i++) {
+        if (strcasecmp(name, policy_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Name of a scheduling policy
+const char *sim_sched_name(int sched) {
+    if (sched < 0 || sched >= SIM_NUM_SCHEDS) return "unknown";
+    return sched_names[sched];
+}
+
+// Scheduling policy from its name, -1 if there is no such policy
+int sim_sched_parse(const char *name) {
+    for (int i = 0; i < SIM_NUM_SCHEDS; i++) {
+        if (strcasecmp(name, sched_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Name of a page size
+const char *sim_page_size_name(int order) {
+    if (order < 0 || order >= SIM_NUM_PAGE_SIZES) return "?";
+    return page_size_names[order];
+}
+
+// Page size from its name, -1 if unknown
+int sim_page_size_parse(const char *name) {
+    for (int i = 0; i < SIM_NUM_PAGE_SIZES; i++) {
+        if (strcasecmp(name, page_size_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Name of a prefetch strategy
+const char *sim_prefetch_name(int prefetch) {
+    if (prefetch < 0 || prefetch >= SIM_NUM_PREFETCH) return "?";
+    return prefetch_names[prefetch];
+}
+
+// Prefetch strategy from its name, -1 if unknown
+int sim_prefetch_parse(const char *name) {
+    for (int i = 0; i < SIM_NUM_PREFETCH; i++) {
+        if (strcasecmp(name, prefetch_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Default parameters: LRU over 16 frames with dense page tables, no TLB, no log,
+// and the sched.c scheduler on one CPU with instantaneous page-ins
+void sim_config_default(sim_config_t *config) {
+    memset(config, 0, sizeof(sim_config_t));
+    config->policy = SIM_POLICY_LRU;
+    config->f = 16;
+    config->seed = 1;
+    config->log_fd = -1;
+    config->pt.type = PT_DENSE;
+    config->tlb.nlevels = 0;
+    config->tlb.tagged = 1;
+    config->mem_ns = 100.0;
+    config->sched = SIM_SCHED_FIFO;
+    config->ncpus = 1;
+    config->quantum_ns = 10000.0;
+    config->levels = 3;
+    config->boost_ns = 1000000.0;
+    config->pagein_ns = 0.0;
+    config->prefetch = SIM_PREFETCH_NONE;
+    config->prefetch_depth = 4;
+    config->transfer_ns = 0.0;
+    config->pageout_ns = 0.0;
+    config->writeback_ns = 0.0;
+    config->writeback_batch = 8;
+    config->copy_ns = 0.0;
+    config->huge_order = SIM_PAGE_4K;
+    config->huge_threshold = 0.5;
+    config->huge_demote = 1;
+}
+
+// Add the counters of src to dst
+void sim_stats_add(sim_stats_t *dst, const sim_stats_t *src) {
+    dst->references += src->references;
+    dst->hits += src->hits;
+    dst->page_faults += src->page_faults;
+    dst->illegal_access += src->illegal_access;
+    dst->replacements += src->replacements;
+    dst->no_victim += src->no_victim;
+    dst->walks += src->walks;
+    dst->walk_steps += src->walk_steps;
+    for (int i = 0; i < TLB_MAX_LEVELS; i++) {
+        dst->tlb_hits[i] += src->tlb_hits[i];
+    }
+    dst->tlb_misses += src->tlb_misses;
+    dst->access_ns += src->access_ns;
+    dst->dispatches += src->dispatches;
+    dst->cpu_ns += src->cpu_ns;
+    dst->ready_ns += src->ready_ns;
+    dst->io_ns += src->io_ns;
+    dst->turnaround_ns += src->turnaround_ns;
+    dst->prefetches += src->prefetches;
+    dst->prefetch_hits += src->prefetch_hits;
+    dst->prefetch_unused += src->prefetch_unused;
+    dst->prefetch_evictions += src->prefetch_evictions;
+    dst->writes += src->writes;
+    dst->dirty_evictions += src->dirty_evictions;
+    dst->cleaned += src->cleaned;
+    dst->shared_faults += src->shared_faults;
+    dst->cow_faults += src->cow_faults;
+    dst->promotions += src->promotions;
+    dst->demotions += src->demotions;
+    dst->bloat_pages += src->bloat_pages;
+    dst->promote_fails += src->promote_fails;
+    dst->huge_hits += src->huge_hits;
+}
+
+// Effective access time: estimated time per completed reference, a hit or a fault served by a shared frame
+double sim_stats_eat(const sim_stats_t *stats) {
+    long long done = stats->hits + stats->shared_faults;
+    return done ? stats->access_ns / done : 0.0;
+}
+
+// Effective access time counting the time processes waited for page-ins (and the page-outs before them)
+double sim_stats_eat_faults(const sim_stats_t *stats) {
+    long long done = stats->hits + stats->shared_faults;
+    return done ? (stats->access_ns + stats->io_ns) / done : 0.0;
+}
+
+// Fraction of the CPUs' time spent running processes until the last one terminated
+double sim_utilization(const sim_t *sim) {
+    if (sim->makespan <= 0) return 0.0;
+    double busy = 0.0;
+    for (int i = 0; i < sim->config.ncpus; i++) busy += sim->cpus[i].busy;
+    return busy / (sim->config.ncpus * sim->makespan);
+}
+
+// Mean fragmentation of the free frames seen by the faults: the share of the free frames that lie in
+// 2 MB blocks with some frames in use, and so could not back a huge page (0: none, 1: all)
+double sim_fragmentation(const sim_t *sim) {
+    return sim->frag_samples ? sim->frag_sum / sim->frag_samples : 0.0;
+}
+
+// Set up the processes, page tables, frames and ready queue of a run
+int sim_init(sim_t *sim, const sim_trace_t *trace, const sim_config_t *config) {
+    if (config->f < 1) {
+        fprintf(stderr, "At least one frame is required for the simulation\n");
+        return -1;
+    }
+    if (config->policy < 0 || config->policy >= SIM_NUM_POLICIES) {
+        fprintf(stderr, "Invalid replacement policy %d\n", config->policy);
+        return -1;
+    }
+    if (config->sched < 0 || config->sched >= SIM_NUM_SCHEDS) {
+        fprintf(stderr, "Invalid scheduling policy %d\n", config->sched);
+        return -1;
+    }
+    if (config->ncpus < 1 || config->ncpus > SIM_MAX_CPUS) {
+        fprintf(stderr, "The number of CPUs must be between 1 and %d\n", SIM_MAX_CPUS);
+        return -1;
+    }
+    if (config->sched != SIM_SCHED_FIFO && config->quantum_ns <= 0) {
+        fprintf(stderr, "The time quantum must be positive\n");
+        return -1;
+    }
+    if (config->prefetch < 0 || config->prefetch >= SIM_NUM_PREFETCH) {
+        fprintf(stderr, "Invalid prefetch strategy %d\n", config->prefetch);
+        return -1;
+    }
+    if (config->prefetch != SIM_PREFETCH_NONE && config->prefetch_depth < 1) {
+        fprintf(stderr, "The prefetch depth must be positive\n");
+        return -1;
+    }
+    if (config->writeback_ns > 0 && config->writeback_batch < 1) {
+        fprintf(stderr, "The write-back daemon must clean at least one page per period\n");
+        return -1;
+    }
+    if (config->huge_order < 0 || config->huge_order >= SIM_NUM_PAGE_SIZES) {
+        fprintf(stderr, "Invalid page size %d\n", config->huge_order);
+        return -1;
+    }
+    if (config->huge_order != SIM_PAGE_4K && (config->huge_threshold <= 0 || config->huge_threshold > 1)) {
+        fprintf(stderr, "The huge page promotion threshold must be in (0, 1]\n");
+        return -1;
+    }
+    if (config->sched == SIM_SCHED_MLFQ && (config->levels < 1 || config->levels > SIM_MAX_LEVELS)) {
+        fprintf(stderr, "The number of MLFQ levels must be between 1 and %d\n", SIM_MAX_LEVELS);
+        return -1;
+    }
+
+    memset(sim, 0, sizeof(sim_t));
+    sim->config = *config;
+    sim->k = trace->k;
+    sim->rng = config->seed;
+
+    // Fit the page table shape to the largest address space of the trace
+    int64_t max_mi = 1;
+    for (int i = 0; i < trace->k; i++) {
+        if (trace->procs[i].mi > max_mi) max_mi = trace->procs[i].mi;
+    }
+    if (pt_spec_fit(&sim->config.pt, max_mi) != 0) {
+        fprintf(stderr, "The radix page table does not cover %" PRId64 " pages\n", max_mi);
+        return -1;
+    }
+    if (sim->config.pt.type == PT_HASHED && sim->config.pt.nbuckets <= 0) {
+        sim->config.pt.nbuckets = 2 * config->f; // Hashed tables only hold resident pages
+    }
+
+    // One TLB per CPU
+    sim->tlbs = (tlb_t *)calloc(config->ncpus, sizeof(tlb_t));
+    for (int i = 0; i < config->ncpus; i++) {
+        if (tlb_init(&sim->tlbs[i], &config->tlb, config->seed + i) != 0) {
+            fprintf(stderr, "Could not allocate the TLB\n");
+            sim_destroy(sim);
+            return -1;
+        }
+    }
+    sim->cpus = (sim_cpu_t *)calloc(config->ncpus, sizeof(sim_cpu_t));
+    for (int i = 0; i < config->ncpus; i++) {
+        sim->cpus[i].slot = -1;
+    }
+
+    // Page tables are allocated lazily from one arena
+    if (pt_arena_create(&sim->arena, 1 << 16) != 0) {
+        fprintf(stderr, "Could not allocate the page tables\n");
+        sim_destroy(sim);
+        return -1;
+    }
+    int ntables = (sim->config.pt.type == PT_HASHED) ? 1 : sim->k;
+    sim->tables = (pagetable_t *)calloc(ntables, sizeof(pagetable_t));
+    for (int i = 0; i < ntables; i++) {
+        if (pt_init(&sim->tables[i], &sim->arena, &sim->config.pt, sizeof(sim_pte_t), trace->procs[i].mi) != 0) {
+            fprintf(stderr, "Could not allocate the page tables\n");
+            sim_destroy(sim);
+            return -1;
+        }
+    }
+
+    // Resident segment pages, keyed by (segment, page within the segment)
+    if (trace->nmaps > 0) {
+        pt_spec_t segspec = {PT_HASHED, 0, {0}, 2 * config->f};
+        if (pt_init(&sim->segtable, &sim->arena, &segspec, sizeof(sim_pte_t), 0) != 0) {
+            fprintf(stderr, "Could not allocate the segment table\n");
+            sim_destroy(sim);
+            return -1;
+        }
+    }
+
+    // All frames are free initially
+    sim->frames = (sim_frame_t *)malloc(config->f * sizeof(sim_frame_t));
+    for (int i = 0; i < config->f; i++) {
+        sim->frames[i].owner = -1;
+        sim->frames[i].seg = -1;
+        sim->frames[i].head = i;
+        sim->frames[i].order = SIM_PAGE_4K;
+        sim->frames[i].subref = NULL;
+    }
+    sim->free_frames = config->f;
+    sim->nblocks = (int)(config->f / ORDER_PAGES(SIM_PAGE_2M));
+    sim->block_free = (int *)malloc((sim->nblocks + 1) * sizeof(int));
+    for (int b = 0; b <= sim->nblocks; b++) {
+        sim->block_free[b] = (b < sim->nblocks) ? (int)ORDER_PAGES(SIM_PAGE_2M) : (int)(config->f % ORDER_PAGES(SIM_PAGE_2M));
+    }
+    sim->free_blocks = sim->nblocks;
+    sim->first_free = 0;
+
+    // Every process is in the top ready queue in the order of creation, like the processes launched by master.c
+    sim->procs = (sim_proc_t *)calloc(sim->k, sizeof(sim_proc_t));
+    int nlevels = (config->sched == SIM_SCHED_MLFQ) ? config->levels : 1;
+    for (int l = 0; l < nlevels; l++) {
+        sim->ready[l] = (int *)malloc(sim->k * sizeof(int));
+    }
+    sim->ioq = (int *)malloc(sim->k * sizeof(int));
+    sim->io_done = (double *)malloc(sim->k * sizeof(double));
+    for (int i = 0; i < sim->k; i++) {
+        sim_proc_t *p = &sim->procs[i];
+        p->trace = &trace->procs[i];
+        p->pt = &sim->tables[ntables == 1 ? 0 : i];
+        // A process never holds more than f frames or more than mi pages
+        int max_frames = (p->trace->mi < config->f) ? (int)p->trace->mi : config->f;
+        p->frames = (int *)malloc(max_frames * sizeof(int));
+        sim->ready[0][i] = i;
+        for (int o = SIM_PAGE_2M; o <= config->huge_order; o++) {
+            p->resident[o] = (int *)calloc(p->trace->mi / ORDER_PAGES(o) + 1, sizeof(int));
+        }
+    }
+    for (int j = 0; j < trace->nmaps; j++) {
+        sim_proc_t *p = &sim->procs[trace->maps[j].proc];
+        p->maps = (const sim_map_t **)realloc(p->maps, (p->nmaps + 1) * sizeof(sim_map_t *));
+        p->maps[p->nmaps++] = &trace->maps[j];
+    }
+    sim->rq_len[0] = sim->k;
+    sim->next_boost = config->boost_ns;
+    sim->next_writeback = config->writeback_ns;
+
+    return 0;
+}
+
+// Count a frame out of the free pool, for the fragmentation of the 2 MB blocks
+static void take_frame(sim_t *sim, int frame) {
+    int b = (int)(frame / ORDER_PAGES(SIM_PAGE_2M));
+    if (b < sim->nblocks && sim->block_free[b] == ORDER_PAGES(SIM_PAGE_2M)) sim->free_blocks--;
+    sim->block_free[b]--;
+    sim->free_frames--;
+}
+
+// Lowest numbered free frame (same choice as the scan of SM2 in mmu.c), -1 if none
+static int alloc_frame(sim_t *sim) {
+    for (int i = sim->first_free; i < sim->config.f; i++) {
+        if (sim->frames[i].owner == -1) {
+            sim->first_free = i + 1;
+            take_frame(sim, i);
+            return i;
+        }
+    }
+    sim->first_free = sim->config.f;
+    return -1;
+}
+
+// Return a frame to the free pool
+static void release_frame(sim_t *sim, int frame) {
+    sim->frames[frame].owner = -1;
+    if (frame < sim->first_free) sim->first_free = frame;
+    int b = (int)(frame / ORDER_PAGES(SIM_PAGE_2M));
+    sim->block_free[b]++;
+    if (b < sim->nblocks && sim->block_free[b] == ORDER_PAGES(SIM_PAGE_2M)) sim->free_blocks++;
+    sim->free_frames++;
+}
+
+// Page table entry of a page, counting the walk against the process
+static sim_pte_t *walk(sim_t *sim, int slot, int64_t page, int create, int *nsteps) {
+    int steps = 0;
+    sim_proc_t *p = &sim->procs[slot];
+    sim_pte_t *pte = (sim_pte_t *)pt_lookup(p->pt, &sim->arena, slot, page, create, &steps);
+    // A huge page is mapped higher up a radix tree: the walk stops a level short for every size step
+    if (pte != NULL && pte->valid == 1 && pte->order > SIM_PAGE_4K && p->pt->spec.type == PT_RADIX) {
+        steps = (steps > pte->order) ? steps - pte->order : 1;
+    }
+    p->stats.walks++;
+    p->stats.walk_steps += steps;
+    if (nsteps != NULL) *nsteps = steps;
+    return pte;
+}
+
+// Page table entry of a page without counting a walk (the work of the kernel rather than of the process)
+static sim_pte_t *peek(sim_t *sim, int slot, int64_t page, int create) {
+    return (sim_pte_t *)pt_lookup(sim->procs[slot].pt, &sim->arena, slot, page, create, NULL);
+}
+
+// Keep the resident page counts of the huge page blocks up to date when npages pages from first come or go
+static void count_resident(sim_t *sim, sim_proc_t *p, int64_t first, int64_t npages, int delta) {
+    for (int o = SIM_PAGE_2M; o <= sim->config.huge_order; o++) {
+        int64_t size = ORDER_PAGES(o);
+        for (int64_t q = first; q < first + npages; q = (q / size + 1) * size) {
+            int64_t end = (q / size + 1) * size;
+            if (end > first + npages) end = first + npages;
+            p->resident[o][q / size] += delta * (int)(end - q);
+        }
+    }
+}
+
+// Map a page to a frame and add the frame to the process's frame list, -1 if the table is out of memory
+static int map_page(sim_t *sim, int slot, int64_t page, int frame) {
+    sim_proc_t *p = &sim->procs[slot];
+    sim_pte_t *pte = walk(sim, slot, page, 1, NULL);
+    if (pte == NULL) return -1;
+    pte->frame = frame;
+    pte->valid = 1;
+    pte->order = SIM_PAGE_4K;
+    count_resident(sim, p, page, 1, 1);
+
+    sim_frame_t *fr = &sim->frames[frame];
+    fr->owner = slot;
+    fr->page = page;
+    fr->last_use = sim->timestamp;
+    fr->loaded = sim->timestamp;
+    fr->ref = 1;
+    fr->prefetched = 0;
+    fr->dirty = 0;
+    fr->seg = -1;
+    fr->refs = 1;
+    fr->head = frame;
+    fr->order = SIM_PAGE_4K;
+    fr->pslot = p->nframes;
+    p->frames[p->nframes++] = frame;
+    return 0;
+}
+
+// Remove the translation of a page of a process from every TLB and from its page table
+static void clear_pte(sim_t *sim, int slot, int64_t page) {
+    sim_proc_t *p = &sim->procs[slot];
+    for (int i = 0; i < sim->config.ncpus; i++) {
+        tlb_invalidate(&sim->tlbs[i], slot, page);
+    }
+    // Hashed entries are given back to the table, the others are just invalidated
+    sim_pte_t *pte = walk(sim, slot, page, 0, NULL);
+    if (p->pt->spec.type == PT_HASHED) {
+        pt_remove(p->pt, &sim->arena, slot, page);
+    } else if (pte != NULL) {
+        memset(pte, 0, sizeof(sim_pte_t));
+    }
+}
+
+// Remove the entry of a page from the page table, without a walk or a TLB shootdown
+static void drop_pte(sim_t *sim, int slot, int64_t page) {
+    sim_proc_t *p = &sim->procs[slot];
+    if (p->pt->spec.type == PT_HASHED) {
+        pt_remove(p->pt, &sim->arena, slot, page);
+    } else {
+        sim_pte_t *pte = peek(sim, slot, page, 0);
+        if (pte != NULL) memset(pte, 0, sizeof(sim_pte_t));
+    }
+}
+
+// Take a frame out of its owner's list, moving the last frame of the list into the vacated position
+static void list_remove(sim_t *sim, int frame) {
+    sim_frame_t *fr = &sim->frames[frame];
+    sim_proc_t *p = &sim->procs[fr->owner];
+    int last = p->frames[--p->nframes];
+    p->frames[fr->pslot] = last;
+    sim->frames[last].pslot = fr->pslot;
+    if (p->hand >= p->nframes) p->hand = 0;
+}
+
+// Shared segment mapping covering a page of a process, NULL for a private page
+static const sim_map_t *find_map(const sim_proc_t *p, int64_t page) {
+    for (int i = 0; i < p->nmaps; i++) {
+        if (page >= p->maps[i]->first && page < p->maps[i]->first + p->maps[i]->pages) return p->maps[i];
+    }
+    return NULL;
+}
+
+// Entry of a resident segment page in the segment table
+static sim_pte_t *seg_lookup(sim_t *sim, int seg, int64_t segpage, int create) {
+    return (sim_pte_t *)pt_lookup(&sim->segtable, &sim->arena, seg, segpage, create, NULL);
+}
+
+// Record a freshly loaded segment page in the segment table, so that other processes can map its frame
+static void seg_insert(sim_t *sim, const sim_map_t *map, int64_t page, int frame) {
+    sim_frame_t *fr = &sim->frames[frame];
+    fr->seg = map->seg;
+    fr->segpage = page - map->first;
+    sim_pte_t *spte = seg_lookup(sim, fr->seg, fr->segpage, 1);
+    if (spte == NULL) {
+        fprintf(stderr, "Out of page table memory\n");
+        exit(1);
+    }
+    spte->frame = frame;
+    spte->valid = 1;
+}
+
+// Page through which a live process maps a shared frame, -1 if it does not map it.
+// There is no reverse map: the segment declarations of the process give the candidate pages.
+static int64_t mapped_page(sim_t *sim, int slot, int frame) {
+    sim_frame_t *fr = &sim->frames[frame];
+    sim_proc_t *q = &sim->procs[slot];
+    if (q->done) return -1;
+    for (int i = 0; i < q->nmaps; i++) {
+        const sim_map_t *map = q->maps[i];
+        if (map->seg != fr->seg || fr->segpage >= map->pages) continue;
+        int64_t page = map->first + fr->segpage;
+        sim_pte_t *pte = (sim_pte_t *)pt_lookup(q->pt, &sim->arena, slot, page, 0, NULL);
+        if (pte != NULL && pte->valid == 1 && pte->frame == frame) return page;
+    }
+    return -1;
+}
+
+// Hand a shared frame to another process mapping it, when its owner stops mapping it
+static void transfer_frame(sim_t *sim, int frame) {
+    sim_frame_t *fr = &sim->frames[frame];
+    for (int i = 0; i < sim->k; i++) {
+        int64_t page = (i == fr->owner) ? -1 : mapped_page(sim, i, frame);
+        if (page < 0) continue;
+        list_remove(sim, frame);
+        count_resident(sim, &sim->procs[fr->owner], fr->page, 1, -1);
+        sim_proc_t *q = &sim->procs[i];
+        count_resident(sim, q, page, 1, 1);
+        fr->owner = i;
+        fr->page = page;
+        fr->pslot = q->nframes;
+        q->frames[q->nframes++] = frame;
+        return;
+    }
+}
+
+// Make a shared frame private to one of the processes mapping it: the others lose their mapping
+// and fault on their next reference to the page
+static void unshare_frame(sim_t *sim, int frame, int keep) {
+    sim_frame_t *fr = &sim->frames[frame];
+    for (int i = 0; i < sim->k && fr->refs > 1; i++) {
+        int64_t page = (i == keep) ? -1 : mapped_page(sim, i, frame);
+        if (page < 0) continue;
+        if (i == fr->owner) {
+            transfer_frame(sim, frame);
+        }
+        clear_pte(sim, i, page);
+        fr->refs--;
+        sim->shared_saved--;
+    }
+    pt_remove(&sim->segtable, &sim->arena, fr->seg, fr->segpage);
+    fr->seg = -1;
+}
+
+// Invalidate the page held in a frame and remove the frame from its owner's list.
+// A shared frame is unmapped from every process mapping it.
+// The rest of the frames of a huge page return to the pool, only its first frame stays with the caller.
+static void unmap_frame(sim_t *sim, int frame) {
+    sim_frame_t *fr = &sim->frames[frame];
+    if (fr->seg >= 0) unshare_frame(sim, frame, fr->owner);
+    sim_proc_t *p = &sim->procs[fr->owner];
+    if (fr->prefetched) p->stats.prefetch_unused++;
+    clear_pte(sim, fr->owner, fr->page);
+
+    int64_t size = ORDER_PAGES(fr->order);
+    for (int64_t i = 1; i < size; i++) {
+        drop_pte(sim, fr->owner, fr->page + i);
+        release_frame(sim, frame + (int)i);
+    }
+    if (fr->order > SIM_PAGE_4K) {
+        free(fr->subref);
+        fr->subref = NULL;
+        fr->order = SIM_PAGE_4K;
+    }
+    count_resident(sim, p, fr->page, size, -1);
+    list_remove(sim, frame);
+}
+
+// Take a frame from its page for a new one; a dirty page is written back first
+static void evict(sim_t *sim, int frame) {
+    if (sim->frames[frame].dirty) {
+        sim->procs[sim->frames[frame].owner].stats.dirty_evictions++;
+        sim->last_pageouts += (int)ORDER_PAGES(sim->frames[frame].order);
+    }
+    unmap_frame(sim, frame);
+}
+
+// Split a huge page back into base pages under memory pressure. The base pages that were never referenced
+// are freed (the bloat of the promotion), the others stay resident with the replacement state of the huge page.
+static void demote(sim_t *sim, int head) {
+    sim_frame_t unit = sim->frames[head];
+    int slot = unit.owner;
+    sim_proc_t *p = &sim->procs[slot];
+    int64_t size = ORDER_PAGES(unit.order);
+
+    list_remove(sim, head);
+    sim->frames[head].order = SIM_PAGE_4K;
+    sim->frames[head].subref = NULL;
+    for (int i = 0; i < sim->config.ncpus; i++) {
+        tlb_invalidate(&sim->tlbs[i], slot, unit.page);
+    }
+    for (int64_t i = 0; i < size; i++) {
+        int frame = head + (int)i;
+        if (unit.subref[i / 64] & (1ULL << (i % 64))) {
+            peek(sim, slot, unit.page + i, 0)->order = SIM_PAGE_4K;
+            sim_frame_t *fr = &sim->frames[frame];
+            *fr = unit;
+            fr->page = unit.page + i;
+            fr->head = frame;
+            fr->order = SIM_PAGE_4K;
+            fr->subref = NULL;
+            fr->pslot = p->nframes;
+            p->frames[p->nframes++] = frame;
+        } else {
+            drop_pte(sim, slot, unit.page + i);
+            release_frame(sim, frame);
+            count_resident(sim, p, unit.page + i, 1, -1);
+        }
+    }
+    free(unit.subref);
+    p->stats.demotions++;
+}
+
+// Promote the aligned block of the given order holding a page that just faulted in to a huge page, when enough
+// of the block is resident and a free aligned run of frames can hold it. Returns 1 if the block was promoted.
+// The resident pages are copied to the run, the rest of the block is filled in (bloat).
+static int promote(sim_t *sim, int slot, int64_t page, int order) {
+    sim_proc_t *p = &sim->procs[slot];
+    int64_t size = ORDER_PAGES(order);
+    int64_t first = page - page % size;
+    if (first + size > p->trace->mi || p->resident[order][first / size] < sim->config.huge_threshold * size) return 0;
+    sim_pte_t *pte = peek(sim, slot, page, 0);
+    if (pte == NULL || pte->valid != 1 || pte->order >= order) return 0;
+    // Shared segments stay in base pages
+    for (int i = 0; i < p->nmaps; i++) {
+        if (p->maps[i]->first < first + size && p->maps[i]->first + p->maps[i]->pages > first) return 0;
+    }
+
+    // First fit among the aligned runs of entirely free 2 MB blocks
+    int64_t blocks = size / ORDER_PAGES(SIM_PAGE_2M);
+    int run = -1;
+    for (int64_t b = 0; b + blocks <= sim->nblocks && run == -1; b += blocks) {
+        int64_t j = 0;
+        while (j < blocks && sim->block_free[b + j] == ORDER_PAGES(SIM_PAGE_2M)) j++;
+        if (j == blocks) run = (int)(b * ORDER_PAGES(SIM_PAGE_2M));
+    }
+    if (run == -1) {
+        if (sim->free_frames >= size) p->stats.promote_fails++;
+        return 0;
+    }
+
+    // Take the run before the old frames are freed, so that they do not land in it
+    for (int64_t i = 0; i < size; i++) {
+        sim_frame_t *fr = &sim->frames[run + i];
+        take_frame(sim, run + (int)i);
+        fr->owner = slot;
+        fr->head = run;
+        fr->order = SIM_PAGE_4K;
+        fr->dirty = 0;
+        fr->prefetched = 0;
+        fr->seg = -1;
+    }
+
+    // Move the resident pages, small and huge, over to the run
+    uint64_t *subref = (uint64_t *)calloc((size_t)size / 64, sizeof(uint64_t));
+    int64_t had = 0;
+    int dirty = 0;
+    for (int64_t q = first; q < first + size;) {
+        pte = peek(sim, slot, q, 0);
+        if (pte == NULL || pte->valid != 1) {
+            q++;
+            continue;
+        }
+        int head = sim->frames[pte->frame].head;
+        sim_frame_t *u = &sim->frames[head];
+        int64_t n = ORDER_PAGES(u->order);
+        if (u->order > SIM_PAGE_4K) {
+            for (int64_t i = 0; i < n; i++) {
+                if (u->subref[i / 64] & (1ULL << (i % 64))) subref[(q - first + i) / 64] |= 1ULL << ((q - first + i) % 64);
+            }
+        } else if (!u->prefetched) {
+            subref[(q - first) / 64] |= 1ULL << ((q - first) % 64);
+        }
+        dirty |= u->dirty;
+        had += n;
+        unmap_frame(sim, head);
+        release_frame(sim, head);
+        q += n;
+    }
+
+    // One mapping for the block
+    for (int64_t i = 0; i < size; i++) {
+        pte = peek(sim, slot, first + i, 1);
+        if (pte == NULL) {
+            fprintf(stderr, "Out of page table memory\n");
+            exit(1);
+        }
+        pte->frame = run + (int)i;
+        pte->valid = 1;
+        pte->order = order;
+    }
+    sim_frame_t *hd = &sim->frames[run];
+    hd->page = first;
+    hd->last_use = sim->timestamp;
+    hd->loaded = sim->timestamp;
+    hd->ref = 1;
+    hd->dirty = dirty;
+    hd->refs = 1;
+    hd->order = order;
+    hd->subref = subref;
+    hd->pslot = p->nframes;
+    p->frames[p->nframes++] = run;
+    count_resident(sim, p, first, size, 1);
+    p->stats.promotions++;
+    p->stats.bloat_pages += size - had;
+    return 1;
+}
+
+// Pick the frame of the process to be replaced, -1 if it holds no frame
+static int select_victim(sim_t *sim, sim_proc_t *p) {
+    if (p->nframes == 0) return -1;
+
+    int victim = -1;
+    switch (sim->config.policy) {
+        case SIM_POLICY_LRU: {
+            long min_time = LONG_MAX;
+            for (int i = 0; i < p->nframes; i++) {
+                if (sim->frames[p->frames[i]].last_use < min_time) {
+                    min_time = sim->frames[p->frames[i]].last_use;
+                    victim = p->frames[i];
+                }
+            }
+            break;
+        }
+        case SIM_POLICY_FIFO: {
+            long min_time = LONG_MAX;
+            for (int i = 0; i < p->nframes; i++) {
+                if (sim->frames[p->frames[i]].loaded < min_time) {
+                    min_time = sim->frames[p->frames[i]].loaded;
+                    victim = p->frames[i];
+                }
+            }
+            break;
+        }
+        case SIM_POLICY_CLOCK: {
+            // Clear reference bits until a frame without one is found
+            while (1) {
+                sim_frame_t *fr = &sim->frames[p->frames[p->hand]];
+                if (fr->ref == 0) {
+                    victim = p->frames[p->hand];
+                    break;
+                }
+                fr->ref = 0;
+                p->hand = (p->hand + 1) % p->nframes;
+            }
+            break;
+        }
+        case SIM_POLICY_RANDOM:
+            victim = p->frames[sim_rand(&sim->rng) % p->nframes];
+            break;
+    }
+    return victim;
+}
+
+// Record a reference to a resident page for the replacement policies and the prefetch counters
+static void touch(sim_t *sim, sim_proc_t *p, int frame, int write) {
+    int head = sim->frames[frame].head;
+    sim_frame_t *fr = &sim->frames[head];
+    if (fr->order > SIM_PAGE_4K) {
+        fr->subref[(frame - head) / 64] |= 1ULL << ((frame - head) % 64);
+        p->stats.huge_hits++;
+    }
+    fr->last_use = sim->timestamp;
+    fr->ref = 1;
+    if (write) {
+        fr->dirty = 1;
+        p->stats.writes++;
+    }
+    if (fr->prefetched) {
+        fr->prefetched = 0;
+        p->stats.prefetch_hits++;
+    }
+}
+
+// A write to a copy-on-write page: give the process a private copy of the shared frame.
+// Returns the frame the page is now in, or -1 if no frame can be had for the copy.
+static int break_cow(sim_t *sim, int slot, int64_t page, int frame, double *ref_ns) {
+    sim_proc_t *p = &sim->procs[slot];
+    const sim_map_t *map = find_map(p, page);
+    if (map == NULL || !map->cow) return frame;
+    p->stats.cow_faults++;
+
+    // The last process mapping the page just takes the frame over
+    sim_frame_t *fr = &sim->frames[frame];
+    if (fr->refs == 1) {
+        unshare_frame(sim, frame, slot);
+        return frame;
+    }
+
+    int copy = alloc_frame(sim);
+    if (copy == -1) {
+        copy = select_victim(sim, p);
+        if (copy == -1) {
+            p->stats.page_faults++;
+            p->stats.no_victim++;
+            return -1;
+        }
+        if (copy == frame) {
+            unshare_frame(sim, frame, slot);
+            return frame;
+        }
+        // The copy is not queued at the disk: a dirty victim's write is charged to this reference
+        if (sim->frames[copy].dirty) {
+            p->stats.access_ns += sim->config.pageout_ns;
+            *ref_ns += sim->config.pageout_ns;
+        }
+        evict(sim, copy);
+        p->stats.replacements++;
+    }
+
+    if (fr->owner == slot) transfer_frame(sim, frame);
+    fr->refs--;
+    sim->shared_saved--;
+    clear_pte(sim, slot, page);
+    if (map_page(sim, slot, page, copy) != 0) {
+        fprintf(stderr, "Out of page table memory\n");
+        exit(1);
+    }
+    p->stats.access_ns += sim->config.copy_ns;
+    *ref_ns += sim->config.copy_ns;
+    return copy;
+}
+
+// Load a page ahead of its use. Returns -1 when no frame can be had without evicting
+// a page loaded by this same fault, which ends the prefetching.
+static int prefetch_page(sim_t *sim, int slot, int64_t page) {
+    sim_proc_t *p = &sim->procs[slot];
+    if (page < 0 || page >= p->trace->mi) return 0;
+    sim_pte_t *pte = walk(sim, slot, page, 0, NULL);
+    if (pte != NULL && pte->valid == 1) return 0;
+    // A segment page already resident is mapped on demand, without a page-in
+    const sim_map_t *map = (p->nmaps > 0) ? find_map(p, page) : NULL;
+    if (map != NULL) {
+        sim_pte_t *spte = seg_lookup(sim, map->seg, page - map->first, 0);
+        if (spte != NULL && spte->valid == 1) return 0;
+    }
+
+    int frame = alloc_frame(sim);
+    if (frame == -1) {
+        frame = select_victim(sim, p);
+        // Huge pages are not broken up for a prefetch
+        if (frame == -1 || sim->frames[frame].loaded == sim->timestamp || sim->frames[frame].order > SIM_PAGE_4K) return -1;
+        if (!sim->frames[frame].prefetched) p->stats.prefetch_evictions++;
+        evict(sim, frame);
+    }
+    if (map_page(sim, slot, page, frame) != 0) {
+        fprintf(stderr, "Out of page table memory\n");
+        exit(1);
+    }
+    if (map != NULL) seg_insert(sim, map, page, frame);
+    // Not referenced yet: the clock policy may take it back first
+    sim->frames[frame].ref = 0;
+    sim->frames[frame].prefetched = 1;
+    p->stats.prefetches++;
+    sim->last_prefetched++;
+    return 0;
+}
+
+// Load the pages the prefetch strategy expects to be referenced after the one that faulted
+static void prefetch(sim_t *sim, int slot, int64_t page) {
+    sim_proc_t *p = &sim->procs[slot];
+    int depth = sim->config.prefetch_depth;
+
+    switch (sim->config.prefetch) {
+        case SIM_PREFETCH_READAHEAD:
+            for (int i = 1; i <= depth; i++) {
+                if (prefetch_page(sim, slot, page + i) != 0) break;
+            }
+            break;
+        case SIM_PREFETCH_STRIDE:
+            if (p->stride_conf < 1) break;
+            for (int i = 1; i <= depth; i++) {
+                if (prefetch_page(sim, slot, page + i * p->stride) != 0) break;
+            }
+            break;
+        case SIM_PREFETCH_CLUSTER: {
+            int64_t first = page - page % depth;
+            for (int64_t q = first; q < first + depth; q++) {
+                if (q != page && prefetch_page(sim, slot, q) != 0) break;
+            }
+            break;
+        }
+    }
+}
+
+// Handle one page reference of the process in the given slot, as mmu.c does for a message on queue 3.
+// The reference is a page number, with REFGEN_WRITE set for a write.
+// The time taken by the translation and data access is added to *ref_ns.
+int sim_access(sim_t *sim, int slot, int64_t ref, double *ref_ns) {
+    sim_proc_t *p = &sim->procs[slot];
+    int fd = sim->config.log_fd;
+    int64_t page = REFGEN_PAGE(ref);
+    int write = (ref & REFGEN_WRITE) != 0;
+
+    sim->timestamp++;
+    p->stats.references++;
+    if (fd >= 0) dprintf(fd, "Global ordering - (Timestamp %ld, Process %d, Page %" PRId64 ")\n", sim->timestamp, slot + 1, page);
+
+    // Illegal page reference
+    if (page >= p->trace->mi) {
+        p->stats.illegal_access++;
+        if (fd >= 0) dprintf(fd, "Invalid Page Reference - (Process %d, Page %" PRId64 ")\n", slot + 1, page);
+        return SIM_INVALID;
+    }
+
+    // Stride detector (a retried reference repeats the page and is not a new stride)
+    if (page != p->last_page) {
+        int64_t stride = page - p->last_page;
+        if (stride == p->stride) {
+            if (p->stride_conf < 3) p->stride_conf++;
+        } else {
+            p->stride = stride;
+            p->stride_conf = 0;
+        }
+        p->last_page = page;
+    }
+
+    // The TLB is consulted before the page table
+    double ns = 0.0;
+    int frame = -1;
+    if (sim->config.tlb.nlevels > 0) {
+        int level = tlb_lookup(&sim->tlbs[sim->cpu], slot, page, &frame, &ns);
+        if (level >= 0) {
+            if (write && sim->frames[frame].seg >= 0) {
+                if ((frame = break_cow(sim, slot, page, frame, ref_ns)) < 0) return SIM_FAULT;
+                tlb_insert(&sim->tlbs[sim->cpu], slot, page, frame);
+            }
+            touch(sim, p, frame, write);
+            p->stats.tlb_hits[level]++;
+            p->stats.hits++;
+            p->stats.access_ns += ns + sim->config.mem_ns;
+            *ref_ns += ns + sim->config.mem_ns;
+            return SIM_HIT;
+        }
+        p->stats.tlb_misses++;
+    }
+
+    // Page hit
+    int steps = 0;
+    sim_pte_t *pte = walk(sim, slot, page, 0, &steps);
+    ns += steps * sim->config.mem_ns;
+    if (pte != NULL && pte->valid == 1) {
+        frame = pte->frame;
+        int order = pte->order;
+        if (write && sim->frames[frame].seg >= 0 && (frame = break_cow(sim, slot, page, frame, ref_ns)) < 0) return SIM_FAULT;
+        touch(sim, p, frame, write);
+        tlb_insert_size(&sim->tlbs[sim->cpu], slot, page, frame, SIM_HUGE_SHIFT * order);
+        p->stats.hits++;
+        p->stats.access_ns += ns + sim->config.mem_ns;
+        *ref_ns += ns + sim->config.mem_ns;
+        return SIM_HIT;
+    }
+    p->stats.access_ns += ns;
+    *ref_ns += ns;
+
+    // Page fault
+    p->stats.page_faults++;
+    sim->last_prefetched = 0;
+    sim->last_pageouts = 0;
+    if (sim->nblocks > 0) {
+        sim->frag_sum += sim->free_frames ? 1.0 - (double)sim->free_blocks * ORDER_PAGES(SIM_PAGE_2M) / sim->free_frames : 0.0;
+        sim->frag_samples++;
+    }
+    if (fd >= 0) dprintf(fd, "Page fault sequence - (Process %d, Page %" PRId64 ")\n", slot + 1, page);
+
+    // A segment page another process has loaded is mapped without a page-in
+    const sim_map_t *map = (p->nmaps > 0) ? find_map(p, page) : NULL;
+    sim_pte_t *spte = (map != NULL) ? seg_lookup(sim, map->seg, page - map->first, 0) : NULL;
+    if (spte != NULL && spte->valid == 1) {
+        frame = spte->frame;
+        pte = walk(sim, slot, page, 1, NULL);
+        if (pte == NULL) {
+            fprintf(stderr, "Out of page table memory\n");
+            exit(1);
+        }
+        pte->frame = frame;
+        pte->valid = 1;
+        pte->order = SIM_PAGE_4K;
+        sim->frames[frame].refs++;
+        if (++sim->shared_saved > sim->peak_saved) sim->peak_saved = sim->shared_saved;
+        p->stats.shared_faults++;
+
+        if (write && (frame = break_cow(sim, slot, page, frame, ref_ns)) < 0) return SIM_FAULT;
+        touch(sim, p, frame, write);
+        tlb_insert(&sim->tlbs[sim->cpu], slot, page, frame);
+        p->stats.access_ns += sim->config.mem_ns;
+        *ref_ns += sim->config.mem_ns;
+        return SIM_HIT;
+    }
+
+    frame = alloc_frame(sim);
+    if (frame == -1) {
+        // Replace one of the process's own pages
+        frame = select_victim(sim, p);
+        if (frame == -1) {
+            // Nothing to replace, the process retries the reference later
+            p->stats.no_victim++;
+            return SIM_FAULT;
+        }
+        // A huge victim is split first: the pages it never had referenced make room
+        int freed = -1;
+        if (sim->frames[frame].order > SIM_PAGE_4K && sim->config.huge_demote) {
+            demote(sim, frame);
+            freed = alloc_frame(sim);
+            if (freed == -1) frame = select_victim(sim, p);
+        }
+        if (freed != -1) {
+            frame = freed;
+        } else {
+            evict(sim, frame);
+            p->stats.replacements++;
+        }
+    }
+    if (map_page(sim, slot, page, frame) != 0) {
+        fprintf(stderr, "Out of page table memory\n");
+        exit(1);
+    }
+    // A page written through a copy-on-write mapping is a private copy straight away
+    if (map != NULL && !(write && map->cow)) seg_insert(sim, map, page, frame);
+    if (sim->config.prefetch != SIM_PREFETCH_NONE) prefetch(sim, slot, page);
+    for (int o = sim->config.huge_order; o > SIM_PAGE_4K; o--) {
+        if (promote(sim, slot, page, o)) break;
+    }
+
+    return SIM_FAULT;
+}
+
+// Free all the frames of a terminated process. Shared frames still mapped by other processes stay resident.
+void sim_terminate(sim_t *sim, int slot) {
+    sim_proc_t *p = &sim->procs[slot];
+    for (int i = 0; i < p->nmaps; i++) {
+        for (int64_t page = p->maps[i]->first; page < p->maps[i]->first + p->maps[i]->pages; page++) {
+            sim_pte_t *pte = (sim_pte_t *)pt_lookup(p->pt, &sim->arena, slot, page, 0, NULL);
+            if (pte == NULL || pte->valid != 1) continue;
+            sim_frame_t *fr = &sim->frames[pte->frame];
+            if (fr->seg < 0 || fr->refs == 1) continue;
+            if (fr->owner == slot) transfer_frame(sim, pte->frame);
+            fr->refs--;
+            sim->shared_saved--;
+            clear_pte(sim, slot, page);
+        }
+    }
+    while (p->nframes > 0) {
+        int frame = p->frames[p->nframes - 1];
+        unmap_frame(sim, frame);
+        release_frame(sim, frame);
+    }
+    p->done = 1;
+}
+
+// Append a process to the ready queue of its level
+static void make_ready(sim_t *sim, int slot, double now) {
+    sim_proc_t *p = &sim->procs[slot];
+    int l = p->level;
+    sim->ready[l][(sim->rq_head[l] + sim->rq_len[l]) % sim->k] = slot;
+    sim->rq_len[l]++;
+    p->since = now;
+}
+
+// Take the process at the front of the highest non-empty ready queue, -1 if there is none
+static int next_ready(sim_t *sim) {
+    int nlevels = (sim->config.sched == SIM_SCHED_MLFQ) ? sim->config.levels : 1;
+    for (int l = 0; l < nlevels; l++) {
+        if (sim->rq_len[l] > 0) {
+            int slot = sim->ready[l][sim->rq_head[l]];
+            sim->rq_head[l] = (sim->rq_head[l] + 1) % sim->k;
+            sim->rq_len[l]--;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Move the processes whose page-in has completed by now to the ready queue
+static void complete_io(sim_t *sim, double now) {
+    while (sim->io_len > 0 && sim->io_done[sim->io_head] <= now) {
+        int slot = sim->ioq[sim->io_head];
+        double done = sim->io_done[sim->io_head];
+        sim->io_head = (sim->io_head + 1) % sim->k;
+        sim->io_len--;
+        sim->procs[slot].stats.io_ns += done - sim->procs[slot].since;
+        make_ready(sim, slot, done);
+    }
+}
+
+// Put a faulting process in the I/O queue; the disk serves the page-ins one at a time
+static void wait_io(sim_t *sim, int slot, double now) {
+    double start = (sim->disk_free > now) ? sim->disk_free : now;
+    sim->disk_free = start + sim->last_pageouts * sim->config.pageout_ns + sim->config.pagein_ns +
+                     sim->last_prefetched * sim->config.transfer_ns;
+    int tail = (sim->io_head + sim->io_len) % sim->k;
+    sim->ioq[tail] = slot;
+    sim->io_done[tail] = sim->disk_free;
+    sim->io_len++;
+    sim->procs[slot].since = now;
+}
+
+// Write-back daemon: clean up to a batch of dirty pages not referenced since its last run, sweeping
+// the frames round robin. It only runs while the disk is idle, but page-ins arriving meanwhile
+// queue behind its writes.
+static void write_back(sim_t *sim, double now) {
+    if (sim->disk_free > now) return;
+    long since = sim->writeback_stamp;
+    sim->writeback_stamp = sim->timestamp;
+    int cleaned = 0;
+    for (int n = 0; n < sim->config.f && cleaned < sim->config.writeback_batch; n++) {
+        sim_frame_t *fr = &sim->frames[sim->writeback_hand];
+        sim->writeback_hand = (sim->writeback_hand + 1) % sim->config.f;
+        if (fr->owner == -1 || !fr->dirty || fr->last_use > since) continue;
+        fr->dirty = 0;
+        sim->procs[fr->owner].stats.cleaned++;
+        sim->disk_free = (sim->disk_free > now ? sim->disk_free : now) + sim->config.pageout_ns * ORDER_PAGES(fr->order);
+        cleaned++;
+    }
+}
+
+// MLFQ priority boost: every process goes back to the top level
+static void boost(sim_t *sim) {
+    for (int l = 1; l < sim->config.levels; l++) {
+        while (sim->rq_len[l] > 0) {
+            int slot = sim->ready[l][sim->rq_head[l]];
+            sim->rq_head[l] = (sim->rq_head[l] + 1) % sim->k;
+            sim->rq_len[l]--;
+            sim->ready[0][(sim->rq_head[0] + sim->rq_len[0]) % sim->k] = slot;
+            sim->rq_len[0]++;
+        }
+    }
+    for (int i = 0; i < sim->k; i++) {
+        sim->procs[i].level = 0;
+    }
+}
+
+// Take a process off its CPU after its termination
+static void finish(sim_t *sim, sim_cpu_t *cpu, int slot) {
+    sim_terminate(sim, slot);
+    sim->procs[slot].stats.turnaround_ns = cpu->clock;
+    if (cpu->clock > sim->makespan) sim->makespan = cpu->clock;
+    cpu->slot = -1;
+}
+
+// Run the processes on the simulated CPUs until all of them terminate.
+// The CPU with the earliest clock issues the next reference, so the references of all CPUs
+// reach the mmu in time order. With FIFO on one CPU and instantaneous page-ins this is exactly
+// sched.c: the process at the front of the ready queue runs until it faults or terminates.
+void sim_run(sim_t *sim) {
+    int fd = sim->config.log_fd;
+    int alive = sim->k;
+
+    while (alive > 0) {
+        // CPU with the earliest clock, busy CPUs first on ties
+        int c = 0;
+        for (int i = 1; i < sim->config.ncpus; i++) {
+            sim_cpu_t *a = &sim->cpus[i], *b = &sim->cpus[c];
+            if (a->clock < b->clock || (a->clock == b->clock && a->slot != -1 && b->slot == -1)) c = i;
+        }
+        sim_cpu_t *cpu = &sim->cpus[c];
+        double now = cpu->clock;
+
+        if (sim->config.sched == SIM_SCHED_MLFQ && sim->config.boost_ns > 0 && now >= sim->next_boost) {
+            boost(sim);
+            while (sim->next_boost <= now) sim->next_boost += sim->config.boost_ns;
+        }
+        if (sim->config.writeback_ns > 0 && now >= sim->next_writeback) {
+            write_back(sim, now);
+            while (sim->next_writeback <= now) sim->next_writeback += sim->config.writeback_ns;
+        }
+        complete_io(sim, now);
+
+        // An idle CPU takes the next ready process, or waits for the next event
+        if (cpu->slot == -1) {
+            int slot = next_ready(sim);
+            if (slot == -1) {
+                double wake = INFINITY;
+                if (sim->io_len > 0) wake = sim->io_done[sim->io_head];
+                for (int i = 0; i < sim->config.ncpus; i++) {
+                    if (sim->cpus[i].slot != -1 && sim->cpus[i].clock < wake) wake = sim->cpus[i].clock;
+                }
+                if (wake == INFINITY) break;
+                cpu->clock = wake;
+                continue;
+            }
+            cpu->slot = slot;
+            cpu->slice = 0.0;
+            sim->procs[slot].stats.dispatches++;
+            tlb_switch(&sim->tlbs[c], slot);
+            // A CPU that went idle until the clock of a busy one can find a process that CPU preempted later:
+            // it runs from its preemption on, once the CPU with the earliest clock gets to that time
+            if (sim->procs[slot].since > now) {
+                cpu->clock = sim->procs[slot].since;
+                continue;
+            }
+            sim->procs[slot].stats.ready_ns += now - sim->procs[slot].since;
+        }
+
+        int slot = cpu->slot;
+        sim_proc_t *p = &sim->procs[slot];
+        sim->cpu = c;
+
+        // Reference string exhausted: the process sends -9 and terminates
+        if (p->pc == p->trace->n) {
+            sim->timestamp++;
+            if (fd >= 0) dprintf(fd, "Global ordering - (Timestamp %ld, Process %d, Page %d)\n", sim->timestamp, slot + 1, -9);
+            finish(sim, cpu, slot);
+            alive--;
+            continue;
+        }
+
+        double ns = 0.0;
+        int outcome = sim_access(sim, slot, p->trace->refs[p->pc], &ns);
+        cpu->clock += ns;
+        cpu->busy += ns;
+        cpu->slice += ns;
+        p->stats.cpu_ns += ns;
+
+        if (outcome == SIM_HIT) {
+            p->pc++;
+            // Preempt at the end of the time slice (MLFQ slices double at each lower level)
+            if (sim->config.sched != SIM_SCHED_FIFO && cpu->slice >= sim->config.quantum_ns * (1 << p->level)) {
+                if (sim->config.sched == SIM_SCHED_MLFQ && p->level < sim->config.levels - 1) p->level++;
+                make_ready(sim, slot, cpu->clock);
+                cpu->slot = -1;
+            }
+        } else if (outcome == SIM_INVALID) {
+            finish(sim, cpu, slot);
+            alive--;
+        } else {
+            // Wait for the page-in, after which the same reference is issued again
+            wait_io(sim, slot, cpu->clock);
+            cpu->slot = -1;
+        }
+    }
+
+    // Sum up the counters of all the processes. A negative wait in the ready queue means a process was
+    // dispatched before it became ready, which would skew the turnaround and utilization figures.
+    memset(&sim->total, 0, sizeof(sim_stats_t));
+    for (int i = 0; i < sim->k; i++) {
+        if (sim->procs[i].stats.ready_ns < 0) {
+            fprintf(stderr, "Process %d was dispatched before it was ready\n", i + 1);
+            abort();
+        }
+        sim_stats_add(&sim->total, &sim->procs[i].stats);
+    }
+    sim->pt_bytes = pt_arena_used(&sim->arena);
+}
+
+// Release everything allocated by sim_init()
+void sim_destroy(sim_t *sim) {
+    for (int i = 0; sim->procs != NULL && i < sim->k; i++) {
+        free(sim->procs[i].frames);
+        free(sim->procs[i].maps);
+        for (int o = 0; o < SIM_NUM_PAGE_SIZES; o++) free(sim->procs[i].resident[o]);
+    }
+    for (int i = 0; sim->frames != NULL && i < sim->config.f; i++) {
+        free(sim->frames[i].subref);
+    }
+    free(sim->block_free);
+    sim->block_free = NULL;
+    free(sim->procs);
+    free(sim->frames);
+    for (int l = 0; l < SIM_MAX_LEVELS; l++) {
+        free(sim->ready[l]);
+        sim->ready[l] = NULL;
+    }
+    free(sim->ioq);
+    free(sim->io_done);
+    free(sim->tables);
+    if (sim->arena.base != NULL) pt_arena_destroy(&sim->arena);
+    if (sim->tlbs != NULL) {
+        for (int i = 0; i < sim->config.ncpus; i++) tlb_destroy(&sim->tlbs[i]);
+    }
+    free(sim->tlbs);
+    free(sim->cpus);
+    sim->procs = NULL;
+    sim->frames = NULL;
+    sim->ioq = NULL;
+    sim->io_done = NULL;
+    sim->tables = NULL;
+    sim->tlbs = NULL;
+    sim->cpus = NULL;
+}
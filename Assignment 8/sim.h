@@ -0,0 +1,259 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stdint.h>
+#include <pagetable.h>
+#include <tlb.h>
+#include <refgen.h>
+
+// Page replacement policies (applied among the faulting process's own pages, like mmu.c)
+#define SIM_POLICY_LRU 0    // Least recently used page (the policy implemented by mmu.c)
+#define SIM_POLICY_FIFO 1   // Page that was loaded earliest
+#define SIM_POLICY_CLOCK 2  // Second chance over the resident pages
+#define SIM_POLICY_RANDOM 3 // Uniformly random resident page
+#define SIM_NUM_POLICIES 4
+
+// Scheduling policies
+#define SIM_SCHED_FIFO 0  // A process runs until it faults or terminates (the policy of sched.c)
+#define SIM_SCHED_RR 1    // Round robin with a time quantum
+#define SIM_SCHED_MLFQ 2  // Multi-level feedback queue: a full quantum demotes, a fault does not
+#define SIM_NUM_SCHEDS 3
+
+// Prefetch strategies: pages loaded by the mmu along with the one that faulted
+#define SIM_PREFETCH_NONE 0       // Only the faulting page (mmu.c)
+#define SIM_PREFETCH_READAHEAD 1  // The next depth pages after the faulting one
+#define SIM_PREFETCH_STRIDE 2     // depth pages along the process's stride, once the same stride is seen twice running
+#define SIM_PREFETCH_CLUSTER 3    // The other pages of the aligned block of depth pages holding the faulting one
+#define SIM_NUM_PREFETCH 4
+
+// Page sizes: a page of order o maps an aligned block of 2^(SIM_HUGE_SHIFT * o) base pages
+#define SIM_PAGE_4K 0
+#define SIM_PAGE_2M 1
+#define SIM_PAGE_1G 2
+#define SIM_NUM_PAGE_SIZES 3
+#define SIM_HUGE_SHIFT 9
+
+#define SIM_MAX_CPUS 64
+#define SIM_MAX_LEVELS 8
+
+// Outcome of a single page reference
+#define SIM_HIT 0
+#define SIM_FAULT 1
+#define SIM_INVALID 2
+
+// Probability of an illegal address in generated reference strings (same as master.c)
+#define SIM_PROB_ILLEGAL_ADDR REFGEN_PROB_ILLEGAL_ADDR
+
+// Reference string of one process
+typedef struct {
+    int64_t mi;     // Number of required pages
+    int n;          // Length of the reference string
+    int64_t *refs;  // Referenced page numbers
+} sim_proc_trace_t;
+
+// Pages of a process backed by a segment that other processes may map too.
+// Declared in a trace file by a line "seg <process> <first page> <pages> <segment> s|c" before the processes.
+typedef struct {
+    int proc;       // Process slot
+    int64_t first;  // First page of the process mapping segment page 0
+    int64_t pages;  // Pages mapped
+    int seg;        // Segment id
+    int cow;        // 1: copy-on-write (fork), 0: writes go to the shared frame (shared memory, libraries)
+} sim_map_t;
+
+// Reference strings of all the processes of one run
+typedef struct {
+    int k;                    // Number of processes
+    int64_t m;                // Virtual address space size (pages)
+    sim_proc_trace_t *procs;  // Per process reference strings
+    int nmaps;                // Number of shared segment mappings
+    sim_map_t *maps;          // Shared segment mappings
+} sim_trace_t;
+
+// Parameters of one simulation run
+typedef struct {
+    int policy;     // One of SIM_POLICY_*
+    int f;          // Number of physical frames
+    uint64_t seed;  // Seed for randomized policies
+    int log_fd;     // If >= 0, the mmu.c log lines are written to this descriptor
+    pt_spec_t pt;   // Page table organisation
+    tlb_config_t tlb; // TLB hierarchy in front of the page tables
+    double mem_ns;  // Latency of one memory reference (data access or page table step)
+    int sched;      // One of SIM_SCHED_*
+    int ncpus;      // Number of simulated CPUs
+    double quantum_ns;  // Time slice (of the top level for MLFQ, doubling at each level below)
+    int levels;     // Number of MLFQ levels
+    double boost_ns;    // MLFQ: every process is moved back to the top level this often (0 never)
+    double pagein_ns;   // Time a faulting process waits for its page (the disk serves one fault at a time)
+    int prefetch;       // One of SIM_PREFETCH_*
+    int prefetch_depth; // Read-ahead window, stride degree or cluster size
+    double transfer_ns; // Extra disk time for each page prefetched with a page-in
+    double pageout_ns;  // Disk time to write a dirty page back before its frame is reused
+    double writeback_ns;    // Period of the write-back daemon (0 disables it)
+    int writeback_batch;    // Dirty pages the daemon cleans at most per period
+    double copy_ns;     // Time to copy a page when a copy-on-write mapping is written
+    int huge_order;     // Largest page size a process's pages may be promoted to, one of SIM_PAGE_*
+    double huge_threshold;  // Fraction of an aligned block's pages that must be resident to promote it
+    int huge_demote;    // Under memory pressure, split a huge page victim and keep its referenced pages
+} sim_config_t;
+
+// Counters kept per process and for the whole run
+typedef struct {
+    long long references;     // Page references issued (retries after a fault included)
+    long long hits;           // References served from a valid page table entry
+    long long page_faults;    // References that found no valid entry, shared_faults included
+    long long illegal_access; // References beyond the process's pages
+    long long replacements;   // Faults served by evicting a resident page
+    long long no_victim;      // Faults with no free frame and no page to replace
+    long long walks;          // Page table walks
+    long long walk_steps;     // Page table memory references made by the walks
+    long long tlb_hits[TLB_MAX_LEVELS]; // Translations found at each TLB level
+    long long tlb_misses;     // Translations that needed a walk
+    double access_ns;         // Estimated time of the translations and data accesses
+    long long dispatches;     // Times a process was given a CPU
+    double cpu_ns;            // Time spent running on a CPU
+    double ready_ns;          // Time spent waiting in the ready queue
+    double io_ns;             // Time spent waiting for page-ins
+    double turnaround_ns;     // Time from arrival (time 0) to termination
+    long long prefetches;     // Pages loaded ahead of use
+    long long prefetch_hits;  // Prefetched pages referenced while resident (faults avoided)
+    long long prefetch_unused;    // Prefetched pages evicted or freed without being referenced
+    long long prefetch_evictions; // Pages evicted to make room for a prefetch (pollution)
+    long long writes;         // Completed references that wrote their page
+    long long dirty_evictions;    // Evictions that had to write the page back first
+    long long cleaned;        // Dirty pages written back by the daemon
+    long long shared_faults;  // Faults served by a frame another process had already loaded (no page-in)
+    long long cow_faults;     // Writes to a copy-on-write page, which then got a private copy
+    long long promotions;     // Blocks of pages promoted to a huge page
+    long long demotions;      // Huge pages split back into base pages under memory pressure
+    long long bloat_pages;    // Pages made resident by promotions without having been referenced
+    long long promote_fails;  // Promotions given up for want of free contiguous frames, though enough frames were free
+    long long huge_hits;      // Completed references to pages mapped by huge pages
+} sim_stats_t;
+
+// Page table entry of the simulated process (all zero means not mapped)
+typedef struct {
+    int frame;  // Frame allocated
+    int valid;  // Valid bit
+    int order;  // Size of the page mapping it, one of SIM_PAGE_*
+} sim_pte_t;
+
+// Frame table entry, holding the replacement state of the page in the frame
+typedef struct {
+    int owner;      // Process slot using the frame, -1 if the frame is free
+    int64_t page;   // Page held by the frame
+    long last_use;  // Timestamp of the last reference
+    long loaded;    // Timestamp of the page-in
+    int ref;        // Reference bit for the clock policy
+    int pslot;      // Position of the frame in the owner's frame list
+    int prefetched; // Set while a prefetched page has not been referenced
+    int dirty;      // Set when the page was written since it was loaded or cleaned
+    int seg;        // Segment of the page, -1 for a private page
+    int64_t segpage;    // Page within the segment
+    int refs;       // Processes mapping the frame (the owner included)
+    int head;       // First frame of the page the frame belongs to (itself but for the rest of a huge page)
+    int order;      // Size of the page headed by the frame, one of SIM_PAGE_*
+    uint64_t *subref;   // Huge page: bitmap of the base pages referenced, kept by demotion
+} sim_frame_t;
+
+// State of one simulated process
+typedef struct {
+    const sim_proc_trace_t *trace;  // Reference string being executed
+    int pc;                         // Index of the next reference
+    int done;                       // Set when the process has terminated
+    pagetable_t *pt;                // Page table (shared by all processes for PT_HASHED)
+    int *frames;                    // Frames held by the process
+    int nframes;                    // Number of entries in frames
+    int hand;                       // Clock hand over frames
+    int level;                      // MLFQ level (0 is the highest priority)
+    double since;                   // Time the process entered its current queue
+    int64_t last_page;              // Last page referenced (stride detector)
+    int64_t stride;                 // Last difference between two referenced pages
+    int stride_conf;                // Times in a row the stride repeated (saturates at 3)
+    const sim_map_t **maps;         // Shared segments mapped by the process
+    int nmaps;                      // Number of entries in maps
+    int *resident[SIM_NUM_PAGE_SIZES];  // Resident base pages in each aligned block of each huge page size
+    sim_stats_t stats;              // Counters of this process
+} sim_proc_t;
+
+// A simulated CPU
+typedef struct {
+    int slot;       // Process running on the CPU, -1 if idle
+    double clock;   // Time at which the CPU issues its next reference
+    double slice;   // Time used of the running process's quantum
+    double busy;    // Time spent running processes
+} sim_cpu_t;
+
+// A complete simulated system: processes, frames, scheduler and mmu
+typedef struct {
+    sim_config_t config;  // Parameters of the run
+    int k;                // Number of processes
+    sim_proc_t *procs;    // Process slots
+    pt_arena_t arena;     // Memory of the page tables
+    tlb_t *tlbs;          // TLB hierarchy of each CPU
+    sim_cpu_t *cpus;      // CPUs
+    int cpu;              // CPU issuing the current reference
+    pagetable_t *tables;  // Page tables (one per process, or a single hashed table)
+    pagetable_t segtable; // Frames of the resident segment pages, by segment and page (hashed)
+    long shared_saved;    // Frames saved by sharing right now: the sum of refs - 1 over the frames
+    long peak_saved;      // Highest value of shared_saved
+    sim_frame_t *frames;  // Frame table
+    int first_free;       // No free frame below this index
+    int free_frames;      // Frames free
+    int *block_free;      // Free frames in each aligned block of 2 MB worth of frames
+    int nblocks;          // Complete blocks of frames
+    int free_blocks;      // Blocks with all their frames free
+    double frag_sum;      // Fragmentation of the free frames summed over the faults (see sim_fragmentation())
+    long frag_samples;    // Faults sampled
+    int *ready[SIM_MAX_LEVELS];         // Ready queues (circular) of process slots, one per level
+    int rq_head[SIM_MAX_LEVELS], rq_len[SIM_MAX_LEVELS]; // Front and length of each ready queue
+    int *ioq;             // Processes waiting for a page-in, in order of completion
+    double *io_done;      // Completion time of each entry of ioq
+    int io_head, io_len;  // Front and length of the I/O queue
+    double disk_free;     // Time at which the disk finishes its queued page-ins
+    int last_prefetched;  // Pages prefetched by the last fault
+    int last_pageouts;    // Dirty pages the last fault had to write back
+    double next_writeback;    // Time of the next run of the write-back daemon
+    int writeback_hand;   // Next frame the daemon looks at
+    long writeback_stamp; // Timestamp of the daemon's last run
+    double next_boost;    // Time of the next MLFQ boost
+    double makespan;      // Time at which the last process terminated
+    long timestamp;       // Messages handled by the mmu so far
+    uint64_t rng;         // State of the random number generator
+    sim_stats_t total;    // Counters summed over all the processes
+    size_t pt_bytes;      // Memory taken by the page tables
+} sim_t;
+
+uint32_t sim_rand ( uint64_t * ) ;
+double sim_randf ( uint64_t * ) ;
+
+uint64_t sim_rand64 ( uint64_t * ) ;
+
+void sim_trace_generate ( sim_trace_t * , int , int64_t , int , uint64_t , const refgen_spec_t * ) ;
+int sim_trace_load ( sim_trace_t * , const char * ) ;
+int sim_trace_save ( const sim_trace_t * , const char * ) ;
+void sim_trace_free ( sim_trace_t * ) ;
+void sim_trace_share ( sim_trace_t * , int64_t , int ) ;
+
+const char *sim_policy_name ( int ) ;
+int sim_policy_parse ( const char * ) ;
+const char *sim_sched_name ( int ) ;
+int sim_sched_parse ( const char * ) ;
+const char *sim_prefetch_name ( int ) ;
+int sim_prefetch_parse ( const char * ) ;
+const char *sim_page_size_name ( int ) ;
+int sim_page_size_parse ( const char * ) ;
+void sim_config_default ( sim_config_t * ) ;
+void sim_stats_add ( sim_stats_t * , const sim_stats_t * ) ;
+double sim_stats_eat ( const sim_stats_t * ) ;
+double sim_stats_eat_faults ( const sim_stats_t * ) ;
+double sim_utilization ( const sim_t * ) ;
+double sim_fragmentation ( const sim_t * ) ;
+
+int sim_init ( sim_t * , const sim_trace_t * , const sim_config_t * ) ;
+int sim_access ( sim_t * , int , int64_t , double * ) ;
+void sim_terminate ( sim_t * , int ) ;
+void sim_run ( sim_t * ) ;
+void sim_destroy ( sim_t * ) ;
+
+#endif
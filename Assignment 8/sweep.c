@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sim.h>
+
+#define MAX_VALUES 1024
+#define MAX_TABLES 16
+#define MAX_TLBS 16
+
+// One configuration of the sweep
+typedef struct {
+    sim_config_t config;      // Parameters of the run
+    int k;                    // Number of processes
+    int seed_idx;             // Index of the generated trace among the seeds
+    const sim_trace_t *trace; // Reference strings of the run
+    sim_stats_t stats;        // Totals of the run
+    sim_stats_t *proc_stats;  // Per process counters (only with -d)
+    double util;              // CPU utilization
+    double makespan;          // Simulated time until the last process terminated
+    long elapsed_us;          // Wall time of the run
+    size_t pt_bytes;          // Page table memory of the run
+    long peak_saved;          // Most frames saved at once by shared segments
+    double frag;              // Mean fragmentation of the free frames at the faults
+    char table_name[64];      // Page table shape as fitted to the trace
+    int status;               // 0 on success
+} job_t;
+
+// Per process reporting
+int detail = 0;
+
+// Jobs shared by the worker threads
+job_t *jobs = NULL;
+int num_jobs = 0;
+int next_job = 0;
+
+// Parse "a,b,c", "lo:hi" or "lo:hi:step" into vals, returns the number of values
+int parse_values(const char *arg, int *vals) {
+    int n = 0;
+    char *copy = strdup(arg);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        int lo, hi, step = 1;
+        int cnt = sscanf(tok, "%d:%d:%d", &lo, &hi, &step);
+        if (cnt == 1) hi = lo;
+        if (cnt < 1 || step < 1) {
+            fprintf(stderr, "Invalid value list: %s\n", arg);
+            exit(1);
+        }
+        for (int v = lo; v <= hi && n < MAX_VALUES; v += step) {
+            vals[n++] = v;
+        }
+    }
+    free(copy);
+    return n;
+}
+
+// Parse a comma separated list of names (or "all") with the given parser
+int parse_names(const char *arg, int *vals, int count, int (*parse)(const char *), const char *what) {
+    int n = 0;
+    if (strcmp(arg, "all") == 0) {
+        for (int i = 0; i < count; i++) vals[n++] = i;
+        return n;
+    }
+    char *copy = strdup(arg);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        int v = parse(tok);
+        if (v == -1) {
+            fprintf(stderr, "Unknown %s: %s\n", what, tok);
+            exit(1);
+        }
+        if (n < MAX_VALUES) vals[n++] = v;
+    }
+    free(copy);
+    return n;
+}
+
+// Microseconds on the monotonic clock
+long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// Worker thread: run jobs until none are left
+void *worker(void *arg) {
+    (void)arg;
+    while (1) {
+        int idx = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED);
+        if (idx >= num_jobs) break;
+        job_t *job = &jobs[idx];
+
+        sim_t sim;
+        long start = now_us();
+        job->status = sim_init(&sim, job->trace, &job->config);
+        if (job->status == 0) {
+            sim_run(&sim);
+            job->stats = sim.total;
+            job->pt_bytes = sim.pt_bytes;
+            job->util = sim_utilization(&sim);
+            job->makespan = sim.makespan;
+            job->peak_saved = sim.peak_saved;
+            job->frag = sim_fragmentation(&sim);
+            pt_spec_name(&sim.config.pt, job->table_name, sizeof(job->table_name));
+            if (detail) {
+                job->proc_stats = (sim_stats_t *)malloc(sim.k * sizeof(sim_stats_t));
+                for (int i = 0; i < sim.k; i++) job->proc_stats[i] = sim.procs[i].stats;
+            }
+            sim_destroy(&sim);
+        }
+        job->elapsed_us = now_us() - start;
+    }
+    return NULL;
+}
+
+void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-p policies] [-f frames] [-k processes] [-m pages | -a address bits] [-n max refs] [-G model] [-W write fraction] [-P page table]... [-T tlb]... [-F] [-M mem ns] "
+                    "[-C schedulers] [-c cpus] [-q quantum ns] [-L levels] [-B boost ns] [-I page-in ns] [-R prefetch] [-D depths] [-X transfer ns] [-O page-out ns] [-Y write-back ns] [-b batch] [-H pages[:cow]] [-K copy ns] [-Z page sizes] [-U threshold] [-N] [-d] [-s seeds] [-S base seed] [-t trace file] [-j threads]\n", prog);
+    fprintf(stderr, "\tpolicies: comma separated list of lru, fifo, clock, random or 'all' (default lru)\n");
+    fprintf(stderr, "\tframes, processes, cpus: comma separated values or lo:hi[:step] ranges (defaults 1:64, 10 and 1)\n");
+    fprintf(stderr, "\tpages: virtual address space size of generated traces (default 25)\n");
+    fprintf(stderr, "\taddress bits: virtual address space of 2^bits bytes (12 to 63) with 4 KB pages, instead of -m\n");
+    fprintf(stderr, "\tmax refs: cap on the length of each generated reference string (default none)\n");
+    fprintf(stderr, "\tmodel: locality of generated traces, uniform, zipf[:s], phase[:pages[:refs]], seq[:pages] or loop[:pages[:iterations]],\n"
+                    "\t       or a mixture such as zipf*3+seq:32*1, then @p for a probability p of an illegal address\n"
+                    "\t       (default uniform without illegal addresses; uniform@0.1 has the distribution of master.c)\n");
+    fprintf(stderr, "\twrite fraction: probability that a generated reference writes its page (default 0)\n");
+    fprintf(stderr, "\tpage table: dense, hashed[:buckets], radix[levels] or radix:b1,b2,... (or b1-b2-...); repeat to compare (default dense)\n");
+    fprintf(stderr, "\ttlb: none or levels joined by '+', each entries[:ways[:lru|fifo|random[:ns]]]; repeat to compare (default none)\n");
+    fprintf(stderr, "\t-F: flush the TLB on every context switch instead of tagging entries with the process\n");
+    fprintf(stderr, "\tmem ns: latency of a memory reference used for the effective access time (default 100)\n");
+    fprintf(stderr, "\tschedulers: comma separated list of fifo, rr, mlfq or 'all' (default fifo, the policy of sched.c)\n");
+    fprintf(stderr, "\tquantum ns, levels, boost ns: time slice, MLFQ levels and MLFQ boost period (defaults 10000, 3, 1000000)\n");
+    fprintf(stderr, "\tpage-in ns: time a faulting process is blocked waiting for the disk (default 0)\n");
+    fprintf(stderr, "\tprefetch: comma separated list of none, readahead, stride, cluster or 'all' (default none)\n");
+    fprintf(stderr, "\tdepths: read-ahead window, stride degree or cluster size, values or ranges (default 4)\n");
+    fprintf(stderr, "\ttransfer ns: extra disk time per page prefetched along with a page-in (default 0)\n");
+    fprintf(stderr, "\tpage-out ns: disk time to write a dirty page back before its frame is reused (default 0)\n");
+    fprintf(stderr, "\twrite-back ns, batch: period of the write-back daemon (default 0, off) and pages it cleans per period (default 8)\n");
+    fprintf(stderr, "\tpages[:cow]: every generated process maps its first pages from one shared segment, copy-on-write with ':cow'\n");
+    fprintf(stderr, "\tcopy ns: time to copy a page when a copy-on-write page is written (default 0)\n");
+    fprintf(stderr, "\tpage sizes: comma separated list of the largest page size processes may use, 4k, 2m, 1g or 'all' (default 4k)\n");
+    fprintf(stderr, "\tthreshold: fraction of an aligned block's pages resident for it to be promoted to a huge page (default 0.5)\n");
+    fprintf(stderr, "\t-N: evict huge pages whole instead of splitting them under memory pressure\n");
+    fprintf(stderr, "\t-d: also report every process of every configuration\n");
+    fprintf(stderr, "\tseeds: number of generated traces per process count (default 1)\n");
+    fprintf(stderr, "\ttrace file: use this trace instead of generated ones (-k, -m and -s are ignored)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int policies[MAX_VALUES], frames[MAX_VALUES], procs[MAX_VALUES], scheds[MAX_VALUES], cpus[MAX_VALUES];
+    int prefetches[MAX_VALUES], depths[MAX_VALUES], sizes[MAX_VALUES];
+    int np = 1, nf, nk = 1, ns = 1, nc = 1, nr = 1, nd = 1, nz = 1;
+    pt_spec_t tables[MAX_TABLES];
+    tlb_config_t tlbs[MAX_TLBS];
+    int num_tables = 0, num_tlbs = 0;
+    int64_t m = 25;
+    int nseeds = 1, maxn = 0, flush = 0;
+    uint64_t base_seed = 1;
+    int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char *trace_file = NULL;
+    refgen_spec_t model;
+    refgen_parse(&model, "uniform");
+    double writes = 0.0;
+    int64_t shared_pages = 0;
+    int shared_cow = 0;
+
+    // Parameters shared by every configuration
+    sim_config_t base;
+    sim_config_default(&base);
+
+    policies[0] = SIM_POLICY_LRU;
+    nf = parse_values("1:64", frames);
+    procs[0] = 10;
+    scheds[0] = SIM_SCHED_FIFO;
+    cpus[0] = 1;
+    prefetches[0] = SIM_PREFETCH_NONE;
+    depths[0] = base.prefetch_depth;
+    sizes[0] = SIM_PAGE_4K;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:f:k:m:a:n:G:W:P:T:FM:C:c:q:L:B:I:R:D:X:O:Y:b:H:K:Z:U:Nds:S:t:j:h")) != -1) {
+        switch (opt) {
+            case 'p': np = parse_names(optarg, policies, SIM_NUM_POLICIES, sim_policy_parse, "replacement policy"); break;
+            case 'f': nf = parse_values(optarg, frames); break;
+            case 'k': nk = parse_values(optarg, procs); break;
+            case 'm': m = strtoll(optarg, NULL, 10); break;
+            case 'a': {
+                // 4 KB pages: at least 12 bits, at most the width of a virtual address
+                char *end;
+                long bits = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || bits < 12 || bits > 63) usage(argv[0]);
+                m = (int64_t)1 << (bits - 12);
+                break;
+            }
+            case 'n': maxn = atoi(optarg); break;
+            case 'G':
+                if (refgen_parse(&model, optarg) != 0) {
+                    fprintf(stderr, "Invalid locality model: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'W': writes = atof(optarg); break;
+            case 'P':
+                if (num_tables == MAX_TABLES || pt_spec_parse(&tables[num_tables], optarg) != 0) {
+                    fprintf(stderr, "Invalid page table: %s\n", optarg);
+                    exit(1);
+                }
+                num_tables++;
+                break;
+            case 'T':
+                if (num_tlbs == MAX_TLBS || tlb_config_parse(&tlbs[num_tlbs], optarg) != 0) {
+                    fprintf(stderr, "Invalid TLB: %s\n", optarg);
+                    exit(1);
+                }
+                tlbs[num_tlbs++].tagged = 1;
+                break;
+            case 'F': flush = 1; break;
+            case 'M': base.mem_ns = atof(optarg); break;
+            case 'C': ns = parse_names(optarg, scheds, SIM_NUM_SCHEDS, sim_sched_parse, "scheduler"); break;
+            case 'c': nc = parse_values(optarg, cpus); break;
+            case 'q': base.quantum_ns = atof(optarg); break;
+            case 'L': base.levels = atoi(optarg); break;
+            case 'B': base.boost_ns = atof(optarg); break;
+            case 'I': base.pagein_ns = atof(optarg); break;
+            case 'R': nr = parse_names(optarg, prefetches, SIM_NUM_PREFETCH, sim_prefetch_parse, "prefetch strategy"); break;
+            case 'D': nd = parse_values(optarg, depths); break;
+            case 'X': base.transfer_ns = atof(optarg); break;
+            case 'O': base.pageout_ns = atof(optarg); break;
+            case 'Y': base.writeback_ns = atof(optarg); break;
+            case 'b': base.writeback_batch = atoi(optarg); break;
+            case 'H':
+                shared_pages = strtoll(optarg, NULL, 10);
+                shared_cow = (strstr(optarg, ":cow") != NULL);
+                break;
+            case 'K': base.copy_ns = atof(optarg); break;
+            case 'Z': nz = parse_names(optarg, sizes, SIM_NUM_PAGE_SIZES, sim_page_size_parse, "page size"); break;
+            case 'U': base.huge_threshold = atof(optarg); break;
+            case 'N': base.huge_demote = 0; break;
+            case 'd': detail = 1; break;
+            case 's': nseeds = atoi(optarg); break;
+            case 'S': base_seed = strtoull(optarg, NULL, 10); break;
+            case 't': trace_file = optarg; break;
+            case 'j': nthreads = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (m < 1 || nseeds < 1 || nk < 1 || nf < 1 || np < 1 || ns < 1 || nc < 1 || nr < 1 || nd < 1 || nz < 1) usage(argv[0]);
+    if (nthreads < 1) nthreads = 1;
+    model.writes = writes;
+    if (num_tables == 0) pt_spec_parse(&tables[num_tables++], "dense");
+    if (num_tlbs == 0) tlb_config_parse(&tlbs[num_tlbs++], "none");
+    for (int i = 0; i < num_tlbs; i++) tlbs[i].tagged = !flush;
+
+    // Traces are generated once and shared (read only) by all the runs that use them
+    int ntraces = trace_file ? 1 : nk * nseeds;
+    sim_trace_t *traces = (sim_trace_t *)calloc(ntraces, sizeof(sim_trace_t));
+    if (trace_file) {
+        if (sim_trace_load(&traces[0], trace_file) != 0) exit(1);
+        nk = 1;
+        nseeds = 1;
+        procs[0] = traces[0].k;
+        m = traces[0].m;
+    } else {
+        for (int i = 0; i < nk; i++) {
+            if (procs[i] < 1) usage(argv[0]);
+            for (int s = 0; s < nseeds; s++) {
+                sim_trace_generate(&traces[i * nseeds + s], procs[i], m, maxn, base_seed + s, &model);
+                if (shared_pages > 0) sim_trace_share(&traces[i * nseeds + s], shared_pages, shared_cow);
+            }
+        }
+    }
+
+    // One job per configuration; the index is decoded digit by digit, the frame count varying fastest
+    int dims[11] = {num_tables, num_tlbs, ns, nc, np, nr, nd, nz, nk, nseeds, nf};
+    num_jobs = 1;
+    for (int d = 0; d < 11; d++) num_jobs *= dims[d];
+    jobs = (job_t *)calloc(num_jobs, sizeof(job_t));
+    for (int idx = 0; idx < num_jobs; idx++) {
+        int digit[11], rest = idx;
+        for (int d = 10; d >= 0; d--) {
+            digit[d] = rest % dims[d];
+            rest /= dims[d];
+        }
+        job_t *job = &jobs[idx];
+        job->config = base;
+        job->config.pt = tables[digit[0]];
+        job->config.tlb = tlbs[digit[1]];
+        job->config.sched = scheds[digit[2]];
+        job->config.ncpus = cpus[digit[3]];
+        job->config.policy = policies[digit[4]];
+        job->config.prefetch = prefetches[digit[5]];
+        job->config.prefetch_depth = depths[digit[6]];
+        job->config.huge_order = sizes[digit[7]];
+        job->k = procs[digit[8]];
+        job->seed_idx = digit[9];
+        job->config.f = frames[digit[10]];
+        job->config.seed = idx + 1;
+        job->trace = &traces[digit[8] * nseeds + digit[9]];
+    }
+
+    // Run the jobs on a pool of threads
+    if (nthreads > num_jobs) nthreads = num_jobs;
+    pthread_t *tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    long start = now_us();
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&tids[i], NULL, worker, NULL);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    long elapsed = now_us() - start;
+
+    // Report the results as CSV in the order of the configurations
+    char model_name[256];
+    if (trace_file) snprintf(model_name, sizeof(model_name), "file");
+    else refgen_name(&model, model_name, sizeof(model_name));
+    printf("pagetable,tlb,sched,cpus,policy,prefetch,depth,k,m,model,f,seed,proc,references,hits,page_faults,demand_faults,illegal_access,replacements,fault_rate,"
+           "walks,walk_steps,tlb_hit_rate,eat_ns,pt_bytes,dispatches,turnaround_us,util,throughput,"
+           "prefetches,prefetch_accuracy,prefetch_coverage,prefetch_unused,prefetch_evictions,"
+           "writes,dirty_evictions,cleaned,eat_fault_ns,shared_faults,cow_faults,peak_saved,"
+           "page_size,promotions,demotions,bloat_pages,promote_fails,huge_hits,frag,time_us\n");
+    for (int i = 0; i < num_jobs; i++) {
+        job_t *job = &jobs[i];
+        if (job->status != 0) continue;
+        char tlb_name[128];
+        tlb_config_name(&job->config.tlb, tlb_name, sizeof(tlb_name));
+        for (int p = (detail ? 0 : job->k); p <= job->k; p++) {
+            // Rows for each process first, then the totals of the run
+            sim_stats_t *st = (p < job->k) ? &job->proc_stats[p] : &job->stats;
+            int nprocs = (p < job->k) ? 1 : job->k;
+            char proc[16];
+            if (p < job->k) sprintf(proc, "%d", p + 1);
+            else sprintf(proc, "all");
+            // Faults that needed a page-in; those served by another process's frame are reported as shared_faults
+            long long demand_faults = st->page_faults - st->shared_faults;
+            double rate = st->references ? (double)demand_faults / st->references : 0.0;
+            long long tlb_hits = 0;
+            for (int l = 0; l < TLB_MAX_LEVELS; l++) tlb_hits += st->tlb_hits[l];
+            double tlb_rate = (tlb_hits + st->tlb_misses) ? (double)tlb_hits / (tlb_hits + st->tlb_misses) : 0.0;
+            // Throughput in processes per simulated second
+            double throughput = (job->makespan > 0) ? job->k / (job->makespan * 1e-9) : 0.0;
+            // Accuracy: prefetched pages that were used; coverage: faults avoided out of those there would have been
+            double accuracy = st->prefetches ? (double)st->prefetch_hits / st->prefetches : 0.0;
+            double coverage = (st->prefetch_hits + demand_faults) ? (double)st->prefetch_hits / (st->prefetch_hits + demand_faults) : 0.0;
+            printf("%s,%s%s,%s,%d,%s,%s,%d,%d,%lld,%s,%d,%llu,%s,%lld,%lld,%lld,%lld,%lld,%lld,%.6f,%lld,%lld,%.6f,%.2f,%zu,%lld,%.3f,%.4f,%.1f,"
+                   "%lld,%.6f,%.6f,%lld,%lld,%lld,%lld,%lld,%.2f,%lld,%lld,%ld,%s,%lld,%lld,%lld,%lld,%lld,%.4f,%ld\n",
+                   job->table_name, tlb_name, (job->config.tlb.nlevels && !job->config.tlb.tagged) ? "/flush" : "",
+                   sim_sched_name(job->config.sched), job->config.ncpus,
+                   sim_policy_name(job->config.policy), sim_prefetch_name(job->config.prefetch), job->config.prefetch_depth,
+                   job->k, (long long)m, model_name, job->config.f,
+                   (unsigned long long)(trace_file ? 0 : base_seed + job->seed_idx), proc,
+                   st->references, st->hits, st->page_faults, demand_faults,
+                   st->illegal_access, st->replacements, rate,
+                   st->walks, st->walk_steps, tlb_rate, sim_stats_eat(st), job->pt_bytes,
+                   st->dispatches, st->turnaround_ns / nprocs / 1000.0, job->util, throughput,
+                   st->prefetches, accuracy, coverage, st->prefetch_unused, st->prefetch_evictions,
+                   st->writes, st->dirty_evictions, st->cleaned, sim_stats_eat_faults(st),
+                   st->shared_faults, st->cow_faults, (p < job->k) ? 0 : job->peak_saved,
+                   sim_page_size_name(job->config.huge_order), st->promotions, st->demotions, st->bloat_pages, st->promote_fails,
+                   st->huge_hits, job->frag, job->elapsed_us);
+        }
+        free(job->proc_stats);
+    }
+    fprintf(stderr, "%d configurations on %d threads in %.3f s\n", num_jobs, nthreads, elapsed / 1e6);
+
+    for (int i = 0; i < ntraces; i++) {
+        sim_trace_free(&traces[i]);
+    }
+    free(traces);
+    free(jobs);
+    free(tids);
+
+    return 0;
+}
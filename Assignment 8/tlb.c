@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tlb.h>
+
+// Names of the replacement policies, indexed by TLB_*
+static const char *tlb_policy_names[] = {"lru", "fifo", "random"};
+
+// Default lookup latency (ns) of each level when the spec does not give one
+static const double default_hit_ns[TLB_MAX_LEVELS] = {1.0, 7.0, 20.0};
+
+// Parse "none" or levels joined by '+', each "entries[:ways[:policy[:ns]]]", e.g. "64:4+1536:12:lru:7"
+int tlb_config_parse(tlb_config_t *config, const char *str) {
+    int tagged = config->tagged;
+    memset(config, 0, sizeof(tlb_config_t));
+    config->tagged = tagged;
+    if (strcmp(str, "none") == 0) return 0;
+
+    char *copy = strdup(str);
+    char *save = NULL;
+    int status = 0;
+    for (char *tok = strtok_r(copy, "+", &save); tok != NULL; tok = strtok_r(NULL, "+", &save)) {
+        if (config->nlevels == TLB_MAX_LEVELS) {
+            status = -1;
+            break;
+        }
+        tlb_level_config_t *lc = &config->level[config->nlevels];
+        char policy[16] = "lru";
+        lc->ways = 0;
+        lc->hit_ns = default_hit_ns[config->nlevels];
+        int n = sscanf(tok, "%d:%d:%15[a-z]:%lf", &lc->entries, &lc->ways, policy, &lc->hit_ns);
+        if (n < 1 || lc->entries < 1 || lc->ways < 0 || lc->hit_ns < 0) {
+            status = -1;
+            break;
+        }
+        if (lc->ways == 0 || lc->ways > lc->entries) lc->ways = lc->entries;
+        if (lc->entries % lc->ways != 0) {
+            status = -1;
+            break;
+        }
+        lc->policy = -1;
+        for (int i = 0; i < 3; i++) {
+            if (strcmp(policy, tlb_policy_names[i]) == 0) lc->policy = i;
+        }
+        if (lc->policy == -1) {
+            status = -1;
+            break;
+        }
+        config->nlevels++;
+    }
+    free(copy);
+    return status;
+}
+
+// Printable form of a TLB shape, e.g. "64:4:lru+1536:12:lru"
+void tlb_config_name(const tlb_config_t *config, char *buf, int len) {
+    if (config->nlevels == 0) {
+        snprintf(buf, len, "none");
+        return;
+    }
+    int n = 0;
+    for (int i = 0; i < config->nlevels && n < len; i++) {
+        const tlb_level_config_t *lc = &config->level[i];
+        n += snprintf(buf + n, len - n, "%s%d:%d:%s", i ? "+" : "", lc->entries, lc->ways, tlb_policy_names[lc->policy]);
+    }
+}
+
+// Build an empty TLB hierarchy
+int tlb_init(tlb_t *tlb, const tlb_config_t *config, uint64_t seed) {
+    memset(tlb, 0, sizeof(tlb_t));
+    tlb->config = *config;
+    tlb->cur_asid = -1;
+    tlb->rng = seed ? seed : 1;
+
+    for (int i = 0; i < config->nlevels; i++) {
+        tlb_level_t *lv = &tlb->level[i];
+        lv->config = config->level[i];
+        lv->ways = lv->config.ways;
+        lv->nsets = lv->config.entries / lv->ways;
+        lv->entries = (tlb_entry_t *)calloc(lv->config.entries, sizeof(tlb_entry_t));
+        if (lv->entries == NULL) return -1;
+    }
+    return 0;
+}
+
+// Set index of a translation (ASID mixed in so processes do not all collide on the same sets)
+static int set_of(tlb_level_t *lv, int asid, int64_t page) {
+    return (int)(((uint64_t)page ^ ((uint64_t)asid * 0x9E3779B1u)) % (uint64_t)lv->nsets);
+}
+
+// Matching entry of a level for a page number in units of 2^shift pages, NULL if the translation is not cached there
+static tlb_entry_t *find(tlb_level_t *lv, int asid, int64_t page, int shift) {
+    tlb_entry_t *set = &lv->entries[set_of(lv, asid, page) * lv->ways];
+    for (int w = 0; w < lv->ways; w++) {
+        if (set[w].valid && set[w].page == page && set[w].shift == shift && set[w].asid == asid) return &set[w];
+    }
+    return NULL;
+}
+
+// Entry of a level covering a base page, whatever its size; the levels hold all the page sizes in use
+static tlb_entry_t *find_any(tlb_t *tlb, tlb_level_t *lv, int asid, int64_t page) {
+    tlb_entry_t *e = find(lv, asid, page, 0);
+    for (int s = 1; e == NULL && (tlb->shifts >> s) != 0; s++) {
+        if (tlb->shifts & (1u << s)) e = find(lv, asid, page >> s, s);
+    }
+    return e;
+}
+
+// Place a translation in a level, replacing an entry of its set if needed
+static void fill(tlb_t *tlb, tlb_level_t *lv, int asid, int64_t page, int shift, int frame) {
+    tlb_entry_t *e = find(lv, asid, page, shift);
+    if (e == NULL) {
+        tlb_entry_t *set = &lv->entries[set_of(lv, asid, page) * lv->ways];
+        for (int w = 0; w < lv->ways && e == NULL; w++) {
+            if (!set[w].valid) e = &set[w];
+        }
+        if (e == NULL) {
+            if (lv->config.policy == TLB_RANDOM) {
+                uint64_t x = tlb->rng;
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                tlb->rng = x;
+                e = &set[x % lv->ways];
+            } else {
+                e = &set[0];
+                for (int w = 1; w < lv->ways; w++) {
+                    long a = (lv->config.policy == TLB_LRU) ? set[w].used : set[w].inserted;
+                    long b = (lv->config.policy == TLB_LRU) ? e->used : e->inserted;
+                    if (a < b) e = &set[w];
+                }
+            }
+        }
+        e->inserted = tlb->clock;
+    }
+    e->valid = 1;
+    e->asid = asid;
+    e->page = page;
+    e->shift = shift;
+    e->frame = frame;
+    e->used = tlb->clock;
+}
+
+// Look a translation up level by level. Returns the level that hit (and the frame), or -1 on a miss.
+// The latency of every level probed is added to *ns. A hit below the first level refills the levels above.
+int tlb_lookup(tlb_t *tlb, int asid, int64_t page, int *frame, double *ns) {
+    tlb->clock++;
+    for (int i = 0; i < tlb->config.nlevels; i++) {
+        tlb_level_t *lv = &tlb->level[i];
+        lv->lookups++;
+        *ns += lv->config.hit_ns;
+        tlb_entry_t *e = find_any(tlb, lv, asid, page);
+        if (e != NULL) {
+            lv->hits++;
+            e->used = tlb->clock;
+            *frame = e->frame + (int)(page & (((int64_t)1 << e->shift) - 1));
+            for (int j = 0; j < i; j++) fill(tlb, &tlb->level[j], asid, e->page, e->shift, e->frame);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Cache a translation found by a page table walk in every level
+void tlb_insert(tlb_t *tlb, int asid, int64_t page, int frame) {
+    tlb_insert_size(tlb, asid, page, frame, 0);
+}
+
+// Cache the translation of a page mapped as part of an aligned block of 2^shift pages (a huge page):
+// one entry then covers the whole block
+void tlb_insert_size(tlb_t *tlb, int asid, int64_t page, int frame, int shift) {
+    int64_t first = page & ~(((int64_t)1 << shift) - 1);
+    tlb->shifts |= 1u << shift;
+    for (int i = 0; i < tlb->config.nlevels; i++) {
+        fill(tlb, &tlb->level[i], asid, page >> shift, shift, frame - (int)(page - first));
+    }
+}
+
+// Drop the translation of a page from every level (the page was unmapped); a huge entry covering it goes too
+void tlb_invalidate(tlb_t *tlb, int asid, int64_t page) {
+    for (int i = 0; i < tlb->config.nlevels; i++) {
+        tlb_entry_t *e;
+        while ((e = find_any(tlb, &tlb->level[i], asid, page)) != NULL) e->valid = 0;
+    }
+}
+
+// Drop all the translations of a process, or of every process if asid is -1
+void tlb_flush(tlb_t *tlb, int asid) {
+    for (int i = 0; i < tlb->config.nlevels; i++) {
+        tlb_level_t *lv = &tlb->level[i];
+        for (int j = 0; j < lv->config.entries; j++) {
+            if (asid == -1 || lv->entries[j].asid == asid) lv->entries[j].valid = 0;
+        }
+    }
+}
+
+// Context switch to a process; an untagged TLB loses all its translations
+void tlb_switch(tlb_t *tlb, int asid) {
+    if (asid == tlb->cur_asid) return;
+    if (!tlb->config.tagged && tlb->cur_asid != -1) {
+        tlb_flush(tlb, -1);
+        tlb->flushes++;
+    }
+    tlb->cur_asid = asid;
+}
+
+// Release the entries of every level
+void tlb_destroy(tlb_t *tlb) {
+    for (int i = 0; i < tlb->config.nlevels; i++) {
+        free(tlb->level[i].entries);
+        tlb->level[i].entries = NULL;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef __TLB_H
+#define __TLB_H
+
+#include <stdint.h>
+
+#define TLB_MAX_LEVELS 3
+
+// Replacement within a set
+#define TLB_LRU 0
+#define TLB_FIFO 1
+#define TLB_RANDOM 2
+
+// Shape of one TLB level
+typedef struct {
+    int entries;    // Number of entries
+    int ways;       // Associativity (0 or entries means fully associative)
+    int policy;     // One of TLB_LRU, TLB_FIFO, TLB_RANDOM
+    double hit_ns;  // Latency of a lookup at this level
+} tlb_level_config_t;
+
+// Shape of the whole TLB hierarchy
+typedef struct {
+    int nlevels;                                // 0 disables the TLB
+    tlb_level_config_t level[TLB_MAX_LEVELS];   // First level first
+    int tagged;                                 // 1: entries carry an ASID, 0: flush on every switch
+} tlb_config_t;
+
+// Cached translation
+typedef struct {
+    int valid;
+    int asid;       // Process slot of the translation
+    int64_t page;   // Virtual page number, in units of the entry's page size
+    int shift;      // The entry maps 2^shift base pages (0 for a base page)
+    int frame;      // Frame the page is mapped to (the first of the 2^shift)
+    long used;      // Time of the last hit (LRU)
+    long inserted;  // Time of the fill (FIFO)
+} tlb_entry_t;
+
+// One level of the hierarchy
+typedef struct {
+    tlb_level_config_t config;
+    int nsets;            // Number of sets
+    int ways;             // Entries per set
+    tlb_entry_t *entries; // nsets * ways entries, set after set
+    long long lookups;    // Lookups that reached this level
+    long long hits;       // Lookups that hit at this level
+} tlb_level_t;
+
+// A TLB hierarchy
+typedef struct {
+    tlb_config_t config;
+    tlb_level_t level[TLB_MAX_LEVELS];
+    int cur_asid;     // Process whose translations are loaded (flush mode)
+    long clock;       // Lookup counter used for the replacement timestamps
+    unsigned shifts;  // Bit s is set once an entry of 2^s pages was inserted (the sizes a lookup probes)
+    uint64_t rng;     // State for random replacement
+    long long flushes;
+} tlb_t;
+
+int tlb_config_parse ( tlb_config_t * , const char * ) ;
+void tlb_config_name ( const tlb_config_t * , char * , int ) ;
+
+int tlb_init ( tlb_t * , const tlb_config_t * , uint64_t ) ;
+int tlb_lookup ( tlb_t * , int , int64_t , int * , double * ) ;
+void tlb_insert ( tlb_t * , int , int64_t , int ) ;
+void tlb_insert_size ( tlb_t * , int , int64_t , int , int ) ;
+void tlb_invalidate ( tlb_t * , int , int64_t ) ;
+void tlb_flush ( tlb_t * , int ) ;
+void tlb_switch ( tlb_t * , int ) ;
+void tlb_destroy ( tlb_t * ) ;
+
+#endif